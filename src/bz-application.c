@@ -22,6 +22,7 @@
 #define BAZAAR_MODULE "core"
 
 #define MAX_IDS_PER_BLOCKLIST 2048
+#define GROUPS_CACHE_CHUNK    256
 
 #include "config.h"
 
@@ -57,11 +58,13 @@
 #include "bz-newline-parser.h"
 #include "bz-parser.h"
 #include "bz-preferences-dialog.h"
+#include "bz-refresh-delta.h"
 #include "bz-result.h"
 #include "bz-root-blocklist.h"
 #include "bz-root-curated-config.h"
 #include "bz-serializable.h"
 #include "bz-state-info.h"
+#include "bz-trace.h"
 #include "bz-transaction-manager.h"
 #include "bz-util.h"
 #include "bz-window.h"
@@ -88,6 +91,10 @@ struct _BzApplication
   BzNewlineParser            *txt_blocklist_parser;
   BzSearchEngine             *search_engine;
   BzStateInfo                *state;
+  BzTraceSpan                *flathub_span;
+  BzTraceSpan                *startup_span;
+  BzTraceSpan                *sync_span;
+  BzTraceSpan                *worker_span;
   BzTransactionManager       *transactions;
   BzYamlParser               *blocklist_parser;
   BzYamlParser               *curated_parser;
@@ -99,6 +106,7 @@ struct _BzApplication
   GHashTable                 *eol_runtimes;
   GHashTable                 *ids_to_groups;
   GHashTable                 *ignore_eol_set;
+  GHashTable                 *installed_groups;
   GHashTable                 *installed_set;
   GHashTable                 *sys_name_to_addons;
   GHashTable                 *sys_ref_to_addon_group_ids;
@@ -109,6 +117,8 @@ struct _BzApplication
   GListStore                 *search_biases_backing;
   GNetworkMonitor            *network;
   GPtrArray                  *blocklist_regexes;
+  GPtrArray                  *pending_groups;
+  GPtrArray                  *pending_installed;
   GPtrArray                  *txt_blocked_id_sets;
   GSettings                  *settings;
   GTimer                     *init_timer;
@@ -123,8 +133,10 @@ struct _BzApplication
   GtkStringList              *blocklists;
   GtkStringList              *curated_configs;
   GtkStringList              *txt_blocklists;
+  gboolean                    entries_enumerated;
   gboolean                    flathub_remote_initialized;
   gboolean                    running;
+  guint                       group_batch_depth;
   guint                       periodic_timeout_source;
   int                         n_entries_incoming;
   int                         n_remotes_syncing;
@@ -192,6 +204,41 @@ BZ_DEFINE_DATA (
     },
     BZ_RELEASE_DATA (cache, g_object_unref))
 
+BZ_DEFINE_DATA (
+    refresh_worker,
+    RefreshWorker,
+    {
+      GWeakRef    *self;
+      GSubprocess *subprocess;
+      gboolean     deltas;
+      GPtrArray   *checksums;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (subprocess, g_object_unref);
+    BZ_RELEASE_DATA (checksums, g_ptr_array_unref))
+
+BZ_DEFINE_DATA (
+    apply_refresh_deltas,
+    ApplyRefreshDeltas,
+    {
+      GWeakRef  *self;
+      GPtrArray *entries;
+      GPtrArray *checksums;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (entries, g_ptr_array_unref);
+    BZ_RELEASE_DATA (checksums, g_ptr_array_unref))
+
+BZ_DEFINE_DATA (
+    decode_groups,
+    DecodeGroups,
+    {
+      GVariant *variant;
+      gsize     offset;
+      gsize     n_children;
+    },
+    BZ_RELEASE_DATA (variant, g_variant_unref))
+
 static DexFuture *
 init_fiber (GWeakRef *wr);
 
@@ -204,6 +251,19 @@ enumerate_disk_io_fiber (EnumerateDiskIoData *data);
 static DexFuture *
 enumerate_disk_entries_fiber (GWeakRef *wr);
 
+static DexFuture *
+refresh_worker_fiber (RefreshWorkerData *data);
+
+static gboolean
+read_refresh_delta (GInputStream        *input,
+                    BzRefreshDeltaFrame *frame,
+                    char               **checksum,
+                    GBytes             **bytes,
+                    GError             **error);
+
+static DexFuture *
+apply_refresh_deltas_fiber (ApplyRefreshDeltasData *data);
+
 static DexFuture *
 check_for_updates_fiber (GWeakRef *wr);
 
@@ -223,8 +283,8 @@ static DexFuture *
 open_flatpakref_fiber (OpenFlatpakrefData *data);
 
 static DexFuture *
-backend_sync_finally (DexFuture *future,
-                      GWeakRef  *wr);
+backend_sync_finally (DexFuture         *future,
+                      RefreshWorkerData *data);
 
 static DexFuture *
 backend_sync_save_groups_finally (DexFuture *future,
@@ -262,6 +322,24 @@ ensure_group_and_add (BzApplication *self,
                       gboolean       ignore_eol,
                       gboolean       installed);
 
+static void
+begin_group_batch (BzApplication *self);
+
+static void
+end_group_batch (BzApplication *self);
+
+static void
+groups_append (BzApplication *self,
+               BzEntryGroup  *group);
+
+static void
+installed_apps_add (BzApplication *self,
+                    BzEntryGroup  *group);
+
+static void
+installed_apps_remove (BzApplication *self,
+                       BzEntryGroup  *group);
+
 static void
 fiber_replace_entry (BzApplication *self,
                      BzEntry       *entry);
@@ -419,6 +497,9 @@ bz_application_dispose (GObject *object)
   g_clear_object (&self->groups);
   g_clear_object (&self->gs_search);
   g_clear_object (&self->installed_apps);
+  g_clear_pointer (&self->installed_groups, g_hash_table_unref);
+  g_clear_pointer (&self->pending_groups, g_ptr_array_unref);
+  g_clear_pointer (&self->pending_installed, g_ptr_array_unref);
   g_clear_object (&self->malcontent);
   g_clear_object (&self->internal_config);
   g_clear_object (&self->network);
@@ -438,6 +519,11 @@ bz_application_dispose (GObject *object)
   g_clear_pointer (&self->ids_to_groups, g_hash_table_unref);
   g_clear_pointer (&self->ignore_eol_set, g_hash_table_unref);
   g_clear_pointer (&self->init_timer, g_timer_destroy);
+  g_clear_pointer (&self->flathub_span, bz_trace_span_end);
+  g_clear_pointer (&self->startup_span, bz_trace_span_end);
+  g_clear_pointer (&self->sync_span, bz_trace_span_end);
+  g_clear_pointer (&self->worker_span, bz_trace_span_end);
+  bz_trace_finish ();
   g_clear_pointer (&self->installed_set, g_hash_table_unref);
   g_clear_pointer (&self->sys_name_to_addons, g_hash_table_unref);
   g_clear_pointer (&self->txt_blocked_id_sets, g_ptr_array_unref);
@@ -563,6 +649,7 @@ bz_application_command_line (GApplication            *app,
             (const char *const *) content_configs_strv);
 
       g_timer_start (self->init_timer);
+      self->startup_span = bz_trace_span_begin ("first-window");
       init = dex_scheduler_spawn (
           dex_scheduler_get_default (),
           bz_get_dex_stack_size (),
@@ -985,8 +1072,10 @@ init_fiber (GWeakRef *wr)
   g_autoptr (GFile) flathub_cache_file  = NULL;
   g_autofree char *cache_version_path   = NULL;
   g_autoptr (GFile) cache_version_file  = NULL;
+  g_autoptr (BzTraceSpan) span          = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
+  span = bz_trace_span_begin ("init");
 
   bz_state_info_set_online (self->state, TRUE);
   bz_state_info_set_busy (self->state, TRUE);
@@ -1231,6 +1320,32 @@ init_fiber (GWeakRef *wr)
   return dex_future_new_true ();
 }
 
+/* Runs on the thread pool. Groups themselves are only built on
+ * the main thread, since deserializing one touches string
+ * lists, the application and addon bookkeeping that are not
+ * thread safe, so this just gets the validation of the cache
+ * out of the way and hands back trusted children
+ */
+static DexFuture *
+decode_groups_fiber (DecodeGroupsData *data)
+{
+  g_autoptr (GPtrArray) children = NULL;
+  g_autoptr (BzTraceSpan) span   = NULL;
+
+  span = bz_trace_span_begin ("decode-groups");
+
+  children = g_ptr_array_new_full (data->n_children, (GDestroyNotify) g_variant_unref);
+  for (gsize i = 0; i < data->n_children; i++)
+    {
+      g_autoptr (GVariant) child = NULL;
+
+      child = g_variant_get_child_value (data->variant, data->offset + i);
+      g_ptr_array_add (children, g_variant_get_normal_form (child));
+    }
+
+  return dex_future_new_take_boxed (G_TYPE_PTR_ARRAY, g_steal_pointer (&children));
+}
+
 static DexFuture *
 enumerate_disk_groups_fiber (GWeakRef *wr)
 {
@@ -1240,10 +1355,17 @@ enumerate_disk_groups_fiber (GWeakRef *wr)
   g_autoptr (GFile) groups_cache_file = NULL;
   g_autoptr (GBytes) bytes            = NULL;
   g_autoptr (GVariant) variant        = NULL;
-  g_autoptr (GVariantIter) iter       = NULL;
+  g_autoptr (GPtrArray) futures       = NULL;
+  g_autoptr (GTimer) timer            = NULL;
+  g_autoptr (GTimer) build_timer      = NULL;
+  g_autoptr (BzTraceSpan) span        = NULL;
+  gsize    n_children                 = 0;
+  guint    n_groups                   = 0;
+  double   build_elapsed              = 0.0;
   gboolean has_flathub_group          = FALSE;
 
   bz_weak_get_or_return_reject (self, wr);
+  span = bz_trace_span_begin ("enumerate-disk-groups");
 
   groups_cache_file = fiber_dup_cache_file ("groups-cache", &groups_cache, &local_error);
   if (groups_cache_file == NULL)
@@ -1272,28 +1394,68 @@ enumerate_disk_groups_fiber (GWeakRef *wr)
       return dex_future_new_for_boolean (FALSE);
     }
 
-  iter = g_variant_iter_new (variant);
-  for (;;)
+  timer       = g_timer_new ();
+  build_timer = g_timer_new ();
+  g_timer_stop (build_timer);
+
+  /* Validate in chunks across the thread pool, then build the
+   * groups here, one chunk at a time and in their original
+   * order, as soon as each chunk is ready
+   */
+  n_children = g_variant_n_children (variant);
+  futures    = g_ptr_array_new_with_free_func (dex_unref);
+  for (gsize offset = 0; offset < n_children; offset += GROUPS_CACHE_CHUNK)
     {
-      g_autoptr (GVariant) group_variant = NULL;
-      g_autoptr (BzEntryGroup) group     = NULL;
+      g_autoptr (DecodeGroupsData) data = NULL;
 
-      group_variant = g_variant_iter_next_value (iter);
-      if (group_variant == NULL)
-        break;
+      data             = decode_groups_data_new ();
+      data->variant    = g_variant_ref (variant);
+      data->offset     = offset;
+      data->n_children = MIN (GROUPS_CACHE_CHUNK, n_children - offset);
+
+      g_ptr_array_add (
+          futures,
+          dex_scheduler_spawn (
+              dex_thread_pool_scheduler_get_default (),
+              bz_get_dex_stack_size (),
+              (DexFiberFunc) decode_groups_fiber,
+              decode_groups_data_ref (data),
+              decode_groups_data_unref));
+    }
+
+  begin_group_batch (self);
+  for (guint i = 0; i < futures->len; i++)
+    {
+      g_autoptr (GPtrArray) children = NULL;
 
-      group = bz_entry_group_new (self->entry_factory);
-      if (bz_entry_group_deserialize (group, group_variant))
+      /* Hands the main loop back between chunks that
+       * are still being decoded
+       */
+      children = dex_await_boxed (dex_ref (g_ptr_array_index (futures, i)), &local_error);
+      if (children == NULL)
         {
-          const char *id = NULL;
+          g_warning ("Failed to decode part of the groups cache: %s",
+                     local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
 
+      g_timer_continue (build_timer);
+      for (guint j = 0; j < children->len; j++)
+        {
+          g_autoptr (BzEntryGroup) group = NULL;
+          const char *id                 = NULL;
+
+          group = bz_entry_group_new (self->entry_factory);
+          if (!bz_entry_group_deserialize (group, g_ptr_array_index (children, j)))
+            continue;
           bz_entry_group_reconcile_with_installed_set (group, self->installed_set);
 
           if (!has_flathub_group &&
               bz_entry_group_get_is_flathub (group))
             has_flathub_group = TRUE;
 
-          g_list_store_append (self->groups, group);
+          groups_append (self, group);
 
           id = bz_entry_group_get_id (group);
           if (id != NULL)
@@ -1303,11 +1465,20 @@ enumerate_disk_groups_fiber (GWeakRef *wr)
                 g_object_ref (group));
 
           if (bz_entry_group_get_removable (group) > 0)
-            g_list_store_insert_sorted (
-                self->installed_apps, group,
-                (GCompareDataFunc) cmp_group, NULL);
+            installed_apps_add (self, group);
+          n_groups++;
         }
+      g_timer_stop (build_timer);
     }
+  end_group_batch (self);
+  build_elapsed = g_timer_elapsed (build_timer, NULL);
+
+  g_debug ("Deserialized %u cached groups in %.2f ms, %.2f ms of which "
+           "building them on the main thread, %.2f ms after startup",
+           n_groups,
+           g_timer_elapsed (timer, NULL) * 1000.0,
+           build_elapsed * 1000.0,
+           g_timer_elapsed (self->init_timer, NULL) * 1000.0);
 
   gtk_filter_changed (GTK_FILTER (self->group_filter), GTK_FILTER_CHANGE_LESS_STRICT);
   gtk_filter_changed (GTK_FILTER (self->appid_filter), GTK_FILTER_CHANGE_LESS_STRICT);
@@ -1329,8 +1500,11 @@ enumerate_disk_io_fiber (EnumerateDiskIoData *data)
   g_autoptr (GHashTable) cached_set = NULL;
   g_autoptr (GPtrArray) futures     = NULL;
   g_autoptr (GPtrArray) entries     = NULL;
+  g_autoptr (BzTraceSpan) span      = NULL;
   GHashTableIter iter               = { 0 };
 
+  span = bz_trace_span_begin ("enumerate-disk-io");
+
   cached_set = dex_await_boxed (
       bz_entry_cache_manager_enumerate_disk (data->cache),
       &local_error);
@@ -1388,9 +1562,11 @@ enumerate_disk_entries_fiber (GWeakRef *wr)
   g_autoptr (GError) local_error          = NULL;
   g_autoptr (GPtrArray) entries           = NULL;
   g_autoptr (EnumerateDiskIoData) io_data = NULL;
+  g_autoptr (BzTraceSpan) span            = NULL;
   gboolean has_flathub_entry              = FALSE;
 
   bz_weak_get_or_return_reject (self, wr);
+  span = bz_trace_span_begin ("enumerate-disk-entries");
 
   io_data        = enumerate_disk_io_data_new ();
   io_data->cache = g_object_ref (self->cache);
@@ -1410,6 +1586,7 @@ enumerate_disk_entries_fiber (GWeakRef *wr)
       return dex_future_new_for_error (g_steal_pointer (&local_error));
     }
 
+  begin_group_batch (self);
   for (guint i = 0; i < entries->len; i++)
     {
       BzEntry *entry = NULL;
@@ -1428,6 +1605,8 @@ enumerate_disk_entries_fiber (GWeakRef *wr)
 
       fiber_replace_entry (self, entry);
     }
+  end_group_batch (self);
+  self->entries_enumerated = TRUE;
 
   gtk_filter_changed (GTK_FILTER (self->group_filter), GTK_FILTER_CHANGE_LESS_STRICT);
   gtk_filter_changed (GTK_FILTER (self->appid_filter), GTK_FILTER_CHANGE_LESS_STRICT);
@@ -1442,6 +1621,208 @@ enumerate_disk_entries_fiber (GWeakRef *wr)
   return dex_future_new_for_boolean (has_flathub_entry);
 }
 
+/* Resolves to the entries the refresh worker reported as
+ * added or changed, or to a boolean if the caller has to
+ * enumerate the whole entry cache instead
+ */
+static DexFuture *
+refresh_worker_fiber (RefreshWorkerData *data)
+{
+  g_autoptr (GError) local_error = NULL;
+  g_autoptr (GInputStream) input = NULL;
+  g_autoptr (GPtrArray) entries  = NULL;
+  g_autoptr (BzTraceSpan) span   = NULL;
+  guint    n_removed             = 0;
+  gboolean fallback              = FALSE;
+
+  span = bz_trace_span_begin ("refresh-worker-deltas");
+
+  if (data->deltas)
+    {
+      input = g_buffered_input_stream_new (
+          g_subprocess_get_stdout_pipe (data->subprocess));
+      entries         = g_ptr_array_new_with_free_func (g_object_unref);
+      data->checksums = g_ptr_array_new_with_free_func (g_free);
+
+      for (;;)
+        {
+          BzRefreshDeltaFrame frame    = { 0 };
+          g_autofree char *checksum    = NULL;
+          g_autoptr (GBytes) bytes     = NULL;
+          g_autoptr (GVariant) variant = NULL;
+          g_autoptr (BzEntry) entry    = NULL;
+
+          if (!read_refresh_delta (input, &frame, &checksum, &bytes, &local_error))
+            {
+              if (local_error != NULL)
+                {
+                  g_warning ("Could not read deltas from the refresh worker: %s",
+                             local_error->message);
+                  g_clear_error (&local_error);
+                  fallback = TRUE;
+                }
+              break;
+            }
+
+          /* Any copy the cache manager holds of it is stale now */
+          g_ptr_array_add (data->checksums, g_strdup (checksum));
+
+          if (frame.kind == BZ_REFRESH_DELTA_KIND_REMOVED)
+            {
+              /* Like a full enumeration, groups keep what
+               * they had until the groups cache is rebuilt
+               */
+              n_removed++;
+              continue;
+            }
+
+          variant = g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, bytes, FALSE);
+          entry   = g_object_new (BZ_TYPE_FLATPAK_ENTRY, NULL);
+          if (!bz_serializable_deserialize (BZ_SERIALIZABLE (entry), variant, &local_error))
+            {
+              g_warning ("Failed to deserialize delta for %s: %s",
+                         checksum, local_error->message);
+              g_clear_error (&local_error);
+              fallback = TRUE;
+              break;
+            }
+          g_ptr_array_add (entries, g_steal_pointer (&entry));
+        }
+
+      /* Keep draining even once the deltas are useless, or
+       * the worker could block on a full pipe
+       */
+      if (fallback)
+        {
+          for (;;)
+            {
+              if (g_input_stream_skip (input, 64 * 1024, NULL, NULL) <= 0)
+                break;
+            }
+        }
+    }
+
+  if (!dex_await (dex_subprocess_wait_check (data->subprocess), &local_error))
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
+
+  if (entries == NULL || fallback)
+    return dex_future_new_true ();
+
+  g_debug ("Refresh worker reported %u added or changed entries and %u removed entries",
+           entries->len, n_removed);
+  return dex_future_new_take_boxed (G_TYPE_PTR_ARRAY, g_steal_pointer (&entries));
+}
+
+/* Returns FALSE without setting @error once the worker
+ * closed its end between frames
+ */
+static gboolean
+read_refresh_delta (GInputStream        *input,
+                    BzRefreshDeltaFrame *frame,
+                    char               **checksum,
+                    GBytes             **bytes,
+                    GError             **error)
+{
+  gsize            bytes_read   = 0;
+  gsize            name_read    = 0;
+  gsize            payload_read = 0;
+  g_autofree char *name         = NULL;
+  g_autofree char *payload      = NULL;
+  g_autoptr (GBytes) contents   = NULL;
+
+  if (!g_input_stream_read_all (input, frame, sizeof (*frame), &bytes_read, NULL, error))
+    return FALSE;
+  if (bytes_read == 0)
+    return FALSE;
+
+  if (bytes_read != sizeof (*frame) ||
+      frame->kind > BZ_REFRESH_DELTA_KIND_REMOVED ||
+      frame->checksum_length == 0 ||
+      frame->checksum_length > BZ_REFRESH_DELTA_MAX_CHECKSUM ||
+      frame->length > G_MAXUINT32)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Malformed delta frame");
+      return FALSE;
+    }
+
+  name    = g_malloc0 (frame->checksum_length + 1);
+  payload = g_malloc (frame->length);
+  if (!g_input_stream_read_all (input, name, frame->checksum_length, &name_read, NULL, error) ||
+      !g_input_stream_read_all (input, payload, frame->length, &payload_read, NULL, error))
+    return FALSE;
+  if (name_read != frame->checksum_length ||
+      payload_read != frame->length)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                   "Delta frame was cut short");
+      return FALSE;
+    }
+
+  contents = g_bytes_new_take (g_steal_pointer (&payload), frame->length);
+  if (bz_entry_cache_manager_digest (contents) != frame->digest)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Delta for %s is corrupt", name);
+      return FALSE;
+    }
+
+  *checksum = g_steal_pointer (&name);
+  *bytes    = g_steal_pointer (&contents);
+  return TRUE;
+}
+
+static DexFuture *
+apply_refresh_deltas_fiber (ApplyRefreshDeltasData *data)
+{
+  g_autoptr (BzApplication) self = NULL;
+  g_autoptr (GError) local_error = NULL;
+  GPtrArray *entries             = data->entries;
+  g_autoptr (BzTraceSpan) span   = NULL;
+
+  bz_weak_get_or_return_reject (self, data->self);
+  span = bz_trace_span_begin ("apply-refresh-deltas");
+
+  /* The worker wrote these to the pack behind our back, so
+   * reload it and drop what we retained from before
+   */
+  if (!dex_await (bz_entry_cache_manager_invalidate (self->cache, data->checksums), &local_error))
+    {
+      g_warning ("Failed to reload the entry cache after a refresh: %s",
+                 local_error->message);
+      self->entries_enumerated = FALSE;
+    }
+
+  begin_group_batch (self);
+  for (guint i = 0; i < entries->len; i++)
+    {
+      BzEntry *entry = NULL;
+
+      entry = g_ptr_array_index (entries, i);
+
+      if (bz_flatpak_entry_get_bundle_path (BZ_FLATPAK_ENTRY (entry)) != NULL)
+        continue;
+
+      fiber_replace_entry (self, entry);
+    }
+  end_group_batch (self);
+
+  if (entries->len > 0)
+    {
+      gtk_filter_changed (GTK_FILTER (self->group_filter), GTK_FILTER_CHANGE_LESS_STRICT);
+      gtk_filter_changed (GTK_FILTER (self->appid_filter), GTK_FILTER_CHANGE_LESS_STRICT);
+    }
+
+  dex_future_disown (dex_scheduler_spawn (
+      dex_scheduler_get_default (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) check_for_updates_fiber,
+      bz_track_weak (self),
+      bz_weak_release));
+
+  return dex_future_new_true ();
+}
+
 static DexFuture *
 check_for_updates_fiber (GWeakRef *wr)
 {
@@ -1463,8 +1844,10 @@ cache_flathub_fiber (GWeakRef *wr)
   gboolean         result              = FALSE;
   g_autofree char *flathub_cache       = NULL;
   g_autoptr (GFile) flathub_cache_file = NULL;
+  g_autoptr (BzTraceSpan) span         = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
+  span = bz_trace_span_begin ("cache-flathub");
 
   flathub_cache_file = fiber_dup_cache_file ("flathub-cache", &flathub_cache, &local_error);
   if (flathub_cache_file != NULL)
@@ -1511,9 +1894,11 @@ cache_groups_fiber (GWeakRef *wr)
   g_autoptr (GVariantBuilder) builder = NULL;
   g_autoptr (GVariant) variant        = NULL;
   g_autoptr (GBytes) bytes            = NULL;
+  g_autoptr (BzTraceSpan) span        = NULL;
   guint n_groups                      = 0;
 
   bz_weak_get_or_return_reject (self, wr);
+  span = bz_trace_span_begin ("cache-groups");
 
   groups_cache_file = fiber_dup_cache_file ("groups-cache", &groups_cache, &local_error);
   if (groups_cache_file == NULL)
@@ -1562,10 +1947,12 @@ respond_to_flatpak_fiber (RespondToFlatpakData *data)
   g_autoptr (GPtrArray) build_notify_groups = NULL;
   g_autoptr (DexFuture) read_future         = NULL;
   g_autoptr (DexFuture) reread_timeout      = NULL;
+  g_autoptr (BzTraceSpan) span              = NULL;
   gboolean update_labels                    = FALSE;
   gboolean update_filters                   = FALSE;
 
   bz_weak_get_or_return_reject (self, data->self);
+  span = bz_trace_span_begin ("respond-to-flatpak");
 
   build_futures       = g_ptr_array_new_with_free_func (dex_unref);
   build_notify_groups = g_ptr_array_new_with_free_func (g_object_unref);
@@ -1743,14 +2130,7 @@ respond_to_flatpak_fiber (RespondToFlatpakData *data)
 
                       group = g_hash_table_lookup (self->ids_to_groups, bz_entry_get_id (entry));
                       if (group != NULL)
-                        {
-                          gboolean found    = FALSE;
-                          guint    position = 0;
-
-                          found = g_list_store_find (self->installed_apps, group, &position);
-                          if (!found)
-                            g_list_store_insert_sorted (self->installed_apps, group, (GCompareDataFunc) cmp_group, NULL);
-                        }
+                        installed_apps_add (self, group);
                     }
                 }
                 break;
@@ -1774,14 +2154,7 @@ respond_to_flatpak_fiber (RespondToFlatpakData *data)
 
                       group = g_hash_table_lookup (self->ids_to_groups, bz_entry_get_id (entry));
                       if (group != NULL && !bz_entry_group_get_removable (group))
-                        {
-                          gboolean found    = FALSE;
-                          guint    position = 0;
-
-                          found = g_list_store_find (self->installed_apps, group, &position);
-                          if (found)
-                            g_list_store_remove (self->installed_apps, position);
-                        }
+                        installed_apps_remove (self, group);
                     }
                 }
                 break;
@@ -1793,6 +2166,7 @@ respond_to_flatpak_fiber (RespondToFlatpakData *data)
               case BZ_BACKEND_NOTIFICATION_KIND_REMOTE_SYNC_START:
               case BZ_BACKEND_NOTIFICATION_KIND_REPLACE_ENTRY:
               case BZ_BACKEND_NOTIFICATION_KIND_TELL_INCOMING:
+              case BZ_BACKEND_NOTIFICATION_KIND_RETAIN_ENTRIES:
               default:
                 g_assert_not_reached ();
               };
@@ -1916,17 +2290,10 @@ respond_to_flatpak_fiber (RespondToFlatpakData *data)
 
                         if (group != NULL)
                           {
-                            gboolean found    = FALSE;
-                            guint    position = 0;
-
-                            found = g_list_store_find (self->installed_apps, group, &position);
-                            if (installed && !found)
-                              g_list_store_insert_sorted (
-                                  self->installed_apps, group,
-                                  (GCompareDataFunc) cmp_group, NULL);
-                            else if (!installed && found &&
-                                     bz_entry_group_get_removable (group) == 0)
-                              g_list_store_remove (self->installed_apps, position);
+                            if (installed)
+                              installed_apps_add (self, group);
+                            else if (bz_entry_group_get_removable (group) == 0)
+                              installed_apps_remove (self, group);
                           }
 
                         g_ptr_array_add (
@@ -1947,6 +2314,7 @@ respond_to_flatpak_fiber (RespondToFlatpakData *data)
             finish_with_background_task_label (self);
           }
           break;
+        case BZ_BACKEND_NOTIFICATION_KIND_RETAIN_ENTRIES:
         default:
           g_assert_not_reached ();
         }
@@ -2157,23 +2525,53 @@ init_sync_finally (DexFuture *future,
 }
 
 static DexFuture *
-backend_sync_finally (DexFuture *future,
-                      GWeakRef  *wr)
+backend_sync_finally (DexFuture         *future,
+                      RefreshWorkerData *data)
 {
   g_autoptr (BzApplication) self = NULL;
 
-  bz_weak_get_or_return_reject (self, wr);
+  bz_weak_get_or_return_reject (self, data->self);
+  g_clear_pointer (&self->worker_span, bz_trace_span_end);
+
+  /* Deltas only cover what the worker wrote during this run,
+   * so if they never get applied, whatever it wrote would be
+   * elided from every later run. Only a successful delta run
+   * or full enumeration allows deltas again.
+   */
+  self->entries_enumerated = FALSE;
 
   if (dex_future_is_resolved (future))
     {
+      const GValue *value               = NULL;
       g_autoptr (DexFuture) enum_future = NULL;
 
-      enum_future = dex_scheduler_spawn (
-          dex_scheduler_get_default (),
-          bz_get_dex_stack_size (),
-          (DexFiberFunc) enumerate_disk_entries_fiber,
-          bz_track_weak (self),
-          bz_weak_release);
+      value = dex_future_get_value (future, NULL);
+      if (G_VALUE_HOLDS (value, G_TYPE_PTR_ARRAY))
+        {
+          g_autoptr (ApplyRefreshDeltasData) apply = NULL;
+
+          apply            = apply_refresh_deltas_data_new ();
+          apply->self      = bz_track_weak (self);
+          apply->entries   = g_value_dup_boxed (value);
+          apply->checksums = g_ptr_array_ref (data->checksums);
+
+          /* The delta run itself succeeded */
+          self->entries_enumerated = TRUE;
+
+          enum_future = dex_scheduler_spawn (
+              dex_scheduler_get_default (),
+              bz_get_dex_stack_size (),
+              (DexFiberFunc) apply_refresh_deltas_fiber,
+              apply_refresh_deltas_data_ref (apply),
+              apply_refresh_deltas_data_unref);
+        }
+      else
+        enum_future = dex_scheduler_spawn (
+            dex_scheduler_get_default (),
+            bz_get_dex_stack_size (),
+            (DexFiberFunc) enumerate_disk_entries_fiber,
+            bz_track_weak (self),
+            bz_weak_release);
 
       enum_future = dex_future_finally (
           enum_future,
@@ -2210,6 +2608,7 @@ flathub_update_finally (DexFuture *future,
   g_autoptr (BzApplication) self = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
+  g_clear_pointer (&self->flathub_span, bz_trace_span_end);
 
   if (dex_future_is_resolved (future))
     {
@@ -2275,6 +2674,12 @@ sync_finally (DexFuture *future,
 
   dex_promise_resolve_boolean (self->ready_to_open_files, TRUE);
 
+  /* Startup has settled by now, so write what we have in case
+   * the process never exits cleanly
+   */
+  g_clear_pointer (&self->sync_span, bz_trace_span_end);
+  bz_trace_flush ();
+
   return dex_future_new_true ();
 }
 
@@ -2329,18 +2734,159 @@ ensure_group_and_add (BzApplication *self,
       new_group = bz_entry_group_new (self->entry_factory);
       bz_entry_group_add (new_group, entry, eol_runtime, ignore_eol);
 
-      g_list_store_append (self->groups, new_group);
+      groups_append (self, new_group);
       g_hash_table_replace (self->ids_to_groups, g_strdup (id), g_object_ref (new_group));
 
       group = new_group;
     }
 
-  if (installed && !g_list_store_find (self->installed_apps, group, NULL))
+  if (installed)
+    installed_apps_add (self, group);
+
+  return group;
+}
+
+/* While a batch is open, new groups and installed apps are
+ * held back and then spliced into their stores at once, so
+ * downstream filter and sort models only see one change
+ */
+static void
+begin_group_batch (BzApplication *self)
+{
+  self->group_batch_depth++;
+}
+
+static void
+end_group_batch (BzApplication *self)
+{
+  g_autoptr (GTimer) timer = NULL;
+  guint n_groups           = 0;
+  guint n_installed        = 0;
+  guint n_splices          = 0;
+
+  g_return_if_fail (self->group_batch_depth > 0);
+  if (--self->group_batch_depth > 0)
+    return;
+
+  timer       = g_timer_new ();
+  n_groups    = self->pending_groups->len;
+  n_installed = self->pending_installed->len;
+
+  if (n_groups > 0)
+    {
+      g_list_store_splice (
+          self->groups,
+          g_list_model_get_n_items (G_LIST_MODEL (self->groups)),
+          0, self->pending_groups->pdata, n_groups);
+      g_ptr_array_set_size (self->pending_groups, 0);
+    }
+
+  if (n_installed > 0)
+    {
+      GListModel *model   = G_LIST_MODEL (self->installed_apps);
+      guint       n_items = 0;
+      guint       start   = 0;
+
+      /* Sort the batch once, then insert each run of it that
+       * lands between the same two existing items with a
+       * single splice, so nothing already in the store is
+       * reported as removed and re-added
+       */
+      g_ptr_array_sort_values_with_data (
+          self->pending_installed,
+          (GCompareDataFunc) cmp_group, NULL);
+
+      n_items = g_list_model_get_n_items (model);
+      for (guint i = 0; i < n_installed;)
+        {
+          BzEntryGroup *first           = NULL;
+          g_autoptr (BzEntryGroup) next = NULL;
+          guint lo                      = start;
+          guint hi                      = n_items;
+          guint run                     = 1;
+
+          first = g_ptr_array_index (self->pending_installed, i);
+
+          /* First existing item sorting after `first`, so
+           * existing equal items stay in front of it
+           */
+          while (lo < hi)
+            {
+              g_autoptr (BzEntryGroup) item = NULL;
+              guint mid                     = 0;
+
+              mid  = lo + (hi - lo) / 2;
+              item = g_list_model_get_item (model, mid);
+              if (cmp_group (item, first, NULL) <= 0)
+                lo = mid + 1;
+              else
+                hi = mid;
+            }
+
+          if (lo < n_items)
+            next = g_list_model_get_item (model, lo);
+          while (i + run < n_installed &&
+                 (next == NULL ||
+                  cmp_group (next, g_ptr_array_index (self->pending_installed, i + run), NULL) > 0))
+            run++;
+
+          g_list_store_splice (
+              self->installed_apps,
+              lo, 0,
+              self->pending_installed->pdata + i, run);
+
+          n_items += run;
+          start = lo + run;
+          i += run;
+          n_splices++;
+        }
+      g_ptr_array_set_size (self->pending_installed, 0);
+    }
+
+  if (n_groups > 0 || n_installed > 0)
+    g_debug ("Ingested %u groups and %u installed apps (%u splices) in %.2f ms",
+             n_groups, n_installed, n_splices, g_timer_elapsed (timer, NULL) * 1000.0);
+}
+
+static void
+groups_append (BzApplication *self,
+               BzEntryGroup  *group)
+{
+  if (self->group_batch_depth > 0)
+    g_ptr_array_add (self->pending_groups, g_object_ref (group));
+  else
+    g_list_store_append (self->groups, group);
+}
+
+static void
+installed_apps_add (BzApplication *self,
+                    BzEntryGroup  *group)
+{
+  if (g_hash_table_contains (self->installed_groups, group))
+    return;
+  g_hash_table_add (self->installed_groups, g_object_ref (group));
+
+  if (self->group_batch_depth > 0)
+    g_ptr_array_add (self->pending_installed, g_object_ref (group));
+  else
     g_list_store_insert_sorted (
         self->installed_apps, group,
         (GCompareDataFunc) cmp_group, NULL);
+}
 
-  return group;
+static void
+installed_apps_remove (BzApplication *self,
+                       BzEntryGroup  *group)
+{
+  guint position = 0;
+
+  if (!g_hash_table_remove (self->installed_groups, group))
+    return;
+
+  if (g_ptr_array_find (self->pending_installed, group, &position))
+    g_ptr_array_remove_index (self->pending_installed, position);
+  else if (g_list_store_find (self->installed_apps, group, &position))
+    g_list_store_remove (self->installed_apps, position);
 }
 
 static void
@@ -3377,9 +3923,13 @@ init_service_struct (BzApplication *self,
       self->txt_blocklists_provider, G_LIST_MODEL (self->txt_blocklists_to_files));
   g_signal_connect_swapped (self->txt_blocklists_provider, "items-changed", G_CALLBACK (txt_blocklists_changed), self);
 
-  self->groups         = g_list_store_new (BZ_TYPE_ENTRY_GROUP);
-  self->installed_apps = g_list_store_new (BZ_TYPE_ENTRY_GROUP);
-  self->ids_to_groups  = g_hash_table_new_full (
+  self->groups           = g_list_store_new (BZ_TYPE_ENTRY_GROUP);
+  self->installed_apps   = g_list_store_new (BZ_TYPE_ENTRY_GROUP);
+  self->installed_groups = g_hash_table_new_full (
+      g_direct_hash, g_direct_equal, g_object_unref, NULL);
+  self->pending_groups    = g_ptr_array_new_with_free_func (g_object_unref);
+  self->pending_installed = g_ptr_array_new_with_free_func (g_object_unref);
+  self->ids_to_groups     = g_hash_table_new_full (
       g_str_hash, g_str_equal, g_free, g_object_unref);
   self->eol_runtimes = g_hash_table_new_full (
       g_str_hash, g_str_equal, g_free, g_free);
@@ -3512,6 +4062,7 @@ new_window (BzApplication *self)
 
   if (dex_future_is_pending (DEX_FUTURE (self->first_window_opened)))
     dex_promise_resolve_boolean (self->first_window_opened, TRUE);
+  g_clear_pointer (&self->startup_span, bz_trace_span_end);
 
   return GTK_WINDOW (window);
 }
@@ -3949,6 +4500,7 @@ make_sync_future (BzApplication *self)
 {
   g_autoptr (GError) local_error         = NULL;
   g_autoptr (GSubprocess) refresh_worker = NULL;
+  g_autoptr (RefreshWorkerData) data     = NULL;
   g_autoptr (DexFuture) backend_future   = NULL;
   g_autoptr (DexFuture) flathub_future   = NULL;
   g_autoptr (DexFuture) ret_future       = NULL;
@@ -3958,25 +4510,54 @@ make_sync_future (BzApplication *self)
   bz_state_info_set_syncing (self->state, TRUE);
   finish_with_background_task_label (self);
 
-  refresh_worker = g_subprocess_new (
-      G_SUBPROCESS_FLAGS_NONE,
-      &local_error,
-      REFRESH_WORKER_BIN_NAME,
-      NULL);
+  g_clear_pointer (&self->sync_span, bz_trace_span_end);
+  g_clear_pointer (&self->worker_span, bz_trace_span_end);
+  self->sync_span   = bz_trace_span_begin ("sync");
+  self->worker_span = bz_trace_span_begin ("refresh-worker");
+
+  /* Once every cached entry has been seen, only what the
+   * refresh actually changed needs to be looked at again
+   */
+  if (self->entries_enumerated)
+    refresh_worker = g_subprocess_new (
+        G_SUBPROCESS_FLAGS_STDOUT_PIPE,
+        &local_error,
+        REFRESH_WORKER_BIN_NAME,
+        BZ_REFRESH_DELTA_ARG,
+        NULL);
+  else
+    refresh_worker = g_subprocess_new (
+        G_SUBPROCESS_FLAGS_NONE,
+        &local_error,
+        REFRESH_WORKER_BIN_NAME,
+        NULL);
   if (refresh_worker == NULL)
     g_critical ("FATAL!!! The refresh worker could not be spawned: %s",
                 local_error->message);
   g_assert (refresh_worker != NULL);
 
-  backend_future = dex_subprocess_wait_check (refresh_worker);
+  data             = refresh_worker_data_new ();
+  data->self       = bz_track_weak (self);
+  data->subprocess = g_object_ref (refresh_worker);
+  data->deltas     = self->entries_enumerated;
+
+  backend_future = dex_scheduler_spawn (
+      bz_get_io_scheduler (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) refresh_worker_fiber,
+      refresh_worker_data_ref (data),
+      refresh_worker_data_unref);
   backend_future = dex_future_finally (
       backend_future,
       (DexFutureCallback) backend_sync_finally,
-      bz_track_weak (self), bz_weak_release);
+      refresh_worker_data_ref (data),
+      refresh_worker_data_unref);
 
   g_clear_object (&self->tmp_flathub);
-  self->tmp_flathub = bz_flathub_state_new ();
-  flathub_future    = bz_flathub_state_update_to_today (self->tmp_flathub);
+  g_clear_pointer (&self->flathub_span, bz_trace_span_end);
+  self->flathub_span = bz_trace_span_begin ("flathub-update");
+  self->tmp_flathub  = bz_flathub_state_new ();
+  flathub_future     = bz_flathub_state_update_to_today (self->tmp_flathub);
   flathub_future    = dex_future_finally (
       flathub_future,
       (DexFutureCallback) flathub_update_finally,
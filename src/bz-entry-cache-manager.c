@@ -21,10 +21,50 @@
 #define G_LOG_DOMAIN  "BAZAAR::ENTRY-CACHE"
 #define BAZAAR_MODULE "entry-cache"
 
-#define MAX_CONCURRENT_WRITES       16
-#define WATCH_CLEANUP_INTERVAL_MSEC 5000
+/* Only give memory back to the system once a worthwhile
+ * amount has been released and nothing is going on
+ */
+#define TRIM_THRESHOLD_BYTES (8 * 1024 * 1024)
+#define TRIM_IDLE_MSEC       3000
+
+/* Must be a power of two no larger than 256 */
+#define N_STRIPES 16
+
+#define PACK_DATA_BASENAME     "entries.pack"
+#define PACK_INDEX_BASENAME    "entries.idx"
+#define PACK_LOCK_BASENAME     "entries.lock"
+#define PACK_INDEX_MAGIC       "BZPKIDX1"
+#define PACK_INDEX_VERSION     3
+#define PACK_RECORD_MAGIC      0x33505a42
+#define PACK_KEY_SIZE          16
+#define PACK_ALIGNMENT         8
+#define PACK_BUFFER_SIZE       (64 * 1024)
+#define PACK_COMMIT_DELAY_MSEC 100
+
+/* Access times are only written back once they are this
+ * stale, so reading an entry rarely dirties the index
+ */
+#define PACK_ACCESS_RESOLUTION_SEC (24 * 60 * 60)
+
+/* Rewrite the pack for superseded records alone only once
+ * they take up at least 1/n of it
+ */
+#define PACK_GC_WASTE_DIVISOR 8
 
+/* Record flags */
+#define PACK_RECORD_DEFLATED (1 << 0)
+
+/* Below this, deflating isn't worth inflating again later */
+#define PACK_DEFLATE_MIN_SIZE 256
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
 #include <malloc.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "bz-entry-cache-manager.h"
 #include "bz-env.h"
@@ -37,35 +77,101 @@
 G_DEFINE_QUARK (bz-entry-cache-error-quark, bz_entry_cache_error);
 /* clang-format on */
 
-struct _BzEntryCacheManager
+typedef struct
 {
-  GObject parent_instance;
-
-  GMutex mutex;
-  guint  living_entries;
-
-  DexScheduler *scheduler;
-  guint64       memory_usage;
-
-  DexPromise *init;
-
   GHashTable *alive_hash;
   GHashTable *writing_hash;
   GHashTable *reading_hash;
 
-  BzGuard *ongoing_gates[MAX_CONCURRENT_WRITES];
-  GMutex   ongoing_mutexes[MAX_CONCURRENT_WRITES];
-  guint    ongoing_queued[MAX_CONCURRENT_WRITES];
-  GMutex   ongoing_queueing_mutex;
-
   BzGuard *alive_gate;
   GMutex   alive_mutex;
   BzGuard *reading_gate;
   GMutex   reading_mutex;
   BzGuard *writing_gate;
   GMutex   writing_mutex;
+} EntryStripe;
+
+G_STATIC_ASSERT ((N_STRIPES & (N_STRIPES - 1)) == 0);
+G_STATIC_ASSERT (N_STRIPES <= 256);
 
-  DexFuture *watch_task;
+struct _BzEntryCacheManager
+{
+  GObject parent_instance;
+
+  GMutex   mutex;
+  guint    living_entries;
+  gint     notify_queued;
+  guint64  trim_bytes;
+  gboolean trim_queued;
+  gint64   last_activity;
+
+  DexScheduler *scheduler;
+
+  /* Recently used entries are kept alive by strong
+   * references here until their estimated sizes add up
+   * to more than memory_budget
+   */
+  GMutex      lru_mutex;
+  GQueue      lru;
+  GHashTable *lru_links;
+  guint64     memory_usage;
+  guint64     memory_budget;
+
+  DexPromise *init;
+
+  /* Checksums are spread across independently
+   * guarded stripes so unrelated tasks never wait on
+   * each other
+   */
+  EntryStripe stripes[N_STRIPES];
+
+  /* Every cached entry lives in a single append-only data
+   * file. A sorted index of checksum -> offset/length is
+   * memory mapped, and records appended since the index
+   * was last written are tracked in pack_pending.
+   *
+   * Appends collect in pack_buffer, with offsets relative
+   * to it in pack_unflushed, and are committed in batches:
+   * every writer that appended while pack_commit is pending
+   * shares the same flush and index write.
+   *
+   * The refresh worker writes to the same pack from its
+   * own process. Every write to either file, and every
+   * scan of the data file's tail, happens with the lock
+   * file flocked, and a flush only learns where its records
+   * land once it holds that lock. pack_size is how much of
+   * the data file has been accounted for. The identity of
+   * both files we opened is remembered to notice when they
+   * were replaced under us, e.g. by GC in another process.
+   */
+  GMutex       pack_mutex;
+  char        *pack_data_path;
+  char        *pack_index_path;
+  GMappedFile *pack_index;
+  GMappedFile *pack_data;
+  int          pack_fd;
+  int          pack_lock_fd;
+  guint        pack_lock_depth;
+  guint64      pack_size;
+  GByteArray  *pack_buffer;
+  GHashTable  *pack_unflushed;
+  GHashTable  *pack_pending;
+  gboolean     pack_dirty;
+  DexPromise  *pack_commit;
+  guint64      pack_index_dev;
+  guint64      pack_index_ino;
+  guint64      pack_data_dev;
+  guint64      pack_data_ino;
+  guint        elided_writes;
+  guint        committed_writes;
+  int          deflate_level;
+  guint64      raw_bytes_written;
+  guint64      stored_bytes_written;
+  guint64      deflate_usec;
+  guint64      inflate_usec;
+  guint64      inflated_bytes;
+
+  DexFuture *init_task;
 };
 
 G_DEFINE_FINAL_TYPE (BzEntryCacheManager, bz_entry_cache_manager, G_TYPE_OBJECT);
@@ -75,23 +181,32 @@ enum
   PROP_0,
 
   PROP_LIVING_ENTRIES,
+  PROP_ELIDED_WRITES,
+  PROP_COMMITTED_WRITES,
+  PROP_MEMORY_USAGE,
+  PROP_MEMORY_BUDGET,
+  PROP_LRU_ENTRIES,
+  PROP_RAW_BYTES_WRITTEN,
+  PROP_STORED_BYTES_WRITTEN,
+  PROP_DEFLATE_USEC,
+  PROP_INFLATE_USEC,
+  PROP_INFLATED_BYTES,
 
   LAST_PROP
 };
 static GParamSpec *props[LAST_PROP] = { 0 };
 
 static DexFuture *
-watch_init_fiber (GWeakRef *wr);
+init_fiber (GWeakRef *wr);
 
 static DexFuture *
-watch_cb (DexFuture *future,
-          GWeakRef  *wr);
+notify_props_fiber (GWeakRef *wr);
 
 static DexFuture *
-watch_work_fiber (GWeakRef *wr);
+trim_fiber (GWeakRef *wr);
 
 static DexFuture *
-notify_props_fiber (GWeakRef *wr);
+commit_fiber (GWeakRef *wr);
 
 BZ_DEFINE_DATA (
     living_entry,
@@ -101,6 +216,7 @@ BZ_DEFINE_DATA (
       BzGuard *gate;
       GMutex   mutex;
       GTimer  *cached;
+      gsize    size;
     },
     BZ_RELEASE_DATA (gate, bz_guard_destroy);
     g_mutex_clear (&self->mutex);
@@ -133,34 +249,326 @@ BZ_DEFINE_DATA (
 static DexFuture *
 read_task_fiber (ReadTaskData *data);
 
+BZ_DEFINE_DATA (
+    prune_task,
+    PruneTask,
+    {
+      GWeakRef *self;
+      char     *unique_id_checksum;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (unique_id_checksum, g_free))
+static DexFuture *
+prune_task_fiber (PruneTaskData *data);
+
 static DexFuture *
 enumerate_disk_fiber (GWeakRef *wr);
 
+BZ_DEFINE_DATA (
+    gc_task,
+    GcTask,
+    {
+      GWeakRef   *self;
+      GHashTable *live;
+      guint64     max_size;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (live, g_hash_table_unref))
+static DexFuture *
+gc_task_fiber (GcTaskData *data);
+
+BZ_DEFINE_DATA (
+    invalidate_task,
+    InvalidateTask,
+    {
+      GWeakRef  *self;
+      GPtrArray *checksums;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (checksums, g_ptr_array_unref))
+static DexFuture *
+invalidate_task_fiber (InvalidateTaskData *data);
+
+BZ_DEFINE_DATA (
+    lru_item,
+    LruItem,
+    {
+      char    *unique_id_checksum;
+      BzEntry *entry;
+      gsize    size;
+    },
+    BZ_RELEASE_DATA (unique_id_checksum, g_free);
+    BZ_RELEASE_DATA (entry, g_object_unref))
+
+static void
+lru_touch (BzEntryCacheManager *self,
+           const char          *unique_id_checksum,
+           BzEntry             *entry,
+           gsize                size);
+
+static void
+lru_remove (BzEntryCacheManager *self,
+            const char          *unique_id_checksum);
+
+static void
+lru_clear (BzEntryCacheManager *self);
+
+static void
+entry_finalized_cb (PruneTaskData *data,
+                    GObject       *where_the_object_was);
+
+static void
+queue_prune (BzEntryCacheManager *self,
+             const char          *unique_id_checksum);
+
+static void
+queue_notify_props (BzEntryCacheManager *self);
+
+static void
+mark_activity (BzEntryCacheManager *self);
+
+static void
+adjust_living_entries (BzEntryCacheManager *self,
+                       int                  delta);
+
+static EntryStripe *
+stripe_for (BzEntryCacheManager *self,
+            const char          *unique_id_checksum);
+
+/* On-disk layout of the pack. Both files are host-local
+ * caches, so fields are stored in native byte order.
+ */
+typedef struct
+{
+  char    magic[8];
+  guint32 version;
+  guint32 n_records;
+  guint64 data_size;
+  guint64 reserved;
+} PackIndexHeader;
+
+typedef struct
+{
+  guint8  key[PACK_KEY_SIZE];
+  guint64 offset;
+  guint64 digest;
+  guint32 length;
+  /* Seconds since the epoch, see PACK_ACCESS_RESOLUTION_SEC */
+  guint32 accessed;
+  guint32 flags;
+  guint32 raw_length;
+} PackRecord;
+
+/* length is what is stored in the pack, raw_length is the
+ * size of the serialized entry. The digest is of the
+ * latter, so it doesn't depend on the compression level.
+ */
+typedef struct
+{
+  guint32 magic;
+  guint32 length;
+  guint8  key[PACK_KEY_SIZE];
+  guint64 digest;
+  guint32 flags;
+  guint32 raw_length;
+} PackRecordHeader;
+
+G_STATIC_ASSERT (sizeof (PackIndexHeader) == 32);
+G_STATIC_ASSERT (sizeof (PackRecord) == 48);
+G_STATIC_ASSERT (sizeof (PackRecordHeader) % PACK_ALIGNMENT == 0);
+/* GVariant never needs more than 8 byte alignment */
+G_STATIC_ASSERT (PACK_ALIGNMENT % 8 == 0);
+
+/* All pack_*_locked functions expect pack_mutex to be held */
+static gboolean
+pack_open_locked (BzEntryCacheManager *self,
+                  GError             **error);
+
+static void
+pack_close_locked (BzEntryCacheManager *self);
+
+static gboolean
+pack_lock_locked (BzEntryCacheManager *self,
+                  GError             **error);
+
+static void
+pack_unlock_locked (BzEntryCacheManager *self);
+
+static gboolean
+pack_scan_locked (BzEntryCacheManager *self,
+                  guint64              end,
+                  GError             **error);
+
+static gboolean
+pack_catch_up_locked (BzEntryCacheManager *self,
+                      GError             **error);
+
+static gboolean
+pack_reload_if_replaced_locked (BzEntryCacheManager *self,
+                                GError             **error);
+
+static void
+pack_remember_index_locked (BzEntryCacheManager *self);
+
+static gboolean
+pack_migrate_legacy_locked (BzEntryCacheManager *self,
+                            GError             **error);
+
+static const PackRecord *
+pack_lookup_locked (BzEntryCacheManager *self,
+                    const char          *unique_id_checksum);
+
+static gboolean
+pack_map_data_locked (BzEntryCacheManager *self,
+                      guint64              end,
+                      GError             **error);
+
+static GBytes *
+pack_read_locked (BzEntryCacheManager *self,
+                  const char          *unique_id_checksum,
+                  guint32             *flags,
+                  gsize               *raw_length);
+
+static void
+pack_touch_locked (BzEntryCacheManager *self,
+                   const char          *unique_id_checksum,
+                   const PackRecord    *record,
+                   guint32              now);
+
+static gboolean
+pack_append_locked (BzEntryCacheManager *self,
+                    const char          *unique_id_checksum,
+                    GBytes              *bytes,
+                    guint32              flags,
+                    gsize                raw_length,
+                    guint64              digest,
+                    GError             **error);
+
+static gboolean
+pack_flush_output_locked (BzEntryCacheManager *self,
+                          GError             **error);
+
+static void
+pack_abandon_output_locked (BzEntryCacheManager *self);
+
+static void
+pack_queue_commit_locked (BzEntryCacheManager *self);
+
+static gboolean
+pack_flush_index_locked (BzEntryCacheManager *self,
+                         GError             **error);
+
+static gboolean
+pack_write_index_locked (BzEntryCacheManager *self,
+                         const PackRecord    *records,
+                         guint                n_records,
+                         GError             **error);
+
+static gboolean
+pack_collect_garbage_locked (BzEntryCacheManager *self,
+                             GHashTable          *live,
+                             guint64              max_size,
+                             GError             **error);
+
+static void
+pack_collect_keys_locked (BzEntryCacheManager *self,
+                          GHashTable          *set);
+
+static gboolean
+parse_pack_key (const char *unique_id_checksum,
+                guint8     *key);
+
+static char *
+dup_pack_key_string (const guint8 *key);
+
+static gboolean
+write_all_fd (int           fd,
+              gconstpointer data,
+              gsize         length,
+              GError      **error);
+
+static guint64
+digest_pack_record (GBytes *bytes);
+
+static GBytes *
+deflate_record (GBytes  *bytes,
+                int      level,
+                guint32 *flags);
+
+static GBytes *
+inflate_record (GBytes  *bytes,
+                gsize    raw_length,
+                GError **error);
+
+static GBytes *
+convert_record (GConverter *converter,
+                GBytes     *bytes,
+                gsize       max_length,
+                GError    **error);
+
+static guint64
+pack_record_span (guint32 length);
+
+static gint
+cmp_pack_record (gconstpointer a,
+                 gconstpointer b);
+
+static gint
+cmp_pack_record_offset (gconstpointer a,
+                        gconstpointer b);
+
+static gint
+cmp_pack_record_accessed (gconstpointer a,
+                          gconstpointer b);
+
 static void
 bz_entry_cache_manager_dispose (GObject *object)
 {
-  BzEntryCacheManager *self = BZ_ENTRY_CACHE_MANAGER (object);
+  BzEntryCacheManager *self      = BZ_ENTRY_CACHE_MANAGER (object);
+  g_autoptr (GError) local_error = NULL;
+
+  g_mutex_lock (&self->pack_mutex);
+  if (!pack_flush_index_locked (self, &local_error))
+    g_warning ("Failed to write entry cache index: %s", local_error->message);
+  if (self->pack_commit != NULL)
+    dex_promise_reject (self->pack_commit,
+                        g_error_new (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                     "The entry cache is shutting down"));
+  g_mutex_unlock (&self->pack_mutex);
 
   g_mutex_clear (&self->mutex);
 
+  g_queue_clear_full (&self->lru, lru_item_data_unref);
+  g_clear_pointer (&self->lru_links, g_hash_table_unref);
+  g_mutex_clear (&self->lru_mutex);
+
   dex_clear (&self->scheduler);
-  dex_clear (&self->watch_task);
+  dex_clear (&self->init_task);
 
   g_clear_pointer (&self->init, dex_unref);
-  g_clear_pointer (&self->alive_hash, g_hash_table_unref);
-  g_clear_pointer (&self->writing_hash, g_hash_table_unref);
-  g_clear_pointer (&self->reading_hash, g_hash_table_unref);
-  for (guint i = 0; i < G_N_ELEMENTS (self->ongoing_gates); i++)
-    g_clear_pointer (&self->ongoing_gates[i], bz_guard_destroy);
-  for (guint i = 0; i < G_N_ELEMENTS (self->ongoing_mutexes); i++)
-    g_mutex_clear (&self->ongoing_mutexes[i]);
-  g_mutex_clear (&self->ongoing_queueing_mutex);
-  g_clear_pointer (&self->alive_gate, bz_guard_destroy);
-  g_clear_pointer (&self->reading_gate, bz_guard_destroy);
-  g_clear_pointer (&self->writing_gate, bz_guard_destroy);
-  g_mutex_clear (&self->alive_mutex);
-  g_mutex_clear (&self->reading_mutex);
-  g_mutex_clear (&self->writing_mutex);
+  for (guint i = 0; i < G_N_ELEMENTS (self->stripes); i++)
+    {
+      EntryStripe *stripe = &self->stripes[i];
+
+      g_clear_pointer (&stripe->alive_hash, g_hash_table_unref);
+      g_clear_pointer (&stripe->writing_hash, g_hash_table_unref);
+      g_clear_pointer (&stripe->reading_hash, g_hash_table_unref);
+      g_clear_pointer (&stripe->alive_gate, bz_guard_destroy);
+      g_clear_pointer (&stripe->reading_gate, bz_guard_destroy);
+      g_clear_pointer (&stripe->writing_gate, bz_guard_destroy);
+      g_mutex_clear (&stripe->alive_mutex);
+      g_mutex_clear (&stripe->reading_mutex);
+      g_mutex_clear (&stripe->writing_mutex);
+    }
+  pack_close_locked (self);
+  if (self->pack_lock_fd >= 0)
+    close (self->pack_lock_fd);
+  self->pack_lock_fd = -1;
+  g_clear_pointer (&self->pack_buffer, g_byte_array_unref);
+  g_clear_pointer (&self->pack_unflushed, g_hash_table_unref);
+  g_clear_pointer (&self->pack_pending, g_hash_table_unref);
+  g_clear_pointer (&self->pack_commit, dex_unref);
+  g_mutex_clear (&self->pack_mutex);
 
   G_OBJECT_CLASS (bz_entry_cache_manager_parent_class)->dispose (object);
 }
@@ -178,6 +586,36 @@ bz_entry_cache_manager_get_property (GObject    *object,
     case PROP_LIVING_ENTRIES:
       g_value_set_uint (value, bz_entry_cache_manager_get_living_entries (self));
       break;
+    case PROP_ELIDED_WRITES:
+      g_value_set_uint (value, bz_entry_cache_manager_get_elided_writes (self));
+      break;
+    case PROP_COMMITTED_WRITES:
+      g_value_set_uint (value, bz_entry_cache_manager_get_committed_writes (self));
+      break;
+    case PROP_MEMORY_USAGE:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_memory_usage (self));
+      break;
+    case PROP_MEMORY_BUDGET:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_memory_budget (self));
+      break;
+    case PROP_LRU_ENTRIES:
+      g_value_set_uint (value, bz_entry_cache_manager_get_lru_entries (self));
+      break;
+    case PROP_RAW_BYTES_WRITTEN:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_raw_bytes_written (self));
+      break;
+    case PROP_STORED_BYTES_WRITTEN:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_stored_bytes_written (self));
+      break;
+    case PROP_DEFLATE_USEC:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_deflate_usec (self));
+      break;
+    case PROP_INFLATE_USEC:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_inflate_usec (self));
+      break;
+    case PROP_INFLATED_BYTES:
+      g_value_set_uint64 (value, bz_entry_cache_manager_get_inflated_bytes (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -196,6 +634,16 @@ bz_entry_cache_manager_set_property (GObject      *object,
   switch (prop_id)
     {
     case PROP_LIVING_ENTRIES:
+    case PROP_ELIDED_WRITES:
+    case PROP_COMMITTED_WRITES:
+    case PROP_MEMORY_USAGE:
+    case PROP_MEMORY_BUDGET:
+    case PROP_LRU_ENTRIES:
+    case PROP_RAW_BYTES_WRITTEN:
+    case PROP_STORED_BYTES_WRITTEN:
+    case PROP_DEFLATE_USEC:
+    case PROP_INFLATE_USEC:
+    case PROP_INFLATED_BYTES:
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -217,6 +665,76 @@ bz_entry_cache_manager_class_init (BzEntryCacheManagerClass *klass)
           0, G_MAXUINT, 0,
           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
 
+  props[PROP_ELIDED_WRITES] =
+      g_param_spec_uint (
+          "elided-writes",
+          NULL, NULL,
+          0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_COMMITTED_WRITES] =
+      g_param_spec_uint (
+          "committed-writes",
+          NULL, NULL,
+          0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_MEMORY_USAGE] =
+      g_param_spec_uint64 (
+          "memory-usage",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_MEMORY_BUDGET] =
+      g_param_spec_uint64 (
+          "memory-budget",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_LRU_ENTRIES] =
+      g_param_spec_uint (
+          "lru-entries",
+          NULL, NULL,
+          0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_RAW_BYTES_WRITTEN] =
+      g_param_spec_uint64 (
+          "raw-bytes-written",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_STORED_BYTES_WRITTEN] =
+      g_param_spec_uint64 (
+          "stored-bytes-written",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_DEFLATE_USEC] =
+      g_param_spec_uint64 (
+          "deflate-usec",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_INFLATE_USEC] =
+      g_param_spec_uint64 (
+          "inflate-usec",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_INFLATED_BYTES] =
+      g_param_spec_uint64 (
+          "inflated-bytes",
+          NULL, NULL,
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (object_class, LAST_PROP, props);
 }
 
@@ -227,24 +745,40 @@ bz_entry_cache_manager_init (BzEntryCacheManager *self)
 
   self->scheduler = dex_thread_pool_scheduler_new ();
 
-  self->init       = dex_promise_new ();
-  self->alive_hash = g_hash_table_new_full (
-      g_str_hash, g_str_equal, g_free, living_entry_data_unref);
-  self->writing_hash = g_hash_table_new_full (
-      g_str_hash, g_str_equal, g_free, dex_unref);
-  self->reading_hash = g_hash_table_new_full (
-      g_str_hash, g_str_equal, g_free, dex_unref);
-  for (guint i = 0; i < G_N_ELEMENTS (self->ongoing_mutexes); i++)
-    g_mutex_init (&self->ongoing_mutexes[i]);
-  g_mutex_init (&self->ongoing_queueing_mutex);
-  g_mutex_init (&self->alive_mutex);
-  g_mutex_init (&self->reading_mutex);
-  g_mutex_init (&self->writing_mutex);
-
-  self->watch_task = dex_scheduler_spawn (
+  g_mutex_init (&self->lru_mutex);
+  g_queue_init (&self->lru);
+  self->lru_links     = g_hash_table_new (g_str_hash, g_str_equal);
+  self->memory_budget = bz_get_entry_cache_budget ();
+
+  self->init = dex_promise_new ();
+  for (guint i = 0; i < G_N_ELEMENTS (self->stripes); i++)
+    {
+      EntryStripe *stripe = &self->stripes[i];
+
+      stripe->alive_hash = g_hash_table_new_full (
+          g_str_hash, g_str_equal, g_free, living_entry_data_unref);
+      stripe->writing_hash = g_hash_table_new_full (
+          g_str_hash, g_str_equal, g_free, dex_unref);
+      stripe->reading_hash = g_hash_table_new_full (
+          g_str_hash, g_str_equal, g_free, dex_unref);
+      g_mutex_init (&stripe->alive_mutex);
+      g_mutex_init (&stripe->reading_mutex);
+      g_mutex_init (&stripe->writing_mutex);
+    }
+  g_mutex_init (&self->pack_mutex);
+  self->pack_fd        = -1;
+  self->pack_lock_fd   = -1;
+  self->pack_buffer    = g_byte_array_new ();
+  self->pack_unflushed = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, g_free);
+  self->pack_pending = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, g_free);
+  self->deflate_level = bz_get_entry_cache_compression_level ();
+
+  self->init_task = dex_scheduler_spawn (
       self->scheduler,
       bz_get_dex_stack_size (),
-      (DexFiberFunc) watch_init_fiber,
+      (DexFiberFunc) init_fiber,
       bz_track_weak (self), bz_weak_release);
 }
 
@@ -265,6 +799,115 @@ bz_entry_cache_manager_get_living_entries (BzEntryCacheManager *self)
   return self->living_entries;
 }
 
+guint
+bz_entry_cache_manager_get_elided_writes (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->elided_writes;
+}
+
+guint
+bz_entry_cache_manager_get_committed_writes (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->committed_writes;
+}
+
+guint64
+bz_entry_cache_manager_get_memory_usage (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->lru_mutex);
+  return self->memory_usage;
+}
+
+guint64
+bz_entry_cache_manager_get_memory_budget (BzEntryCacheManager *self)
+{
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+  return self->memory_budget;
+}
+
+guint
+bz_entry_cache_manager_get_lru_entries (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->lru_mutex);
+  return g_queue_get_length (&self->lru);
+}
+
+guint64
+bz_entry_cache_manager_get_raw_bytes_written (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->raw_bytes_written;
+}
+
+guint64
+bz_entry_cache_manager_get_stored_bytes_written (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->stored_bytes_written;
+}
+
+guint64
+bz_entry_cache_manager_get_deflate_usec (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->deflate_usec;
+}
+
+guint64
+bz_entry_cache_manager_get_inflate_usec (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->inflate_usec;
+}
+
+guint64
+bz_entry_cache_manager_get_inflated_bytes (BzEntryCacheManager *self)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self), 0);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  return self->inflated_bytes;
+}
+
+/* Resolves to FALSE when an identical record was already
+ * cached and nothing had to be written
+ */
 DexFuture *
 bz_entry_cache_manager_add (BzEntryCacheManager *self,
                             BzEntry             *entry)
@@ -351,80 +994,119 @@ bz_entry_cache_manager_enumerate_disk (BzEntryCacheManager *self)
   return g_steal_pointer (&future);
 }
 
-static DexFuture *
-write_task_fiber (WriteTaskData *data)
+/* Drops every record whose checksum is not in live, then
+ * least recently accessed records until the pack fits in
+ * max_size. A max_size of 0 means no limit.
+ */
+DexFuture *
+bz_entry_cache_manager_collect_garbage (BzEntryCacheManager *self,
+                                        GHashTable          *live,
+                                        guint64              max_size)
 {
-  g_autoptr (BzEntryCacheManager) self    = NULL;
-  char    *unique_id_checksum             = data->unique_id_checksum;
-  BzEntry *entry                          = data->entry;
-  g_autoptr (GError) local_error          = NULL;
-  g_autoptr (BzGuard) slot_guard          = NULL;
-  g_autoptr (BzGuard) other_guard         = NULL;
-  g_autoptr (GMutexLocker) locker         = NULL;
-  guint      slot_queued                  = G_MAXUINT;
-  guint      slot_index                   = 0;
-  DexFuture *writing_future               = NULL;
-  g_autoptr (LivingEntryData) living      = NULL;
-  g_autoptr (DexPromise) promise          = NULL;
-  g_autoptr (GVariantBuilder) builder     = NULL;
-  g_autoptr (GVariant) variant            = NULL;
-  g_autoptr (GBytes) bytes                = NULL;
-  gsize            bytes_size             = 0;
-  gconstpointer    bytes_data             = 0;
-  g_autofree char *main_cache             = NULL;
-  g_autoptr (GFile) parent_file           = NULL;
-  g_autofree char *save_file_path         = NULL;
-  g_autoptr (GFile) save_file             = NULL;
-  gsize            existing_contents_size = 0;
-  g_autofree char *existing_contents      = NULL;
-  g_autoptr (GFileOutputStream) output    = NULL;
-  gssize   bytes_written                  = 0;
-  gboolean result                         = FALSE;
-  g_autoptr (GError) ret_error            = NULL;
+  g_autoptr (GcTaskData) data  = NULL;
+  g_autoptr (DexFuture) future = NULL;
 
-  bz_weak_get_or_return_reject (self, data->self);
+  dex_return_error_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self));
+  dex_return_error_if_fail (live != NULL);
 
-  if (!BZ_IS_FLATPAK_ENTRY (entry))
-    return dex_future_new_reject (
-        BZ_ENTRY_CACHE_ERROR,
-        BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
-        "Entry with unique ID checksum '%s' cannot be "
-        "cached because it is not a flatpak entry",
-        unique_id_checksum);
+  data           = gc_task_data_new ();
+  data->self     = bz_track_weak (self);
+  data->live     = g_hash_table_ref (live);
+  data->max_size = max_size;
 
-  /* Rate limit to reduce competition for resources
-   * when refresh triggers a flood of requests
-   *
-   * Here we make sure to pick the slot with the
-   * least tasks waiting in line
-   */
-  locker = g_mutex_locker_new (&self->ongoing_queueing_mutex);
-  for (guint i = 0; i < G_N_ELEMENTS (self->ongoing_gates); i++)
-    {
-      if (self->ongoing_queued[i] < slot_queued)
-        {
-          slot_queued = self->ongoing_queued[i];
-          slot_index  = i;
-        }
-    }
-  self->ongoing_queued[slot_index]++;
-  g_clear_pointer (&locker, g_mutex_locker_free);
+  future = dex_scheduler_spawn (
+      self->scheduler,
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) gc_task_fiber,
+      gc_task_data_ref (data),
+      gc_task_data_unref);
+  return g_steal_pointer (&future);
+}
+
+/* Picks up whatever other processes wrote to the pack since
+ * it was last loaded and forgets the copies of the entries
+ * in checksums that are held in memory, so that the next get
+ * decaches them again
+ */
+DexFuture *
+bz_entry_cache_manager_invalidate (BzEntryCacheManager *self,
+                                   GPtrArray           *checksums)
+{
+  g_autoptr (InvalidateTaskData) data = NULL;
+  g_autoptr (DexFuture) future        = NULL;
+
+  dex_return_error_if_fail (BZ_IS_ENTRY_CACHE_MANAGER (self));
+  dex_return_error_if_fail (checksums != NULL);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&slot_guard,
-                               &self->ongoing_mutexes[slot_index],
-                               &self->ongoing_gates[slot_index]);
+  data            = invalidate_task_data_new ();
+  data->self      = bz_track_weak (self);
+  data->checksums = g_ptr_array_ref (checksums);
 
-  locker = g_mutex_locker_new (&self->ongoing_queueing_mutex);
-  self->ongoing_queued[slot_index]--;
-  g_clear_pointer (&locker, g_mutex_locker_free);
+  future = dex_scheduler_spawn (
+      self->scheduler,
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) invalidate_task_fiber,
+      invalidate_task_data_ref (data),
+      invalidate_task_data_unref);
+  return g_steal_pointer (&future);
+}
+
+/* What records are compared by to elide writes, for
+ * telling whether a serialized entry changed elsewhere
+ */
+guint64
+bz_entry_cache_manager_digest (GBytes *bytes)
+{
+  g_return_val_if_fail (bytes != NULL, 0);
+  return digest_pack_record (bytes);
+}
+
+static DexFuture *
+write_task_fiber (WriteTaskData *data)
+{
+  g_autoptr (BzEntryCacheManager) self = NULL;
+  char    *unique_id_checksum          = data->unique_id_checksum;
+  BzEntry *entry                       = data->entry;
+  g_autoptr (GError) local_error       = NULL;
+  g_autoptr (BzGuard) guard            = NULL;
+  g_autoptr (GMutexLocker) locker      = NULL;
+  DexFuture *writing_future            = NULL;
+  g_autoptr (LivingEntryData) living   = NULL;
+  g_autoptr (DexPromise) promise       = NULL;
+  g_autoptr (GVariantBuilder) builder  = NULL;
+  g_autoptr (GVariant) variant         = NULL;
+  g_autoptr (GBytes) bytes             = NULL;
+  const PackRecord *existing           = NULL;
+  guint64           digest             = 0;
+  gboolean          elide              = FALSE;
+  g_autoptr (GBytes) stored            = NULL;
+  guint32 flags                        = 0;
+  gint64  deflate_start                = 0;
+  gint64  deflate_usec                 = 0;
+  g_autoptr (DexFuture) commit         = NULL;
+  gboolean result                      = FALSE;
+  g_autoptr (GError) ret_error         = NULL;
+  EntryStripe *stripe                  = NULL;
+
+  bz_weak_get_or_return_reject (self, data->self);
+  stripe = stripe_for (self, unique_id_checksum);
+
+  if (!BZ_IS_FLATPAK_ENTRY (entry))
+    return dex_future_new_reject (
+        BZ_ENTRY_CACHE_ERROR,
+        BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
+        "Entry with unique ID checksum '%s' cannot be "
+        "cached because it is not a flatpak entry",
+        unique_id_checksum);
 
   dex_await (dex_ref (self->init), NULL);
+  mark_activity (self);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&other_guard,
-                               &self->writing_mutex,
-                               &self->writing_gate);
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
+                               &stripe->writing_mutex,
+                               &stripe->writing_gate);
   {
-    writing_future = g_hash_table_lookup (self->writing_hash, unique_id_checksum);
+    writing_future = g_hash_table_lookup (stripe->writing_hash, unique_id_checksum);
     if (writing_future != NULL)
       return dex_future_new_reject (
           BZ_ENTRY_CACHE_ERROR,
@@ -433,17 +1115,17 @@ write_task_fiber (WriteTaskData *data)
           unique_id_checksum);
 
     promise = dex_promise_new ();
-    g_hash_table_replace (self->writing_hash,
+    g_hash_table_replace (stripe->writing_hash,
                           g_strdup (unique_id_checksum),
                           dex_ref (promise));
   }
-  bz_clear_guard (&other_guard);
+  bz_clear_guard (&guard);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&other_guard,
-                               &self->alive_mutex,
-                               &self->alive_gate);
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
+                               &stripe->alive_mutex,
+                               &stripe->alive_gate);
   {
-    living = g_hash_table_lookup (self->alive_hash, unique_id_checksum);
+    living = g_hash_table_lookup (stripe->alive_hash, unique_id_checksum);
     if (living != NULL)
       living_entry_data_ref (living);
     else
@@ -452,113 +1134,112 @@ write_task_fiber (WriteTaskData *data)
         g_weak_ref_init (&living->wr, NULL);
         g_mutex_init (&living->mutex);
         living->cached = g_timer_new ();
-        g_hash_table_replace (self->alive_hash,
+        g_hash_table_replace (stripe->alive_hash,
                               g_strdup (unique_id_checksum),
                               living_entry_data_ref (living));
+        adjust_living_entries (self, 1);
       }
   }
-  bz_clear_guard (&other_guard);
+  bz_clear_guard (&guard);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&other_guard,
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
                                &living->mutex,
                                &living->gate);
   {
     builder = g_variant_builder_new (G_VARIANT_TYPE_VARDICT);
     bz_serializable_serialize (BZ_SERIALIZABLE (entry), builder);
-    variant    = g_variant_builder_end (builder);
-    bytes      = g_variant_get_data_as_bytes (variant);
-    bytes_data = g_bytes_get_data (bytes, &bytes_size);
-
-    main_cache  = bz_dup_module_dir ();
-    parent_file = g_file_new_for_path (main_cache);
-    result      = g_file_make_directory_with_parents (parent_file, NULL, &local_error);
-    if (!result)
-      {
-        if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
-          g_clear_pointer (&local_error, g_error_free);
-        else
-          {
-            ret_error = g_error_new (
-                BZ_ENTRY_CACHE_ERROR,
-                BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
-                "Failed to make parent directory '%s' when caching '%s': %s",
-                main_cache, unique_id_checksum, local_error->message);
-            goto done;
-          }
-      }
-    save_file_path = g_build_filename (main_cache, unique_id_checksum, NULL);
-    save_file      = g_file_new_for_path (save_file_path);
-
-    result = g_file_get_contents (
-        save_file_path, &existing_contents,
-        &existing_contents_size, NULL);
-    /* Only write if the file has definitely changed */
-    if (!result ||
-        existing_contents_size != bytes_size ||
-        memcmp (existing_contents, bytes_data, bytes_size) != 0)
+    variant = g_variant_builder_end (builder);
+    bytes   = g_variant_get_data_as_bytes (variant);
+    digest  = digest_pack_record (bytes);
+
+    locker   = g_mutex_locker_new (&self->pack_mutex);
+    existing = pack_lookup_locked (self, unique_id_checksum);
+    elide    = existing != NULL &&
+               existing->digest == digest &&
+               existing->raw_length == g_bytes_get_size (bytes);
+    /* Nothing changed since the entry was last cached */
+    if (elide)
+      self->elided_writes++;
+    g_clear_pointer (&locker, g_mutex_locker_free);
+
+    if (!elide)
       {
-        output = g_file_replace (
-            save_file,
-            NULL,
-            FALSE,
-            G_FILE_CREATE_REPLACE_DESTINATION,
-            NULL,
-            &local_error);
-        if (output == NULL)
-          {
-            ret_error = g_error_new (
-                BZ_ENTRY_CACHE_ERROR,
-                BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
-                "Failed to open write stream when caching '%s': %s",
-                unique_id_checksum, local_error->message);
-            goto done;
-          }
-
-        bytes_written = g_output_stream_write_bytes (G_OUTPUT_STREAM (output), bytes, NULL, &local_error);
-        if (bytes_written < 0)
-          {
-            ret_error = g_error_new (
-                BZ_ENTRY_CACHE_ERROR,
-                BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
-                "Failed to write data to stream when caching '%s': %s",
-                unique_id_checksum, local_error->message);
-            goto done;
-          }
-
-        result = g_output_stream_close (G_OUTPUT_STREAM (output), NULL, &local_error);
+        /* Deflate without holding up the whole pack, the
+         * living guard already keeps out other writers of
+         * this entry
+         */
+        deflate_start = g_get_monotonic_time ();
+        stored        = deflate_record (bytes, self->deflate_level, &flags);
+        deflate_usec  = g_get_monotonic_time () - deflate_start;
+
+        locker = g_mutex_locker_new (&self->pack_mutex);
+        result = pack_append_locked (
+            self, unique_id_checksum,
+            stored, flags, g_bytes_get_size (bytes),
+            digest, &local_error);
         if (!result)
           {
             ret_error = g_error_new (
                 BZ_ENTRY_CACHE_ERROR,
                 BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
-                "Failed to close stream when caching '%s': %s",
+                "Failed to append '%s' to the entry cache: %s",
                 unique_id_checksum, local_error->message);
             goto done;
           }
+        self->committed_writes++;
+        self->raw_bytes_written += g_bytes_get_size (bytes);
+        self->stored_bytes_written += g_bytes_get_size (stored);
+        self->deflate_usec += deflate_usec;
+
+        pack_queue_commit_locked (self);
+        commit = dex_ref (DEX_FUTURE (self->pack_commit));
       }
+    g_clear_pointer (&locker, g_mutex_locker_free);
 
     g_timer_start (living->cached);
+    living->size = g_bytes_get_size (bytes);
   }
+  bz_clear_guard (&guard);
+
+  /* A retained copy would now be stale */
+  if (commit != NULL)
+    lru_remove (self, unique_id_checksum);
+
+  /* Readers wait on our promise, so only settle it
+   * once the record can actually be read back
+   */
+  if (commit != NULL &&
+      !dex_await (g_steal_pointer (&commit), &local_error))
+    ret_error = g_error_new (
+        BZ_ENTRY_CACHE_ERROR,
+        BZ_ENTRY_CACHE_ERROR_CACHE_FAILED,
+        "Failed to commit '%s' to the entry cache: %s",
+        unique_id_checksum, local_error->message);
+
 done:
-  bz_clear_guard (&slot_guard);
+  g_clear_pointer (&locker, g_mutex_locker_free);
+  bz_clear_guard (&guard);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&other_guard,
-                               &self->writing_mutex,
-                               &self->writing_gate);
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
+                               &stripe->writing_mutex,
+                               &stripe->writing_gate);
   {
     if (ret_error != NULL)
       dex_promise_reject (promise, g_error_copy (ret_error));
     else
       dex_promise_resolve_boolean (promise, TRUE);
 
-    g_hash_table_remove (self->writing_hash, unique_id_checksum);
+    g_hash_table_remove (stripe->writing_hash, unique_id_checksum);
   }
-  bz_clear_guard (&other_guard);
+  bz_clear_guard (&guard);
+
+  /* Writing alone never attaches a live entry */
+  queue_prune (self, unique_id_checksum);
 
   if (ret_error != NULL)
     return dex_future_new_for_error (g_steal_pointer (&ret_error));
   else
-    return dex_future_new_true ();
+    return dex_future_new_for_boolean (!elide);
 }
 
 static DexFuture *
@@ -573,24 +1254,28 @@ read_task_fiber (ReadTaskData *data)
   g_autoptr (LivingEntryData) living   = NULL;
   DexFuture *reading_future            = NULL;
   g_autoptr (DexPromise) promise       = NULL;
-  g_autofree char *main_cache          = NULL;
-  g_autofree char *path                = NULL;
-  g_autoptr (GFile) file               = NULL;
   g_autoptr (GBytes) bytes             = NULL;
+  guint32 flags                        = 0;
+  gsize   raw_length                   = 0;
+  gint64  inflate_start                = 0;
   g_autoptr (GVariant) variant         = NULL;
   g_autoptr (BzFlatpakEntry) entry     = NULL;
+  g_autoptr (PruneTaskData) prune      = NULL;
   gboolean result                      = FALSE;
   g_autoptr (GError) ret_error         = NULL;
+  EntryStripe *stripe                  = NULL;
 
   bz_weak_get_or_return_reject (self, data->self);
+  stripe = stripe_for (self, unique_id_checksum);
 
   dex_await (dex_ref (self->init), NULL);
+  mark_activity (self);
 
   BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
-                               &self->writing_mutex,
-                               &self->writing_gate);
+                               &stripe->writing_mutex,
+                               &stripe->writing_gate);
   {
-    writing_future = g_hash_table_lookup (self->writing_hash, unique_id_checksum);
+    writing_future = g_hash_table_lookup (stripe->writing_hash, unique_id_checksum);
     if (writing_future != NULL)
       {
         dex_ref (writing_future);
@@ -601,24 +1286,24 @@ read_task_fiber (ReadTaskData *data)
   bz_clear_guard (&guard);
 
   BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
-                               &self->reading_mutex,
-                               &self->reading_gate);
+                               &stripe->reading_mutex,
+                               &stripe->reading_gate);
   {
-    reading_future = g_hash_table_lookup (self->reading_hash, unique_id_checksum);
+    reading_future = g_hash_table_lookup (stripe->reading_hash, unique_id_checksum);
     if (reading_future != NULL)
       return dex_ref (reading_future);
     promise = dex_promise_new ();
-    g_hash_table_replace (self->reading_hash,
+    g_hash_table_replace (stripe->reading_hash,
                           g_strdup (unique_id_checksum),
                           dex_ref (promise));
   }
   bz_clear_guard (&guard);
 
   BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
-                               &self->alive_mutex,
-                               &self->alive_gate);
+                               &stripe->alive_mutex,
+                               &stripe->alive_gate);
   {
-    living = g_hash_table_lookup (self->alive_hash, unique_id_checksum);
+    living = g_hash_table_lookup (stripe->alive_hash, unique_id_checksum);
     if (living != NULL)
       {
         g_autoptr (BzEntry) living_entry = NULL;
@@ -630,12 +1315,16 @@ read_task_fiber (ReadTaskData *data)
         living_entry = g_weak_ref_get (&living->wr);
         if (living_entry != NULL)
           {
+            gsize size = living->size;
+
             bz_clear_guard (&guard);
+            lru_touch (self, unique_id_checksum, living_entry, size);
+
             BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
-                                         &self->reading_mutex,
-                                         &self->reading_gate);
+                                         &stripe->reading_mutex,
+                                         &stripe->reading_gate);
             {
-              g_hash_table_remove (self->reading_hash, unique_id_checksum);
+              g_hash_table_remove (stripe->reading_hash, unique_id_checksum);
             }
             bz_clear_guard (&guard);
 
@@ -650,9 +1339,10 @@ read_task_fiber (ReadTaskData *data)
         g_mutex_init (&living->mutex);
         living->cached = g_timer_new ();
 
-        g_hash_table_replace (self->alive_hash,
+        g_hash_table_replace (stripe->alive_hash,
                               g_strdup (unique_id_checksum),
                               living_entry_data_ref (living));
+        adjust_living_entries (self, 1);
         bz_clear_guard (&guard);
 
         BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &living->mutex, &living->gate);
@@ -661,257 +1351,1913 @@ read_task_fiber (ReadTaskData *data)
 
   /* living data was guarded */
 
-  main_cache = bz_dup_module_dir ();
-  path       = g_build_filename (main_cache, unique_id_checksum, NULL);
-  file       = g_file_new_for_path (path);
-
-  bytes = g_file_load_bytes (file, NULL, NULL, &local_error);
+  g_mutex_lock (&self->pack_mutex);
+  bytes = pack_read_locked (self, unique_id_checksum, &flags, &raw_length);
+  g_mutex_unlock (&self->pack_mutex);
   if (bytes == NULL)
     {
       ret_error = g_error_new (
           BZ_ENTRY_CACHE_ERROR,
           BZ_ENTRY_CACHE_ERROR_DECACHE_FAILED,
-          "Failed to de-cache variant from file: %s",
-          local_error->message);
+          "Entry with unique ID checksum '%s' is not in the entry cache",
+          unique_id_checksum);
       goto done;
     }
 
-  variant = g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, bytes, FALSE);
-  if (variant == NULL)
+  if (flags & PACK_RECORD_DEFLATED)
     {
-      ret_error = g_error_new (
-          BZ_ENTRY_CACHE_ERROR,
-          BZ_ENTRY_CACHE_ERROR_DECACHE_FAILED,
-          "Failed to interpret variant from %s: %s",
-          path, local_error->message);
-      goto done;
+      g_autoptr (GBytes) inflated = NULL;
+
+      inflate_start = g_get_monotonic_time ();
+      inflated      = inflate_record (bytes, raw_length, &local_error);
+
+      g_mutex_lock (&self->pack_mutex);
+      self->inflate_usec += g_get_monotonic_time () - inflate_start;
+      if (inflated != NULL)
+        self->inflated_bytes += g_bytes_get_size (inflated);
+      g_mutex_unlock (&self->pack_mutex);
+
+      if (inflated == NULL)
+        {
+          ret_error = g_error_new (
+              BZ_ENTRY_CACHE_ERROR,
+              BZ_ENTRY_CACHE_ERROR_DECACHE_FAILED,
+              "Failed to inflate entry '%s': %s",
+              unique_id_checksum, local_error->message);
+          goto done;
+        }
+      g_clear_pointer (&bytes, g_bytes_unref);
+      bytes = g_steal_pointer (&inflated);
     }
 
+  /* Unless it was deflated, the slice points straight into
+   * the mapped pack. Either way every record is written by
+   * us from a builder and sits on a PACK_ALIGNMENT boundary,
+   * so GVariant can read it in place without a normal-form
+   * check or an aligned copy
+   */
+  variant      = g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, bytes, TRUE);
+  living->size = g_bytes_get_size (bytes);
+
   entry  = g_object_new (BZ_TYPE_FLATPAK_ENTRY, NULL);
+  /* The entry keeps its cold record as a child of this
+   * variant, so the slice and the mapping behind it stay
+   * alive with the entry. That is safe because records are
+   * never rewritten in place: appends only ever go past the
+   * end, truncation only drops an unindexed torn tail, and
+   * GC renames a new file over the old one
+   */
   result = bz_serializable_deserialize (BZ_SERIALIZABLE (entry), variant, &local_error);
   if (!result)
     {
       ret_error = g_error_new (
           BZ_ENTRY_CACHE_ERROR,
           BZ_ENTRY_CACHE_ERROR_DECACHE_FAILED,
-          "Failed to deserialize entry from %s: %s",
-          path, local_error->message);
+          "Failed to deserialize entry '%s': %s",
+          unique_id_checksum, local_error->message);
       goto done;
     }
   g_weak_ref_init (&living->wr, entry);
+  lru_touch (self, unique_id_checksum, BZ_ENTRY (entry), living->size);
+
+  /* Forget about the entry as soon as it goes away */
+  prune                     = prune_task_data_new ();
+  prune->self               = bz_track_weak (self);
+  prune->unique_id_checksum = g_strdup (unique_id_checksum);
+  g_object_weak_ref (G_OBJECT (entry),
+                     (GWeakNotify) entry_finalized_cb,
+                     g_steal_pointer (&prune));
 
 done:
   BZ_BEGIN_GUARD_WITH_CONTEXT (&guard,
-                               &self->reading_mutex,
-                               &self->reading_gate);
+                               &stripe->reading_mutex,
+                               &stripe->reading_gate);
   {
     if (ret_error != NULL)
       dex_promise_reject (promise, g_error_copy (ret_error));
     else
       dex_promise_resolve_object (promise, g_object_ref (entry));
 
-    g_hash_table_remove (self->reading_hash, unique_id_checksum);
+    g_hash_table_remove (stripe->reading_hash, unique_id_checksum);
   }
   bz_clear_guard (&guard);
 
   if (ret_error != NULL)
-    return dex_future_new_for_error (g_steal_pointer (&ret_error));
+    {
+      queue_prune (self, unique_id_checksum);
+      return dex_future_new_for_error (g_steal_pointer (&ret_error));
+    }
   else
     return dex_future_new_for_object (entry);
 }
 
+static DexFuture *
+prune_task_fiber (PruneTaskData *data)
+{
+  g_autoptr (BzEntryCacheManager) self = NULL;
+  char *unique_id_checksum             = data->unique_id_checksum;
+  g_autoptr (BzGuard) guard            = NULL;
+  g_autoptr (BzGuard) living_guard     = NULL;
+  LivingEntryData *living              = NULL;
+  g_autoptr (BzEntry) entry            = NULL;
+  gboolean pruned                      = FALSE;
+  const PackRecord *record             = NULL;
+  guint64           freed              = 0;
+  gboolean          queue_trim         = FALSE;
+  EntryStripe      *stripe             = NULL;
+
+  bz_weak_get_or_return_reject (self, data->self);
+  stripe = stripe_for (self, unique_id_checksum);
+
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &stripe->alive_mutex, &stripe->alive_gate);
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &stripe->reading_mutex, &stripe->reading_gate);
+  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &stripe->writing_mutex, &stripe->writing_gate);
+  {
+    living = g_hash_table_lookup (stripe->alive_hash, unique_id_checksum);
+
+    /* Tasks in flight will queue another prune when they
+     * finish, so leave their living data alone
+     */
+    if (living != NULL &&
+        !g_hash_table_contains (stripe->reading_hash, unique_id_checksum) &&
+        !g_hash_table_contains (stripe->writing_hash, unique_id_checksum))
+      {
+        BZ_BEGIN_GUARD_WITH_CONTEXT (&living_guard, &living->mutex, &living->gate);
+        entry = g_weak_ref_get (&living->wr);
+        bz_clear_guard (&living_guard);
+
+        if (entry == NULL)
+          {
+            g_hash_table_remove (stripe->alive_hash, unique_id_checksum);
+            adjust_living_entries (self, -1);
+            pruned = TRUE;
+          }
+      }
+  }
+  bz_clear_guard (&guard);
+
+  if (!pruned)
+    return dex_future_new_false ();
+
+  /* The serialized size is a fair estimate of what the
+   * entry held on to while it was alive
+   */
+  g_mutex_lock (&self->pack_mutex);
+  record = pack_lookup_locked (self, unique_id_checksum);
+  if (record != NULL)
+    freed = record->raw_length;
+  g_mutex_unlock (&self->pack_mutex);
+
+  g_mutex_lock (&self->mutex);
+  self->trim_bytes += freed;
+  if (self->trim_bytes >= TRIM_THRESHOLD_BYTES && !self->trim_queued)
+    {
+      self->trim_queued = TRUE;
+      queue_trim        = TRUE;
+    }
+  g_mutex_unlock (&self->mutex);
+
+  if (queue_trim)
+    dex_future_disown (dex_scheduler_spawn (
+        self->scheduler,
+        bz_get_dex_stack_size (),
+        (DexFiberFunc) trim_fiber,
+        bz_track_weak (self), bz_weak_release));
+
+  return dex_future_new_true ();
+}
+
 static DexFuture *
 enumerate_disk_fiber (GWeakRef *wr)
 {
-  g_autoptr (BzEntryCacheManager) self   = NULL;
-  g_autoptr (GError) local_error         = NULL;
-  g_autoptr (BzGuard) guard              = NULL;
-  g_autoptr (GHashTable) set             = NULL;
-  g_autofree char *main_cache            = NULL;
-  g_autoptr (GFile) main_cache_file      = NULL;
-  g_autoptr (GFileEnumerator) enumerator = NULL;
+  g_autoptr (BzEntryCacheManager) self = NULL;
+  g_autoptr (GError) local_error       = NULL;
+  g_autoptr (GHashTable) set           = NULL;
+  g_autoptr (GMutexLocker) locker      = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
 
+  dex_await (dex_ref (self->init), NULL);
+
   set = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &self->alive_mutex, &self->alive_gate);
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &self->reading_mutex, &self->reading_gate);
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &self->writing_mutex, &self->writing_gate);
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  if (!pack_reload_if_replaced_locked (self, &local_error))
+    g_warning ("Failed to reopen entry cache pack: %s", local_error->message);
+  pack_collect_keys_locked (self, set);
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  /* Enumerating means the caller is about to reconcile with
+   * what another process wrote, so retained copies from
+   * before that are not to be trusted anymore
+   */
+  lru_clear (self);
 
-  main_cache = bz_dup_module_dir ();
-  if (!g_file_test (main_cache, G_FILE_TEST_EXISTS))
-    goto done;
-
-  main_cache_file = g_file_new_for_path (main_cache);
-  enumerator      = g_file_enumerate_children (
-      main_cache_file,
-      G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK
-      "," G_FILE_ATTRIBUTE_STANDARD_NAME
-      "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
-      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-      NULL,
-      &local_error);
-  if (enumerator == NULL)
-    return dex_future_new_reject (
-        BZ_ENTRY_CACHE_ERROR,
-        BZ_ENTRY_CACHE_ERROR_ENUMERATE_FAILED,
-        "Could not initialize directory enumerator at %s: %s",
-        main_cache, local_error->message);
+  return dex_future_new_take_boxed (G_TYPE_HASH_TABLE, g_steal_pointer (&set));
+}
 
-  for (;;)
+static DexFuture *
+invalidate_task_fiber (InvalidateTaskData *data)
+{
+  g_autoptr (BzEntryCacheManager) self = NULL;
+  g_autoptr (GError) local_error       = NULL;
+  g_autoptr (BzGuard) guard            = NULL;
+  gboolean result                      = FALSE;
+  int      n_dropped                   = 0;
+
+  bz_weak_get_or_return_reject (self, data->self);
+
+  dex_await (dex_ref (self->init), NULL);
+
+  /* Reloading clears the whole LRU if the other process
+   * replaced the index, catching up covers records it
+   * appended without indexing them yet
+   */
+  g_mutex_lock (&self->pack_mutex);
+  result = pack_lock_locked (self, &local_error);
+  if (result)
     {
-      g_autoptr (GFileInfo) info = NULL;
-      g_autoptr (GFile) child    = NULL;
-      g_autofree char *basename  = NULL;
+      result = pack_reload_if_replaced_locked (self, &local_error) &&
+               pack_catch_up_locked (self, &local_error);
+      pack_unlock_locked (self);
+    }
+  g_mutex_unlock (&self->pack_mutex);
+  if (!result)
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
 
-      info = g_file_enumerator_next_file (enumerator, NULL, &local_error);
-      if (info == NULL)
-        {
-          if (local_error != NULL)
-            return dex_future_new_reject (
-                BZ_ENTRY_CACHE_ERROR,
-                BZ_ENTRY_CACHE_ERROR_ENUMERATE_FAILED,
-                "Could not enumerate children of cache directory at %s: %s",
-                main_cache, local_error->message);
-          else
-            break;
-        }
-      child = g_file_enumerator_get_child (enumerator, info);
+  for (guint i = 0; i < data->checksums->len; i++)
+    {
+      const char  *unique_id_checksum = NULL;
+      EntryStripe *stripe             = NULL;
 
-      if (g_file_info_get_is_symlink (info) ||
-          g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR)
-        continue;
+      unique_id_checksum = g_ptr_array_index (data->checksums, i);
+      stripe             = stripe_for (self, unique_id_checksum);
+
+      lru_remove (self, unique_id_checksum);
 
-      basename = g_file_get_basename (child);
-      if (basename != NULL)
-        g_hash_table_replace (set, g_steal_pointer (&basename), NULL);
+      /* Whoever still holds the old entry keeps it, and its
+       * prune leaves a newer living entry alone
+       */
+      BZ_BEGIN_GUARD_WITH_CONTEXT (&guard, &stripe->alive_mutex, &stripe->alive_gate);
+      if (g_hash_table_remove (stripe->alive_hash, unique_id_checksum))
+        n_dropped++;
+      bz_clear_guard (&guard);
     }
+  if (n_dropped > 0)
+    adjust_living_entries (self, -n_dropped);
 
-done:
-  return dex_future_new_take_boxed (G_TYPE_HASH_TABLE, g_steal_pointer (&set));
+  return dex_future_new_true ();
+}
+
+static DexFuture *
+gc_task_fiber (GcTaskData *data)
+{
+  g_autoptr (BzEntryCacheManager) self = NULL;
+  g_autoptr (GError) local_error       = NULL;
+  g_autoptr (GMutexLocker) locker      = NULL;
+  gboolean result                      = FALSE;
+
+  bz_weak_get_or_return_reject (self, data->self);
+
+  dex_await (dex_ref (self->init), NULL);
+
+  locker = g_mutex_locker_new (&self->pack_mutex);
+  result = pack_collect_garbage_locked (self, data->live, data->max_size, &local_error);
+  g_clear_pointer (&locker, g_mutex_locker_free);
+  if (!result)
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
+
+  return dex_future_new_true ();
 }
 
 static DexFuture *
-watch_init_fiber (GWeakRef *wr)
+init_fiber (GWeakRef *wr)
 {
   g_autoptr (BzEntryCacheManager) self = NULL;
+  g_autoptr (GError) local_error       = NULL;
+  gboolean result                      = FALSE;
 
   bz_weak_get_or_return_reject (self, wr);
 
   // bz_discard_module_dir ();
-  dex_promise_resolve_boolean (self->init, TRUE);
+  g_mutex_lock (&self->pack_mutex);
+  result = pack_open_locked (self, &local_error);
+  if (result)
+    result = pack_migrate_legacy_locked (self, &local_error);
+  if (result)
+    result = pack_flush_index_locked (self, &local_error);
+  g_mutex_unlock (&self->pack_mutex);
+  if (!result)
+    g_warning ("Failed to open entry cache pack, entries "
+               "will not be cached this session: %s",
+               local_error->message);
 
-  return dex_future_finally_loop (
-      dex_timeout_new_msec (WATCH_CLEANUP_INTERVAL_MSEC),
-      (DexFutureCallback) watch_cb,
-      bz_track_weak (self), bz_weak_release);
+  dex_promise_resolve_boolean (self->init, TRUE);
+  return dex_future_new_true ();
 }
 
 static DexFuture *
-watch_cb (DexFuture *future,
-          GWeakRef  *wr)
+notify_props_fiber (GWeakRef *wr)
 {
   g_autoptr (BzEntryCacheManager) self = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
 
-  return dex_scheduler_spawn (
-      self->scheduler,
-      bz_get_dex_stack_size (),
-      (DexFiberFunc) watch_work_fiber,
-      bz_track_weak (self), bz_weak_release);
+  g_atomic_int_set (&self->notify_queued, FALSE);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_LIVING_ENTRIES]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_ELIDED_WRITES]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_COMMITTED_WRITES]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_MEMORY_USAGE]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_LRU_ENTRIES]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_RAW_BYTES_WRITTEN]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_STORED_BYTES_WRITTEN]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_DEFLATE_USEC]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_INFLATE_USEC]);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_INFLATED_BYTES]);
+  return dex_future_new_true ();
 }
 
 static DexFuture *
-watch_work_fiber (GWeakRef *wr)
+commit_fiber (GWeakRef *wr)
 {
   g_autoptr (BzEntryCacheManager) self = NULL;
-  g_autoptr (BzGuard) guard0           = NULL;
-  GHashTableIter iter                  = { 0 };
-  g_autoptr (GTimer) timer             = NULL;
-  guint total                          = 0;
-  guint active                         = 0;
-  guint alive                          = 0;
-  guint pruned                         = 0;
+  g_autoptr (DexPromise) promise       = NULL;
+  g_autoptr (GError) local_error       = NULL;
+  gboolean result                      = FALSE;
+  guint    committed                   = 0;
+  guint    elided                      = 0;
+  guint64  raw_bytes                   = 0;
+  guint64  stored_bytes                = 0;
+  guint64  deflate_usec                = 0;
 
   bz_weak_get_or_return_reject (self, wr);
 
-  timer = g_timer_new ();
+  /* Let the rest of a burst of writes join this batch */
+  dex_await (dex_timeout_new_msec (PACK_COMMIT_DELAY_MSEC), NULL);
 
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard0, &self->alive_mutex, &self->alive_gate);
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard0, &self->reading_mutex, &self->reading_gate);
-  BZ_BEGIN_GUARD_WITH_CONTEXT (&guard0, &self->writing_mutex, &self->writing_gate);
+  g_mutex_lock (&self->pack_mutex);
+  promise      = g_steal_pointer (&self->pack_commit);
+  result       = pack_flush_index_locked (self, &local_error);
+  committed    = self->committed_writes;
+  elided       = self->elided_writes;
+  raw_bytes    = self->raw_bytes_written;
+  stored_bytes = self->stored_bytes_written;
+  deflate_usec = self->deflate_usec;
+  g_mutex_unlock (&self->pack_mutex);
 
-  g_hash_table_iter_init (&iter, self->alive_hash);
-  for (;;)
+  if (promise == NULL)
+    return dex_future_new_true ();
+
+  if (result)
+    {
+      g_debug ("Committed entry cache batch, %u writes committed "
+               "and %u elided so far this session, %" G_GUINT64_FORMAT
+               " bytes stored as %" G_GUINT64_FORMAT " in %" G_GUINT64_FORMAT
+               " usec of deflating",
+               committed, elided, raw_bytes, stored_bytes, deflate_usec);
+      dex_promise_resolve_boolean (promise, TRUE);
+    }
+  else
     {
-      char            *unique_id_checksum = NULL;
-      LivingEntryData *living             = NULL;
-      g_autoptr (BzGuard) guard1          = NULL;
-      g_autoptr (BzEntry) entry           = NULL;
+      g_warning ("Failed to commit entry cache batch: %s", local_error->message);
+      dex_promise_reject (promise, g_error_copy (local_error));
+    }
+  queue_notify_props (self);
 
-      if (!g_hash_table_iter_next (&iter, (gpointer *) &unique_id_checksum, (gpointer *) &living))
-        break;
-      total++;
+  return dex_future_new_true ();
+}
 
-      if (g_hash_table_contains (self->reading_hash, unique_id_checksum) ||
-          g_hash_table_contains (self->writing_hash, unique_id_checksum))
-        {
-          active++;
-          continue;
-        }
+static DexFuture *
+trim_fiber (GWeakRef *wr)
+{
+  for (;;)
+    {
+      g_autoptr (BzEntryCacheManager) self = NULL;
+      gint64  idle                         = 0;
+      guint64 freed                        = 0;
 
-      BZ_BEGIN_GUARD_WITH_CONTEXT (&guard1, &living->mutex, &living->gate);
+      dex_await (dex_timeout_new_msec (TRIM_IDLE_MSEC), NULL);
+      bz_weak_get_or_return_reject (self, wr);
 
-      entry = g_weak_ref_get (&living->wr);
-      if (entry != NULL)
-        alive++;
-      else
+      g_mutex_lock (&self->mutex);
+      idle = g_get_monotonic_time () - self->last_activity;
+      if (idle >= TRIM_IDLE_MSEC * G_TIME_SPAN_MILLISECOND)
         {
-          bz_clear_guard (&guard1);
-          g_hash_table_iter_remove (&iter);
-          pruned++;
+          freed             = self->trim_bytes;
+          self->trim_bytes  = 0;
+          self->trim_queued = FALSE;
         }
-    }
-  bz_clear_guard (&guard0);
+      g_mutex_unlock (&self->mutex);
+
+      /* Still busy, check back later */
+      if (idle < TRIM_IDLE_MSEC * G_TIME_SPAN_MILLISECOND)
+        continue;
 
 #ifdef __GLIBC__
-  malloc_trim (0);
+      malloc_trim (0);
 #endif
+      g_debug ("Trimmed the heap after roughly %" G_GUINT64_FORMAT
+               " bytes worth of entries were released",
+               freed);
+      return dex_future_new_true ();
+    }
+}
 
-  g_debug ("Sweep report: finished in %.4f seconds, including time to acquire guards\n"
-           "  Out of a total of %d entries considered:\n"
-           "    %d were skipped due to active tasks being associated with them\n"
-           "    %d application entries were otherwise kept alive\n"
-           "    %d entries were forgotten by the application and were pruned\n"
-           "  Another sweep will take place in %d msec",
-           g_timer_elapsed (timer, NULL),
-           total, active, alive, pruned, WATCH_CLEANUP_INTERVAL_MSEC);
+static void
+lru_touch (BzEntryCacheManager *self,
+           const char          *unique_id_checksum,
+           BzEntry             *entry,
+           gsize                size)
+{
+  g_autoptr (GPtrArray) evicted   = NULL;
+  g_autoptr (BzEntry) stale       = NULL;
+  g_autoptr (GMutexLocker) locker = NULL;
+  GList       *link               = NULL;
+  LruItemData *item               = NULL;
 
-  g_mutex_lock (&self->mutex);
-  self->living_entries = active + alive;
-  g_mutex_unlock (&self->mutex);
+  if (self->memory_budget == 0)
+    return;
 
-  dex_future_disown (dex_scheduler_spawn (
-      dex_scheduler_get_default (),
-      bz_get_dex_stack_size (),
-      (DexFiberFunc) notify_props_fiber,
-      bz_track_weak (self),
-      bz_weak_release));
+  evicted = g_ptr_array_new_with_free_func (lru_item_data_unref);
+  locker  = g_mutex_locker_new (&self->lru_mutex);
 
-  return dex_timeout_new_msec (WATCH_CLEANUP_INTERVAL_MSEC);
-}
+  link = g_hash_table_lookup (self->lru_links, unique_id_checksum);
+  if (link != NULL)
+    {
+      item = link->data;
+      g_queue_unlink (&self->lru, link);
+      g_queue_push_head_link (&self->lru, link);
 
-static DexFuture *
-notify_props_fiber (GWeakRef *wr)
+      if (item->entry != entry)
+        {
+          /* Drop the old reference outside of the lock */
+          stale       = g_steal_pointer (&item->entry);
+          item->entry = g_object_ref (entry);
+        }
+      self->memory_usage -= item->size;
+    }
+  else
+    {
+      item                     = lru_item_data_new ();
+      item->unique_id_checksum = g_strdup (unique_id_checksum);
+      item->entry              = g_object_ref (entry);
+
+      g_queue_push_head (&self->lru, item);
+      g_hash_table_replace (self->lru_links, item->unique_id_checksum, self->lru.head);
+    }
+  item->size = size;
+  self->memory_usage += size;
+
+  /* Always keep the most recent entry, even if it alone
+   * does not fit in the budget
+   */
+  while (self->memory_usage > self->memory_budget &&
+         self->lru.length > 1)
+    {
+      LruItemData *victim = NULL;
+
+      victim = g_queue_pop_tail (&self->lru);
+      g_hash_table_remove (self->lru_links, victim->unique_id_checksum);
+      self->memory_usage -= victim->size;
+      g_ptr_array_add (evicted, victim);
+    }
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  /* Dropping the last references may finalize entries,
+   * which in turn queues their prune
+   */
+  g_clear_pointer (&evicted, g_ptr_array_unref);
+  g_clear_object (&stale);
+  queue_notify_props (self);
+}
+
+static void
+lru_remove (BzEntryCacheManager *self,
+            const char          *unique_id_checksum)
+{
+  g_autoptr (LruItemData) item    = NULL;
+  g_autoptr (GMutexLocker) locker = NULL;
+  GList *link                     = NULL;
+
+  if (self->memory_budget == 0)
+    return;
+
+  locker = g_mutex_locker_new (&self->lru_mutex);
+  link   = g_hash_table_lookup (self->lru_links, unique_id_checksum);
+  if (link == NULL)
+    return;
+
+  item = link->data;
+  g_hash_table_remove (self->lru_links, unique_id_checksum);
+  g_queue_delete_link (&self->lru, link);
+  self->memory_usage -= item->size;
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  g_clear_pointer (&item, lru_item_data_unref);
+  queue_notify_props (self);
+}
+
+static void
+lru_clear (BzEntryCacheManager *self)
+{
+  GQueue stolen                   = G_QUEUE_INIT;
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  if (self->memory_budget == 0)
+    return;
+
+  locker = g_mutex_locker_new (&self->lru_mutex);
+  stolen = self->lru;
+  g_queue_init (&self->lru);
+  g_hash_table_remove_all (self->lru_links);
+  self->memory_usage = 0;
+  g_clear_pointer (&locker, g_mutex_locker_free);
+
+  /* Dropping the last references may finalize entries,
+   * which in turn queues their prune
+   */
+  g_queue_clear_full (&stolen, lru_item_data_unref);
+  queue_notify_props (self);
+}
+
+static void
+entry_finalized_cb (PruneTaskData *data,
+                    GObject       *where_the_object_was)
 {
   g_autoptr (BzEntryCacheManager) self = NULL;
 
-  bz_weak_get_or_return_reject (self, wr);
+  self = g_weak_ref_get (data->self);
+  if (self != NULL)
+    queue_prune (self, data->unique_id_checksum);
+  prune_task_data_unref (data);
+}
 
-  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_LIVING_ENTRIES]);
-  return dex_future_new_true ();
+static void
+queue_prune (BzEntryCacheManager *self,
+             const char          *unique_id_checksum)
+{
+  g_autoptr (PruneTaskData) data = NULL;
+
+  data                     = prune_task_data_new ();
+  data->self               = bz_track_weak (self);
+  data->unique_id_checksum = g_strdup (unique_id_checksum);
+
+  dex_future_disown (dex_scheduler_spawn (
+      self->scheduler,
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) prune_task_fiber,
+      prune_task_data_ref (data),
+      prune_task_data_unref));
+}
+
+static void
+queue_notify_props (BzEntryCacheManager *self)
+{
+  /* Coalesce bursts of changes into one notification */
+  if (!g_atomic_int_compare_and_exchange (&self->notify_queued, FALSE, TRUE))
+    return;
+
+  dex_future_disown (dex_scheduler_spawn (
+      dex_scheduler_get_default (),
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) notify_props_fiber,
+      bz_track_weak (self),
+      bz_weak_release));
+}
+
+static void
+mark_activity (BzEntryCacheManager *self)
+{
+  g_mutex_lock (&self->mutex);
+  self->last_activity = g_get_monotonic_time ();
+  g_mutex_unlock (&self->mutex);
+}
+
+static void
+adjust_living_entries (BzEntryCacheManager *self,
+                       int                  delta)
+{
+  g_mutex_lock (&self->mutex);
+  self->living_entries += delta;
+  g_mutex_unlock (&self->mutex);
+
+  queue_notify_props (self);
+}
+
+static EntryStripe *
+stripe_for (BzEntryCacheManager *self,
+            const char          *unique_id_checksum)
+{
+  int   hi    = 0;
+  int   lo    = 0;
+  guint index = 0;
+
+  /* Checksums are hex digests, so their leading bits are
+   * already evenly distributed
+   */
+  hi = g_ascii_xdigit_value (unique_id_checksum[0]);
+  lo = hi >= 0 ? g_ascii_xdigit_value (unique_id_checksum[1]) : -1;
+  if (lo >= 0)
+    index = (hi << 4) | lo;
+  else
+    index = g_str_hash (unique_id_checksum);
+
+  return &self->stripes[index & (N_STRIPES - 1)];
+}
+
+static gboolean
+pack_open_locked (BzEntryCacheManager *self,
+                  GError             **error)
+{
+  g_autofree char *main_cache    = NULL;
+  g_autofree char *lock_path     = NULL;
+  g_autoptr (GError) local_error = NULL;
+  struct stat data_stat          = { 0 };
+  guint64     covered            = 0;
+  gboolean    result             = FALSE;
+
+  main_cache = bz_dup_module_dir ();
+  if (g_mkdir_with_parents (main_cache, 0755) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to make cache directory '%s': %s",
+                   main_cache, g_strerror (errsv));
+      return FALSE;
+    }
+
+  self->pack_data_path  = g_build_filename (main_cache, PACK_DATA_BASENAME, NULL);
+  self->pack_index_path = g_build_filename (main_cache, PACK_INDEX_BASENAME, NULL);
+
+  /* Unlike the pack itself, the lock file is never replaced,
+   * so it stays open for as long as we do
+   */
+  if (self->pack_lock_fd < 0)
+    {
+      lock_path          = g_build_filename (main_cache, PACK_LOCK_BASENAME, NULL);
+      self->pack_lock_fd = g_open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (self->pack_lock_fd < 0)
+        {
+          int errsv = errno;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                       "Failed to open '%s': %s",
+                       lock_path, g_strerror (errsv));
+          return FALSE;
+        }
+    }
+  if (!pack_lock_locked (self, error))
+    return FALSE;
+
+  self->pack_fd = g_open (self->pack_data_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (self->pack_fd < 0 ||
+      fstat (self->pack_fd, &data_stat) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to open '%s': %s",
+                   self->pack_data_path, g_strerror (errsv));
+      goto out;
+    }
+  self->pack_data_dev = data_stat.st_dev;
+  self->pack_data_ino = data_stat.st_ino;
+
+  if (g_file_test (self->pack_index_path, G_FILE_TEST_IS_REGULAR))
+    {
+      self->pack_index = g_mapped_file_new (self->pack_index_path, FALSE, &local_error);
+      if (self->pack_index != NULL)
+        {
+          const PackIndexHeader *header = NULL;
+          gsize                  length = 0;
+
+          header = (gconstpointer) g_mapped_file_get_contents (self->pack_index);
+          length = g_mapped_file_get_length (self->pack_index);
+          if (length < sizeof (*header) ||
+              memcmp (header->magic, PACK_INDEX_MAGIC, sizeof (header->magic)) != 0 ||
+              header->version != PACK_INDEX_VERSION ||
+              length != sizeof (*header) + (gsize) header->n_records * sizeof (PackRecord) ||
+              header->data_size > (guint64) data_stat.st_size)
+            {
+              g_debug ("Entry cache index at %s is stale, rebuilding it",
+                       self->pack_index_path);
+              g_clear_pointer (&self->pack_index, g_mapped_file_unref);
+            }
+          else
+            covered = header->data_size;
+        }
+      else
+        {
+          g_debug ("Failed to map entry cache index at %s, rebuilding it: %s",
+                   self->pack_index_path, local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+
+  /* Recover anything appended after the index was last
+   * written, e.g. if the previous process was killed
+   */
+  self->pack_size = covered;
+  if (!pack_scan_locked (self, data_stat.st_size, error))
+    goto out;
+  self->pack_dirty = self->pack_size != covered || self->pack_buffer->len > 0;
+  pack_remember_index_locked (self);
+  result = TRUE;
+
+out:
+  pack_unlock_locked (self);
+  return result;
+}
+
+static void
+pack_close_locked (BzEntryCacheManager *self)
+{
+  if (self->pack_fd >= 0)
+    close (self->pack_fd);
+  self->pack_fd = -1;
+
+  g_clear_pointer (&self->pack_data, g_mapped_file_unref);
+  g_clear_pointer (&self->pack_index, g_mapped_file_unref);
+  g_clear_pointer (&self->pack_data_path, g_free);
+  g_clear_pointer (&self->pack_index_path, g_free);
+  g_hash_table_remove_all (self->pack_pending);
+
+  /* Buffered records don't depend on the file yet and
+   * are flushed to whatever pack is opened next
+   */
+  self->pack_size      = 0;
+  self->pack_dirty     = self->pack_buffer->len > 0;
+  self->pack_index_dev = 0;
+  self->pack_index_ino = 0;
+  self->pack_data_dev  = 0;
+  self->pack_data_ino  = 0;
+}
+
+static gboolean
+pack_lock_locked (BzEntryCacheManager *self,
+                  GError             **error)
+{
+  if (self->pack_lock_fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "The entry cache pack is not open");
+      return FALSE;
+    }
+
+  /* pack_mutex already keeps out our own threads, so
+   * nested callers only need to be counted
+   */
+  if (self->pack_lock_depth++ > 0)
+    return TRUE;
+
+  while (flock (self->pack_lock_fd, LOCK_EX) != 0)
+    {
+      int errsv = errno;
+
+      if (errsv == EINTR)
+        continue;
+
+      self->pack_lock_depth--;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to lock the entry cache pack: %s",
+                   g_strerror (errsv));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+pack_unlock_locked (BzEntryCacheManager *self)
+{
+  g_assert (self->pack_lock_depth > 0);
+
+  if (--self->pack_lock_depth == 0)
+    flock (self->pack_lock_fd, LOCK_UN);
+}
+
+static gboolean
+pack_scan_locked (BzEntryCacheManager *self,
+                  guint64              end,
+                  GError             **error)
+{
+  const char *contents = NULL;
+  guint64     offset   = 0;
+
+  offset = self->pack_size;
+  if (end <= offset)
+    return TRUE;
+
+  if (!pack_map_data_locked (self, end, error))
+    return FALSE;
+  contents = g_mapped_file_get_contents (self->pack_data);
+
+  while (offset + sizeof (PackRecordHeader) <= end)
+    {
+      const PackRecordHeader *header = NULL;
+      PackRecord             *record = NULL;
+      guint64                 next   = 0;
+
+      header = (gconstpointer) (contents + offset);
+      next   = offset + sizeof (*header) + header->length;
+      next   = (next + PACK_ALIGNMENT - 1) & ~((guint64) PACK_ALIGNMENT - 1);
+      if (header->magic != PACK_RECORD_MAGIC || next > end)
+        break;
+
+      /* Anything past what we accounted for is newer */
+      record = g_new0 (PackRecord, 1);
+      memcpy (record->key, header->key, PACK_KEY_SIZE);
+      record->offset     = offset + sizeof (*header);
+      record->digest     = header->digest;
+      record->length     = header->length;
+      record->accessed   = g_get_real_time () / G_USEC_PER_SEC;
+      record->flags      = header->flags;
+      record->raw_length = header->raw_length;
+      g_hash_table_replace (self->pack_pending,
+                            dup_pack_key_string (header->key),
+                            record);
+
+      offset = next;
+    }
+
+  /* Appends only happen under the lock, so whatever doesn't
+   * parse was left behind by a writer that died halfway
+   */
+  if (offset < end)
+    {
+      if (offset == 0)
+        g_debug ("Entry cache data at %s is from an older version, starting over",
+                 self->pack_data_path);
+      else
+        g_warning ("Discarding %" G_GUINT64_FORMAT " damaged trailing bytes of %s",
+                   end - offset, self->pack_data_path);
+      g_clear_pointer (&self->pack_data, g_mapped_file_unref);
+      if (ftruncate (self->pack_fd, offset) != 0)
+        {
+          int errsv = errno;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                       "Failed to truncate '%s': %s",
+                       self->pack_data_path, g_strerror (errsv));
+          return FALSE;
+        }
+    }
+
+  if (offset != self->pack_size)
+    self->pack_dirty = TRUE;
+  self->pack_size = offset;
+  return TRUE;
+}
+
+static gboolean
+pack_catch_up_locked (BzEntryCacheManager *self,
+                      GError             **error)
+{
+  struct stat data_stat = { 0 };
+
+  if (fstat (self->pack_fd, &data_stat) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to stat '%s': %s",
+                   self->pack_data_path, g_strerror (errsv));
+      return FALSE;
+    }
+
+  return pack_scan_locked (self, data_stat.st_size, error);
+}
+
+static gboolean
+pack_reload_if_replaced_locked (BzEntryCacheManager *self,
+                                GError             **error)
+{
+  GStatBuf index_stat = { 0 };
+  GStatBuf data_stat  = { 0 };
+
+  if (self->pack_index_path == NULL)
+    return TRUE;
+
+  if (g_stat (self->pack_index_path, &index_stat) != 0)
+    {
+      index_stat.st_dev = 0;
+      index_stat.st_ino = 0;
+    }
+  if (g_stat (self->pack_data_path, &data_stat) != 0)
+    {
+      data_stat.st_dev = 0;
+      data_stat.st_ino = 0;
+    }
+  if ((guint64) index_stat.st_dev == self->pack_index_dev &&
+      (guint64) index_stat.st_ino == self->pack_index_ino &&
+      (guint64) data_stat.st_dev == self->pack_data_dev &&
+      (guint64) data_stat.st_ino == self->pack_data_ino)
+    return TRUE;
+
+  g_debug ("Entry cache at %s was replaced by another process, reopening",
+           self->pack_data_path);
+
+  /* Whoever replaced it may have rewritten any entry, and
+   * only the writing process drops its own retained copies
+   */
+  lru_clear (self);
+
+  /* Records of ours already in the data file were either
+   * indexed by the other process or are picked up again
+   * by the scan in pack_open_locked, and buffered ones
+   * survive the reopen
+   */
+  pack_close_locked (self);
+  return pack_open_locked (self, error);
+}
+
+static void
+pack_remember_index_locked (BzEntryCacheManager *self)
+{
+  GStatBuf index_stat = { 0 };
+
+  if (self->pack_index != NULL &&
+      g_stat (self->pack_index_path, &index_stat) == 0)
+    {
+      self->pack_index_dev = index_stat.st_dev;
+      self->pack_index_ino = index_stat.st_ino;
+    }
+  else
+    {
+      self->pack_index_dev = 0;
+      self->pack_index_ino = 0;
+    }
+}
+
+static gboolean
+pack_migrate_legacy_locked (BzEntryCacheManager *self,
+                            GError             **error)
+{
+  g_autofree char *main_cache    = NULL;
+  g_autoptr (GDir) dir           = NULL;
+  g_autoptr (GError) local_error = NULL;
+  guint migrated                 = 0;
+
+  main_cache = bz_dup_module_dir ();
+  dir        = g_dir_open (main_cache, 0, error);
+  if (dir == NULL)
+    return FALSE;
+
+  /* Entries used to be stored as individual files named by
+   * their checksum, fold any of those into the pack
+   */
+  for (;;)
+    {
+      const char      *name               = NULL;
+      guint8           key[PACK_KEY_SIZE] = { 0 };
+      g_autofree char *path               = NULL;
+      g_autofree char *contents           = NULL;
+      gsize            length             = 0;
+      g_autoptr (GBytes) bytes            = NULL;
+
+      name = g_dir_read_name (dir);
+      if (name == NULL)
+        break;
+      if (!parse_pack_key (name, key))
+        continue;
+
+      path = g_build_filename (main_cache, name, NULL);
+      if (g_file_test (path, G_FILE_TEST_IS_SYMLINK) ||
+          !g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        continue;
+
+      if (g_file_get_contents (path, &contents, &length, &local_error))
+        {
+          bytes = g_bytes_new_take (g_steal_pointer (&contents), length);
+          if (!pack_append_locked (self, name, bytes, 0, length, digest_pack_record (bytes), error))
+            return FALSE;
+          migrated++;
+        }
+      else
+        {
+          g_warning ("Dropping unreadable legacy cache file %s: %s",
+                     path, local_error->message);
+          g_clear_error (&local_error);
+        }
+
+      g_unlink (path);
+    }
+
+  if (migrated == 0)
+    return TRUE;
+
+  g_debug ("Migrated %u legacy cache files into %s", migrated, self->pack_data_path);
+  return pack_flush_index_locked (self, error);
+}
+
+static const PackRecord *
+pack_lookup_locked (BzEntryCacheManager *self,
+                    const char          *unique_id_checksum)
+{
+  guint8                 key[PACK_KEY_SIZE] = { 0 };
+  const PackRecord      *record             = NULL;
+  const PackIndexHeader *header             = NULL;
+  const PackRecord      *records            = NULL;
+  guint                  lo                 = 0;
+  guint                  hi                 = 0;
+
+  if (!parse_pack_key (unique_id_checksum, key))
+    return NULL;
+
+  /* Unflushed records have buffer relative offsets, only
+   * their other fields are meaningful
+   */
+  record = g_hash_table_lookup (self->pack_unflushed, unique_id_checksum);
+  if (record == NULL)
+    record = g_hash_table_lookup (self->pack_pending, unique_id_checksum);
+  if (record != NULL || self->pack_index == NULL)
+    return record;
+
+  header  = (gconstpointer) g_mapped_file_get_contents (self->pack_index);
+  records = (gconstpointer) (header + 1);
+  hi      = header->n_records;
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      int   cmp = memcmp (records[mid].key, key, PACK_KEY_SIZE);
+
+      if (cmp == 0)
+        return &records[mid];
+      else if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return NULL;
+}
+
+static GBytes *
+pack_read_locked (BzEntryCacheManager *self,
+                  const char          *unique_id_checksum,
+                  guint32             *flags,
+                  gsize               *raw_length)
+{
+  const PackRecord *record       = NULL;
+  g_autoptr (GError) local_error = NULL;
+  g_autoptr (GBytes) data_bytes  = NULL;
+  g_autoptr (GBytes) bytes       = NULL;
+  gint64 now                     = 0;
+
+  if (self->pack_data_path == NULL)
+    return NULL;
+
+  record = pack_lookup_locked (self, unique_id_checksum);
+  if (record == NULL)
+    return NULL;
+
+  /* The record may still be sitting in the write buffer */
+  if (g_hash_table_contains (self->pack_unflushed, unique_id_checksum))
+    {
+      if (!pack_flush_output_locked (self, &local_error))
+        {
+          g_warning ("Failed to flush entry cache data to %s: %s",
+                     self->pack_data_path, local_error->message);
+          return NULL;
+        }
+
+      record = pack_lookup_locked (self, unique_id_checksum);
+      if (record == NULL)
+        return NULL;
+    }
+
+  if (!pack_map_data_locked (self, record->offset + record->length, &local_error))
+    {
+      g_warning ("Failed to map entry cache data at %s: %s",
+                 self->pack_data_path, local_error->message);
+      return NULL;
+    }
+
+  data_bytes  = g_mapped_file_get_bytes (self->pack_data);
+  bytes       = g_bytes_new_from_bytes (data_bytes, record->offset, record->length);
+  *flags      = record->flags;
+  *raw_length = record->raw_length;
+
+  now = g_get_real_time () / G_USEC_PER_SEC;
+  if ((gint64) record->accessed + PACK_ACCESS_RESOLUTION_SEC <= now)
+    pack_touch_locked (self, unique_id_checksum, record, now);
+
+  return g_steal_pointer (&bytes);
+}
+
+static gboolean
+pack_map_data_locked (BzEntryCacheManager *self,
+                      guint64              end,
+                      GError             **error)
+{
+  /* The data file only ever grows while we have it open,
+   * so records appended after it was last mapped just
+   * require a fresh mapping. Mapping our own descriptor
+   * keeps the data in line with the offsets we hold.
+   */
+  if (self->pack_data != NULL &&
+      end <= g_mapped_file_get_length (self->pack_data))
+    return TRUE;
+
+  if (self->pack_fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "The entry cache pack is not open");
+      return FALSE;
+    }
+
+  g_clear_pointer (&self->pack_data, g_mapped_file_unref);
+  self->pack_data = g_mapped_file_new_from_fd (self->pack_fd, FALSE, error);
+  if (self->pack_data == NULL)
+    return FALSE;
+
+  if (end > g_mapped_file_get_length (self->pack_data))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s is shorter than its index claims",
+                   self->pack_data_path);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static void
+pack_touch_locked (BzEntryCacheManager *self,
+                   const char          *unique_id_checksum,
+                   const PackRecord    *record,
+                   guint32              now)
+{
+  PackRecord *pending = NULL;
+
+  /* Indexed records are read only, so shadow them with a
+   * pending copy that wins the next time the index is
+   * written
+   */
+  pending = g_hash_table_lookup (self->pack_pending, unique_id_checksum);
+  if (pending == NULL)
+    {
+      pending = g_memdup2 (record, sizeof (*record));
+      g_hash_table_replace (self->pack_pending, g_strdup (unique_id_checksum), pending);
+    }
+  pending->accessed = now;
+
+  self->pack_dirty = TRUE;
+  pack_queue_commit_locked (self);
+}
+
+static gboolean
+pack_append_locked (BzEntryCacheManager *self,
+                    const char          *unique_id_checksum,
+                    GBytes              *bytes,
+                    guint32              flags,
+                    gsize                raw_length,
+                    guint64              digest,
+                    GError             **error)
+{
+  static const guint8 padding[PACK_ALIGNMENT] = { 0 };
+  guint8              key[PACK_KEY_SIZE]      = { 0 };
+  PackRecordHeader    header                  = { 0 };
+  gconstpointer       data                    = NULL;
+  gsize               length                  = 0;
+  gsize               n_padding               = 0;
+  PackRecord         *record                  = NULL;
+
+  if (self->pack_fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "The entry cache pack is not open");
+      return FALSE;
+    }
+  if (!parse_pack_key (unique_id_checksum, key))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "'%s' is not a valid unique ID checksum",
+                   unique_id_checksum);
+      return FALSE;
+    }
+
+  data = g_bytes_get_data (bytes, &length);
+  if (length > G_MAXUINT32 || raw_length > G_MAXUINT32)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+                   "Record for '%s' is too large",
+                   unique_id_checksum);
+      return FALSE;
+    }
+  n_padding = (PACK_ALIGNMENT - length % PACK_ALIGNMENT) % PACK_ALIGNMENT;
+
+  header.magic      = PACK_RECORD_MAGIC;
+  header.length     = length;
+  header.digest     = digest;
+  header.flags      = flags;
+  header.raw_length = raw_length;
+  memcpy (header.key, key, PACK_KEY_SIZE);
+
+  /* Where the record ends up is only known once it is
+   * flushed, until then it is relative to the buffer
+   */
+  record = g_new0 (PackRecord, 1);
+  memcpy (record->key, key, PACK_KEY_SIZE);
+  record->offset     = self->pack_buffer->len + sizeof (header);
+  record->digest     = digest;
+  record->length     = length;
+  record->accessed   = g_get_real_time () / G_USEC_PER_SEC;
+  record->flags      = flags;
+  record->raw_length = raw_length;
+  g_hash_table_replace (self->pack_unflushed, g_strdup (unique_id_checksum), record);
+
+  g_byte_array_append (self->pack_buffer, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (self->pack_buffer, data, length);
+  g_byte_array_append (self->pack_buffer, padding, n_padding);
+  self->pack_dirty = TRUE;
+
+  if (self->pack_buffer->len >= PACK_BUFFER_SIZE)
+    return pack_flush_output_locked (self, error);
+  return TRUE;
+}
+
+static gboolean
+pack_flush_output_locked (BzEntryCacheManager *self,
+                          GError             **error)
+{
+  guint64        end    = 0;
+  GHashTableIter iter   = { 0 };
+  gboolean       result = FALSE;
+
+  if (self->pack_buffer->len == 0)
+    return TRUE;
+
+  if (self->pack_fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "The entry cache pack is not open");
+      return FALSE;
+    }
+  if (!pack_lock_locked (self, error))
+    return FALSE;
+
+  /* Never append to a data file GC already unlinked, then
+   * account for what other processes appended, our records
+   * go right after it
+   */
+  if (!pack_reload_if_replaced_locked (self, error) ||
+      !pack_catch_up_locked (self, error))
+    goto out;
+  end = self->pack_size;
+
+  if (!write_all_fd (self->pack_fd, self->pack_buffer->data, self->pack_buffer->len, error))
+    {
+      /* Don't leave a torn record for the next scan */
+      if (ftruncate (self->pack_fd, end) != 0)
+        g_debug ("Failed to drop partially written entry cache data: %s",
+                 g_strerror (errno));
+      pack_abandon_output_locked (self);
+      goto out;
+    }
+
+  g_hash_table_iter_init (&iter, self->pack_unflushed);
+  for (;;)
+    {
+      char       *checksum = NULL;
+      PackRecord *record   = NULL;
+
+      if (!g_hash_table_iter_next (&iter, (gpointer *) &checksum, (gpointer *) &record))
+        break;
+
+      record->offset += end;
+      g_hash_table_iter_steal (&iter);
+      g_hash_table_replace (self->pack_pending, checksum, record);
+    }
+  self->pack_size = end + self->pack_buffer->len;
+  g_byte_array_set_size (self->pack_buffer, 0);
+  result = TRUE;
+
+out:
+  pack_unlock_locked (self);
+  return result;
+}
+
+static void
+pack_abandon_output_locked (BzEntryCacheManager *self)
+{
+  /* A failed write can't be trusted, so forget everything
+   * that never made it into the data file
+   */
+  g_byte_array_set_size (self->pack_buffer, 0);
+  g_hash_table_remove_all (self->pack_unflushed);
+}
+
+static void
+pack_queue_commit_locked (BzEntryCacheManager *self)
+{
+  /* Join the pending batch, or start a new one */
+  if (self->pack_commit != NULL)
+    return;
+
+  self->pack_commit = dex_promise_new ();
+  dex_future_disown (dex_scheduler_spawn (
+      self->scheduler,
+      bz_get_dex_stack_size (),
+      (DexFiberFunc) commit_fiber,
+      bz_track_weak (self), bz_weak_release));
+}
+
+static gboolean
+pack_flush_index_locked (BzEntryCacheManager *self,
+                         GError             **error)
+{
+  g_autoptr (GArray) records = NULL;
+  GHashTableIter iter        = { 0 };
+  guint          n_unique    = 0;
+  gboolean       result      = FALSE;
+
+  if (!self->pack_dirty)
+    return TRUE;
+
+  if (!pack_lock_locked (self, error))
+    return FALSE;
+
+  /* Don't clobber an index written by someone else, never
+   * index data that isn't in the file yet, and cover
+   * everything up to where the index says it ends
+   */
+  if (!pack_reload_if_replaced_locked (self, error) ||
+      !pack_flush_output_locked (self, error) ||
+      !pack_catch_up_locked (self, error))
+    goto out;
+  if (!self->pack_dirty)
+    {
+      result = TRUE;
+      goto out;
+    }
+
+  /* The index must never reach the disk before the data
+   * it points into, once per commit is enough for that
+   */
+  if (fsync (self->pack_fd) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to sync '%s': %s",
+                   self->pack_data_path, g_strerror (errsv));
+      goto out;
+    }
+
+  records = g_array_new (FALSE, FALSE, sizeof (PackRecord));
+  if (self->pack_index != NULL)
+    {
+      const PackIndexHeader *old = NULL;
+
+      old = (gconstpointer) g_mapped_file_get_contents (self->pack_index);
+      g_array_append_vals (records, old + 1, old->n_records);
+    }
+
+  g_hash_table_iter_init (&iter, self->pack_pending);
+  for (;;)
+    {
+      PackRecord *record = NULL;
+
+      if (!g_hash_table_iter_next (&iter, NULL, (gpointer *) &record))
+        break;
+      g_array_append_val (records, *record);
+    }
+
+  /* Newer records always sit further into the data file,
+   * so after sorting the first record of each key wins
+   */
+  g_array_sort (records, cmp_pack_record);
+  for (guint i = 0; i < records->len; i++)
+    {
+      PackRecord *record = &g_array_index (records, PackRecord, i);
+
+      if (n_unique > 0 &&
+          memcmp (g_array_index (records, PackRecord, n_unique - 1).key,
+                  record->key, PACK_KEY_SIZE) == 0)
+        continue;
+
+      if (i != n_unique)
+        g_array_index (records, PackRecord, n_unique) = *record;
+      n_unique++;
+    }
+
+  if (!pack_write_index_locked (self, (const PackRecord *) records->data, n_unique, error))
+    goto out;
+
+  g_hash_table_remove_all (self->pack_pending);
+  self->pack_dirty = FALSE;
+  result           = TRUE;
+
+out:
+  pack_unlock_locked (self);
+  return result;
+}
+
+static gboolean
+pack_write_index_locked (BzEntryCacheManager *self,
+                         const PackRecord    *records,
+                         guint                n_records,
+                         GError             **error)
+{
+  PackIndexHeader  header        = { 0 };
+  gsize            contents_size = 0;
+  g_autofree char *contents      = NULL;
+  GMappedFile     *index         = NULL;
+
+  memcpy (header.magic, PACK_INDEX_MAGIC, sizeof (header.magic));
+  header.version   = PACK_INDEX_VERSION;
+  header.n_records = n_records;
+  header.data_size = self->pack_size;
+
+  contents_size = sizeof (header) + (gsize) n_records * sizeof (PackRecord);
+  contents      = g_malloc (contents_size);
+  memcpy (contents, &header, sizeof (header));
+  if (n_records > 0)
+    memcpy (contents + sizeof (header), records, (gsize) n_records * sizeof (PackRecord));
+
+  if (!g_file_set_contents_full (
+          self->pack_index_path,
+          contents, contents_size,
+          G_FILE_SET_CONTENTS_CONSISTENT,
+          0644, error))
+    return FALSE;
+
+  index = g_mapped_file_new (self->pack_index_path, FALSE, error);
+  if (index == NULL)
+    return FALSE;
+
+  g_clear_pointer (&self->pack_index, g_mapped_file_unref);
+  self->pack_index = index;
+  pack_remember_index_locked (self);
+
+  return TRUE;
+}
+
+static gboolean
+pack_collect_garbage_locked (BzEntryCacheManager *self,
+                             GHashTable          *live,
+                             guint64              max_size,
+                             GError             **error)
+{
+  static const guint8 padding[PACK_ALIGNMENT] = { 0 };
+  const PackIndexHeader *header               = NULL;
+  const PackRecord      *records              = NULL;
+  g_autoptr (GArray) kept                     = NULL;
+  guint64          kept_size                  = 0;
+  guint            n_swept                    = 0;
+  guint            n_evicted                  = 0;
+  guint64          old_size                   = 0;
+  g_autofree char *old_size_str               = NULL;
+  g_autofree char *new_size_str               = NULL;
+  g_autofree char *tmp_path                   = NULL;
+  g_autoptr (GFile) tmp_file                  = NULL;
+  g_autoptr (GFileOutputStream) replacer      = NULL;
+  g_autoptr (GOutputStream) output            = NULL;
+  int         tmp_fd                          = -1;
+  const char *contents                        = NULL;
+  guint64     offset                          = 0;
+  gboolean    result                          = FALSE;
+
+  if (self->pack_fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "The entry cache pack is not open");
+      return FALSE;
+    }
+
+  /* Other processes must neither append to the data file
+   * we are about to replace nor see it without its index
+   */
+  if (!pack_lock_locked (self, error))
+    return FALSE;
+
+  /* Get everything into the index so there is only one
+   * place to look
+   */
+  if (!pack_reload_if_replaced_locked (self, error) ||
+      !pack_flush_index_locked (self, error))
+    goto out;
+  if (self->pack_index == NULL)
+    {
+      result = TRUE;
+      goto out;
+    }
+
+  header  = (gconstpointer) g_mapped_file_get_contents (self->pack_index);
+  records = (gconstpointer) (header + 1);
+  kept    = g_array_sized_new (FALSE, FALSE, sizeof (PackRecord), header->n_records);
+  for (guint i = 0; i < header->n_records; i++)
+    {
+      g_autofree char *checksum = NULL;
+
+      checksum = dup_pack_key_string (records[i].key);
+      if (!g_hash_table_contains (live, checksum))
+        {
+          n_swept++;
+          continue;
+        }
+
+      g_array_append_val (kept, records[i]);
+      kept_size += pack_record_span (records[i].length);
+    }
+
+  if (max_size > 0 && kept_size > max_size)
+    {
+      guint n_fit = 0;
+
+      g_array_sort (kept, cmp_pack_record_accessed);
+      kept_size = 0;
+      for (; n_fit < kept->len; n_fit++)
+        {
+          guint64 span = 0;
+
+          span = pack_record_span (g_array_index (kept, PackRecord, n_fit).length);
+          if (kept_size + span > max_size)
+            break;
+          kept_size += span;
+        }
+
+      n_evicted = kept->len - n_fit;
+      g_array_set_size (kept, n_fit);
+    }
+
+  old_size = self->pack_size;
+  if (n_swept == 0 && n_evicted == 0 &&
+      old_size - kept_size < old_size / PACK_GC_WASTE_DIVISOR)
+    {
+      result = TRUE;
+      goto out;
+    }
+
+  if (!pack_map_data_locked (self, old_size, error))
+    goto out;
+  contents = g_mapped_file_get_contents (self->pack_data);
+
+  /* Copy survivors in their current order to keep reads of
+   * the old mapping sequential
+   */
+  g_array_sort (kept, cmp_pack_record_offset);
+
+  tmp_path = g_strconcat (self->pack_data_path, ".gc", NULL);
+  tmp_file = g_file_new_for_path (tmp_path);
+  replacer = g_file_replace (tmp_file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
+  if (replacer == NULL)
+    goto out;
+  output = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM (replacer), PACK_BUFFER_SIZE);
+
+  for (guint i = 0; i < kept->len; i++)
+    {
+      PackRecord      *record    = &g_array_index (kept, PackRecord, i);
+      PackRecordHeader rheader   = { 0 };
+      gsize            n_padding = 0;
+
+      rheader.magic      = PACK_RECORD_MAGIC;
+      rheader.length     = record->length;
+      rheader.digest     = record->digest;
+      rheader.flags      = record->flags;
+      rheader.raw_length = record->raw_length;
+      memcpy (rheader.key, record->key, PACK_KEY_SIZE);
+      n_padding = pack_record_span (record->length) - sizeof (rheader) - record->length;
+
+      if (!g_output_stream_write_all (output, &rheader, sizeof (rheader), NULL, NULL, error) ||
+          !g_output_stream_write_all (output, contents + record->offset, record->length, NULL, NULL, error) ||
+          !g_output_stream_write_all (output, padding, n_padding, NULL, NULL, error))
+        goto fail;
+
+      record->offset = offset + sizeof (rheader);
+      offset += pack_record_span (record->length);
+    }
+  if (!g_output_stream_close (output, NULL, error))
+    goto fail;
+
+  /* Same as for appends, the data has to be durable before
+   * it is renamed into place and indexed
+   */
+  tmp_fd = g_open (tmp_path, O_RDONLY | O_CLOEXEC, 0);
+  if (tmp_fd < 0 || fsync (tmp_fd) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to sync '%s': %s",
+                   tmp_path, g_strerror (errsv));
+      if (tmp_fd >= 0)
+        close (tmp_fd);
+      goto fail;
+    }
+  close (tmp_fd);
+
+  if (g_rename (tmp_path, self->pack_data_path) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to replace '%s': %s",
+                   self->pack_data_path, g_strerror (errsv));
+      goto fail;
+    }
+
+  g_array_sort (kept, cmp_pack_record);
+  self->pack_size = offset;
+  result          = pack_write_index_locked (self, (const PackRecord *) kept->data, kept->len, error);
+
+  /* Either way the data file changed under our mapping and
+   * descriptor. Without a matching index it is rescanned.
+   */
+  pack_close_locked (self);
+  if (!pack_open_locked (self, result ? error : NULL))
+    result = FALSE;
+  if (!result)
+    goto out;
+
+  old_size_str = g_format_size (old_size);
+  new_size_str = g_format_size (offset);
+  g_debug ("Collected entry cache garbage: swept %u dead records and evicted %u, %s -> %s",
+           n_swept, n_evicted, old_size_str, new_size_str);
+  goto out;
+
+fail:
+  g_clear_object (&output);
+  g_unlink (tmp_path);
+
+out:
+  pack_unlock_locked (self);
+  return result;
+}
+
+static void
+pack_collect_keys_locked (BzEntryCacheManager *self,
+                          GHashTable          *set)
+{
+  GHashTableIter iter = { 0 };
+
+  if (self->pack_index != NULL)
+    {
+      const PackIndexHeader *header  = NULL;
+      const PackRecord      *records = NULL;
+
+      header  = (gconstpointer) g_mapped_file_get_contents (self->pack_index);
+      records = (gconstpointer) (header + 1);
+      for (guint i = 0; i < header->n_records; i++)
+        g_hash_table_replace (set, dup_pack_key_string (records[i].key), NULL);
+    }
+
+  g_hash_table_iter_init (&iter, self->pack_pending);
+  for (;;)
+    {
+      const char *checksum = NULL;
+
+      if (!g_hash_table_iter_next (&iter, (gpointer *) &checksum, NULL))
+        break;
+      g_hash_table_replace (set, g_strdup (checksum), NULL);
+    }
+
+  g_hash_table_iter_init (&iter, self->pack_unflushed);
+  for (;;)
+    {
+      const char *checksum = NULL;
+
+      if (!g_hash_table_iter_next (&iter, (gpointer *) &checksum, NULL))
+        break;
+      g_hash_table_replace (set, g_strdup (checksum), NULL);
+    }
+}
+
+static gboolean
+parse_pack_key (const char *unique_id_checksum,
+                guint8     *key)
+{
+  for (guint i = 0; i < PACK_KEY_SIZE; i++)
+    {
+      int hi = 0;
+      int lo = 0;
+
+      hi = g_ascii_xdigit_value (unique_id_checksum[i * 2]);
+      if (hi < 0)
+        return FALSE;
+      lo = g_ascii_xdigit_value (unique_id_checksum[i * 2 + 1]);
+      if (lo < 0)
+        return FALSE;
+
+      key[i] = (hi << 4) | lo;
+    }
+
+  return unique_id_checksum[PACK_KEY_SIZE * 2] == '\0';
+}
+
+static char *
+dup_pack_key_string (const guint8 *key)
+{
+  static const char hex[]  = "0123456789abcdef";
+  char              *string = NULL;
+
+  string = g_malloc (PACK_KEY_SIZE * 2 + 1);
+  for (guint i = 0; i < PACK_KEY_SIZE; i++)
+    {
+      string[i * 2]     = hex[key[i] >> 4];
+      string[i * 2 + 1] = hex[key[i] & 0xf];
+    }
+  string[PACK_KEY_SIZE * 2] = '\0';
+
+  return string;
+}
+
+static gboolean
+write_all_fd (int           fd,
+              gconstpointer data,
+              gsize         length,
+              GError      **error)
+{
+  const guint8 *remaining = data;
+
+  while (length > 0)
+    {
+      gssize written = 0;
+
+      written = write (fd, remaining, length);
+      if (written < 0)
+        {
+          int errsv = errno;
+
+          if (errsv == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                       "Failed to write entry cache data: %s",
+                       g_strerror (errsv));
+          return FALSE;
+        }
+
+      remaining += written;
+      length -= written;
+    }
+
+  return TRUE;
+}
+
+static gint
+cmp_pack_record (gconstpointer a,
+                 gconstpointer b)
+{
+  const PackRecord *record_a = a;
+  const PackRecord *record_b = b;
+  int               cmp      = 0;
+
+  cmp = memcmp (record_a->key, record_b->key, PACK_KEY_SIZE);
+  if (cmp != 0)
+    return cmp;
+
+  /* Newest first, and a pending copy of an indexed record
+   * carries a fresher access time
+   */
+  if (record_a->offset != record_b->offset)
+    return (record_a->offset < record_b->offset) - (record_a->offset > record_b->offset);
+  return (record_a->accessed < record_b->accessed) - (record_a->accessed > record_b->accessed);
+}
+
+static gint
+cmp_pack_record_offset (gconstpointer a,
+                        gconstpointer b)
+{
+  const PackRecord *record_a = a;
+  const PackRecord *record_b = b;
+
+  return (record_a->offset > record_b->offset) - (record_a->offset < record_b->offset);
+}
+
+static gint
+cmp_pack_record_accessed (gconstpointer a,
+                          gconstpointer b)
+{
+  const PackRecord *record_a = a;
+  const PackRecord *record_b = b;
+
+  /* Most recently accessed first */
+  return (record_a->accessed < record_b->accessed) - (record_a->accessed > record_b->accessed);
+}
+
+static guint64
+pack_record_span (guint32 length)
+{
+  guint64 span = 0;
+
+  span = sizeof (PackRecordHeader) + length;
+  return (span + PACK_ALIGNMENT - 1) & ~((guint64) PACK_ALIGNMENT - 1);
+}
+
+/* FNV-1a, only used to notice when a record has changed */
+static guint64
+digest_pack_record (GBytes *bytes)
+{
+  const guint8 *data   = NULL;
+  gsize         length = 0;
+  guint64       digest = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+
+  data = g_bytes_get_data (bytes, &length);
+  for (gsize i = 0; i < length; i++)
+    {
+      digest ^= data[i];
+      digest *= G_GUINT64_CONSTANT (0x100000001b3);
+    }
+
+  return digest;
+}
+
+static GBytes *
+deflate_record (GBytes  *bytes,
+                int      level,
+                guint32 *flags)
+{
+  g_autoptr (GZlibCompressor) compressor = NULL;
+  g_autoptr (GBytes) deflated            = NULL;
+
+  *flags = 0;
+  if (level == 0 || g_bytes_get_size (bytes) < PACK_DEFLATE_MIN_SIZE)
+    return g_bytes_ref (bytes);
+
+  /* Running out of room means it didn't get any smaller */
+  compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, level);
+  deflated   = convert_record (G_CONVERTER (compressor), bytes, g_bytes_get_size (bytes) - 1, NULL);
+  if (deflated == NULL)
+    return g_bytes_ref (bytes);
+
+  *flags = PACK_RECORD_DEFLATED;
+  return g_steal_pointer (&deflated);
+}
+
+static GBytes *
+inflate_record (GBytes  *bytes,
+                gsize    raw_length,
+                GError **error)
+{
+  g_autoptr (GZlibDecompressor) decompressor = NULL;
+  g_autoptr (GBytes) inflated                = NULL;
+
+  /* One spare byte to notice a record that inflates past
+   * what its header says
+   */
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW);
+  inflated     = convert_record (G_CONVERTER (decompressor), bytes, raw_length + 1, error);
+  if (inflated == NULL)
+    return NULL;
+
+  if (g_bytes_get_size (inflated) != raw_length)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Record inflated to %zu bytes, expected %zu",
+                   g_bytes_get_size (inflated), raw_length);
+      return NULL;
+    }
+  return g_steal_pointer (&inflated);
+}
+
+static GBytes *
+convert_record (GConverter *converter,
+                GBytes     *bytes,
+                gsize       max_length,
+                GError    **error)
+{
+  const guint8      *input     = NULL;
+  gsize              input_len = 0;
+  gsize              n_read    = 0;
+  g_autofree guint8 *output    = NULL;
+  gsize              n_written = 0;
+
+  input  = g_bytes_get_data (bytes, &input_len);
+  output = g_malloc (MAX (max_length, 1));
+
+  for (;;)
+    {
+      GConverterResult result        = G_CONVERTER_ERROR;
+      gsize            bytes_read    = 0;
+      gsize            bytes_written = 0;
+
+      if (n_written >= max_length)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                       "Record does not fit in %zu bytes",
+                       max_length);
+          return NULL;
+        }
+
+      result = g_converter_convert (
+          converter,
+          input + n_read, input_len - n_read,
+          output + n_written, max_length - n_written,
+          G_CONVERTER_INPUT_AT_END,
+          &bytes_read, &bytes_written,
+          error);
+      if (result == G_CONVERTER_ERROR)
+        return NULL;
+
+      n_read += bytes_read;
+      n_written += bytes_written;
+      if (result == G_CONVERTER_FINISHED)
+        break;
+    }
+
+  return g_bytes_new_take (g_steal_pointer (&output), n_written);
 }
 
 /* End of bz-entry-cache-manager.c */
@@ -45,6 +45,36 @@ bz_entry_cache_manager_new (void);
 guint
 bz_entry_cache_manager_get_living_entries (BzEntryCacheManager *self);
 
+guint
+bz_entry_cache_manager_get_elided_writes (BzEntryCacheManager *self);
+
+guint
+bz_entry_cache_manager_get_committed_writes (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_memory_usage (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_memory_budget (BzEntryCacheManager *self);
+
+guint
+bz_entry_cache_manager_get_lru_entries (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_raw_bytes_written (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_stored_bytes_written (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_deflate_usec (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_inflate_usec (BzEntryCacheManager *self);
+
+guint64
+bz_entry_cache_manager_get_inflated_bytes (BzEntryCacheManager *self);
+
 DexFuture *
 bz_entry_cache_manager_add (BzEntryCacheManager *self,
                             BzEntry             *entry);
@@ -60,6 +90,18 @@ bz_entry_cache_manager_get_by_checksum (BzEntryCacheManager *self,
 DexFuture *
 bz_entry_cache_manager_enumerate_disk (BzEntryCacheManager *self);
 
+DexFuture *
+bz_entry_cache_manager_collect_garbage (BzEntryCacheManager *self,
+                                        GHashTable          *live,
+                                        guint64              max_size);
+
+DexFuture *
+bz_entry_cache_manager_invalidate (BzEntryCacheManager *self,
+                                   GPtrArray           *checksums);
+
+guint64
+bz_entry_cache_manager_digest (GBytes *bytes);
+
 G_END_DECLS
 
 /* End of bz-entry-cache-manager.h */
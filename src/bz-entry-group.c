@@ -955,7 +955,7 @@ bz_entry_group_add (BzEntryGroup *self,
   BzCategoryFlags  entry_categories   = BZ_CATEGORY_FLAGS_NONE;
   guint            existing           = 0;
   gboolean         is_searchable      = FALSE;
-  AsContentRating *content_rating     = NULL;
+  gint             content_age        = -1;
   gboolean         is_addon           = FALSE;
   gint32           state_flags        = 0;
 
@@ -1013,7 +1013,7 @@ bz_entry_group_add (BzEntryGroup *self,
       is_verified        = bz_entry_is_verified (entry);
       donation_url       = bz_entry_get_donation_url (entry);
       entry_categories   = bz_entry_get_category_flags (entry);
-      content_rating     = bz_entry_get_content_rating (entry);
+      content_age        = bz_entry_get_content_age (entry);
       addons             = bz_entry_get_addons (entry);
       is_searchable      = bz_entry_is_searchable (entry);
       if (addons != NULL)
@@ -1114,8 +1114,8 @@ bz_entry_group_add (BzEntryGroup *self,
               self->categories = entry_categories;
               g_object_notify_by_pspec (G_OBJECT (self), props[PROP_CATEGORIES]);
             }
-          if (content_rating != NULL)
-            self->content_age_rating = as_content_rating_get_minimum_age (content_rating);
+          if (content_age >= 0)
+            self->content_age_rating = content_age;
         }
 
       self->max_usefulness = usefulness;
@@ -130,6 +130,18 @@ typedef struct
   int                   favorites_count;
 
   GHashTable *flathub_prop_queries;
+
+  /* Fields only needed by detail views are kept in a
+   * separate record and decoded on first use
+   */
+  GMutex    cold_mutex;
+  GVariant *cold;
+
+  /* What grouping needs to know about the cold record,
+   * stored with the hot fields so it never has to decode it
+   */
+  guint cold_presence;
+  gint  cold_content_age;
 } BzEntryPrivate;
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (BzEntry, bz_entry, G_TYPE_OBJECT);
@@ -198,6 +210,76 @@ enum
 };
 static GParamSpec *props[LAST_PROP] = { 0 };
 
+/* Plain fields are packed into fixed-position tuples. The hot
+ * and cold tables share a version, so bump it whenever either
+ * of them changes
+ */
+#define ENTRY_FIELDS_VERSION 2
+
+/* Bits of cold_presence */
+enum
+{
+  COLD_HAS_LONG_DESCRIPTION = 1 << 0,
+  COLD_HAS_URL              = 1 << 1,
+  COLD_HAS_METADATA_LICENSE = 1 << 2,
+  COLD_HAS_PROJECT_LICENSE  = 1 << 3,
+  COLD_HAS_PROJECT_GROUP    = 1 << 4,
+  COLD_HAS_SCREENSHOTS      = 1 << 5,
+  COLD_HAS_SHARE_URLS       = 1 << 6,
+};
+
+static const BzSerializableField hot_fields[] = {
+  BZ_SERIALIZABLE_FIELD ("installed", BOOLEAN, BzEntryPrivate, installed),
+  BZ_SERIALIZABLE_FIELD ("installed-version", STRING, BzEntryPrivate, installed_version),
+  BZ_SERIALIZABLE_FIELD ("kinds", UINT32, BzEntryPrivate, kinds),
+  BZ_SERIALIZABLE_FIELD ("reinstallable", BOOLEAN, BzEntryPrivate, reinstallable),
+  BZ_SERIALIZABLE_FIELD ("searchable", BOOLEAN, BzEntryPrivate, searchable),
+  BZ_SERIALIZABLE_FIELD ("id", STRING, BzEntryPrivate, id),
+  BZ_SERIALIZABLE_FIELD ("unique-id", STRING, BzEntryPrivate, unique_id),
+  BZ_SERIALIZABLE_FIELD ("unique-id-checksum", STRING, BzEntryPrivate, unique_id_checksum),
+  BZ_SERIALIZABLE_FIELD ("title", STRING, BzEntryPrivate, title),
+  BZ_SERIALIZABLE_FIELD ("eol", STRING, BzEntryPrivate, eol),
+  BZ_SERIALIZABLE_FIELD ("description", STRING, BzEntryPrivate, description),
+  BZ_SERIALIZABLE_FIELD ("remote-repo-name", STRING, BzEntryPrivate, remote_repo_name),
+  BZ_SERIALIZABLE_FIELD ("size", UINT64, BzEntryPrivate, size),
+  BZ_SERIALIZABLE_FIELD ("installed-size", UINT64, BzEntryPrivate, installed_size),
+  BZ_SERIALIZABLE_FIELD ("search-tokens", STRING, BzEntryPrivate, search_tokens),
+  BZ_SERIALIZABLE_FIELD ("is-floss", BOOLEAN, BzEntryPrivate, is_floss),
+  BZ_SERIALIZABLE_FIELD ("developer", STRING, BzEntryPrivate, developer),
+  BZ_SERIALIZABLE_FIELD ("developer-id", STRING, BzEntryPrivate, developer_id),
+  BZ_SERIALIZABLE_FIELD ("donation-url", STRING, BzEntryPrivate, donation_url),
+  BZ_SERIALIZABLE_FIELD ("light-accent-color", STRING, BzEntryPrivate, light_accent_color),
+  BZ_SERIALIZABLE_FIELD ("dark-accent-color", STRING, BzEntryPrivate, dark_accent_color),
+  BZ_SERIALIZABLE_FIELD ("categories", UINT32, BzEntryPrivate, categories),
+  BZ_SERIALIZABLE_FIELD ("is-flathub", BOOLEAN, BzEntryPrivate, is_flathub),
+  BZ_SERIALIZABLE_FIELD ("cold-presence", UINT32, BzEntryPrivate, cold_presence),
+  BZ_SERIALIZABLE_FIELD ("cold-content-age", INT32, BzEntryPrivate, cold_content_age),
+};
+static BzSerializableSchema hot_schema = {
+  .version  = ENTRY_FIELDS_VERSION,
+  .fields   = hot_fields,
+  .n_fields = G_N_ELEMENTS (hot_fields),
+};
+
+static const BzSerializableField cold_fields[] = {
+  BZ_SERIALIZABLE_FIELD ("long-description", STRING, BzEntryPrivate, long_description),
+  BZ_SERIALIZABLE_FIELD ("url", STRING, BzEntryPrivate, url),
+  BZ_SERIALIZABLE_FIELD ("metadata-license", STRING, BzEntryPrivate, metadata_license),
+  BZ_SERIALIZABLE_FIELD ("project-license", STRING, BzEntryPrivate, project_license),
+  BZ_SERIALIZABLE_FIELD ("project-group", STRING, BzEntryPrivate, project_group),
+  BZ_SERIALIZABLE_FIELD ("is-mobile-friendly", BOOLEAN, BzEntryPrivate, is_mobile_friendly),
+  BZ_SERIALIZABLE_FIELD ("required-controls", UINT32, BzEntryPrivate, required_controls),
+  BZ_SERIALIZABLE_FIELD ("recommended-controls", UINT32, BzEntryPrivate, recommended_controls),
+  BZ_SERIALIZABLE_FIELD ("supported-controls", UINT32, BzEntryPrivate, supported_controls),
+  BZ_SERIALIZABLE_FIELD ("min-display-length", INT32, BzEntryPrivate, min_display_length),
+  BZ_SERIALIZABLE_FIELD ("max-display-length", INT32, BzEntryPrivate, max_display_length),
+};
+static BzSerializableSchema cold_schema = {
+  .version  = ENTRY_FIELDS_VERSION,
+  .fields   = cold_fields,
+  .n_fields = G_N_ELEMENTS (cold_fields),
+};
+
 BZ_DEFINE_DATA (
     query_flathub,
     QueryFlathub,
@@ -243,6 +325,27 @@ make_async_texture (GVariant *parse);
 static void
 clear_entry (BzEntry *self);
 
+static gboolean
+is_cold_prop (guint prop_id);
+
+static void
+ensure_cold (BzEntry *self);
+
+static void
+serialize_cold (BzEntryPrivate  *priv,
+                GVariantBuilder *builder);
+
+static void
+deserialize_cold_field (BzEntryPrivate *priv,
+                        const char     *key,
+                        GVariant       *value);
+
+static guint
+calc_cold_presence (BzEntryPrivate *priv);
+
+static gint
+calc_content_age (BzEntryPrivate *priv);
+
 static void
 bz_entry_dispose (GObject *object)
 {
@@ -253,6 +356,17 @@ bz_entry_dispose (GObject *object)
   G_OBJECT_CLASS (bz_entry_parent_class)->dispose (object);
 }
 
+static void
+bz_entry_finalize (GObject *object)
+{
+  BzEntry        *self = BZ_ENTRY (object);
+  BzEntryPrivate *priv = bz_entry_get_instance_private (self);
+
+  g_mutex_clear (&priv->cold_mutex);
+
+  G_OBJECT_CLASS (bz_entry_parent_class)->finalize (object);
+}
+
 static void
 bz_entry_get_property (GObject    *object,
                        guint       prop_id,
@@ -262,6 +376,9 @@ bz_entry_get_property (GObject    *object,
   BzEntry        *self = BZ_ENTRY (object);
   BzEntryPrivate *priv = bz_entry_get_instance_private (self);
 
+  if (is_cold_prop (prop_id))
+    ensure_cold (self);
+
   switch (prop_id)
     {
     case PROP_HOLDING:
@@ -450,6 +567,10 @@ bz_entry_set_property (GObject      *object,
   BzEntry        *self = BZ_ENTRY (object);
   BzEntryPrivate *priv = bz_entry_get_instance_private (self);
 
+  /* Decode first so the pending record can't clobber this */
+  if (is_cold_prop (prop_id))
+    ensure_cold (self);
+
   switch (prop_id)
     {
     case PROP_INSTALLED:
@@ -673,6 +794,7 @@ bz_entry_class_init (BzEntryClass *klass)
   object_class->set_property = bz_entry_set_property;
   object_class->get_property = bz_entry_get_property;
   object_class->dispose      = bz_entry_dispose;
+  object_class->finalize     = bz_entry_finalize;
 
   props[PROP_HOLDING] =
       g_param_spec_boolean (
@@ -1051,22 +1173,31 @@ bz_entry_init (BzEntry *self)
   priv->hold            = 0;
   priv->reinstallable   = TRUE;
   priv->searchable      = TRUE;
-  priv->favorites_count = -1;
+  priv->favorites_count  = -1;
+  priv->cold_content_age = -1;
+  g_mutex_init (&priv->cold_mutex);
 }
 
 static void
 bz_entry_real_serialize (BzSerializable  *serializable,
                          GVariantBuilder *builder)
 {
-  BzEntry        *self = BZ_ENTRY (serializable);
-  BzEntryPrivate *priv = bz_entry_get_instance_private (self);
+  BzEntry        *self            = BZ_ENTRY (serializable);
+  BzEntryPrivate *priv            = bz_entry_get_instance_private (self);
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  /* An undecoded cold record still matches what was
+   * summarized when it was written
+   */
+  locker = g_mutex_locker_new (&priv->cold_mutex);
+  if (priv->cold == NULL)
+    {
+      priv->cold_presence    = calc_cold_presence (priv);
+      priv->cold_content_age = calc_content_age (priv);
+    }
+  g_clear_pointer (&locker, g_mutex_locker_free);
 
-  g_variant_builder_add (builder, "{sv}", "installed", g_variant_new_boolean (priv->installed));
-  if (priv->installed_version != NULL)
-    g_variant_builder_add (builder, "{sv}", "installed-version", g_variant_new_string (priv->installed_version));
-  g_variant_builder_add (builder, "{sv}", "kinds", g_variant_new_uint32 (priv->kinds));
-  g_variant_builder_add (builder, "{sv}", "reinstallable", g_variant_new_boolean (priv->reinstallable));
-  g_variant_builder_add (builder, "{sv}", "searchable", g_variant_new_boolean (priv->searchable));
+  g_variant_builder_add (builder, "{sv}", "fields", bz_serializable_schema_pack (&hot_schema, priv));
   if (priv->addons != NULL)
     {
       guint n_items = 0;
@@ -1088,28 +1219,6 @@ bz_entry_real_serialize (BzSerializable  *serializable,
           g_variant_builder_add (builder, "{sv}", "addons", g_variant_builder_end (sub_builder));
         }
     }
-  if (priv->id != NULL)
-    g_variant_builder_add (builder, "{sv}", "id", g_variant_new_string (priv->id));
-  if (priv->unique_id != NULL)
-    g_variant_builder_add (builder, "{sv}", "unique-id", g_variant_new_string (priv->unique_id));
-  if (priv->unique_id_checksum != NULL)
-    g_variant_builder_add (builder, "{sv}", "unique-id-checksum", g_variant_new_string (priv->unique_id_checksum));
-  if (priv->title != NULL)
-    g_variant_builder_add (builder, "{sv}", "title", g_variant_new_string (priv->title));
-  if (priv->eol != NULL)
-    g_variant_builder_add (builder, "{sv}", "eol", g_variant_new_string (priv->eol));
-  if (priv->description != NULL)
-    g_variant_builder_add (builder, "{sv}", "description", g_variant_new_string (priv->description));
-  if (priv->long_description != NULL)
-    g_variant_builder_add (builder, "{sv}", "long-description", g_variant_new_string (priv->long_description));
-  if (priv->remote_repo_name != NULL)
-    g_variant_builder_add (builder, "{sv}", "remote-repo-name", g_variant_new_string (priv->remote_repo_name));
-  if (priv->url != NULL)
-    g_variant_builder_add (builder, "{sv}", "url", g_variant_new_string (priv->url));
-  if (priv->size > 0)
-    g_variant_builder_add (builder, "{sv}", "size", g_variant_new_uint64 (priv->size));
-  if (priv->installed_size > 0)
-    g_variant_builder_add (builder, "{sv}", "installed-size", g_variant_new_uint64 (priv->installed_size));
   if (priv->icon_paintable != NULL)
     maybe_save_paintable (priv, "icon-paintable", priv->icon_paintable, builder);
   if (priv->mini_icon != NULL)
@@ -1121,189 +1230,6 @@ bz_entry_real_serialize (BzSerializable  *serializable,
     }
   if (priv->remote_repo_icon != NULL)
     maybe_save_paintable (priv, "remote-repo-icon", priv->remote_repo_icon, builder);
-  if (priv->search_tokens != NULL)
-    g_variant_builder_add (builder, "{sv}", "search-tokens", g_variant_new_string (priv->search_tokens));
-  if (priv->metadata_license != NULL)
-    g_variant_builder_add (builder, "{sv}", "metadata-license", g_variant_new_string (priv->metadata_license));
-  if (priv->project_license != NULL)
-    g_variant_builder_add (builder, "{sv}", "project-license", g_variant_new_string (priv->project_license));
-  g_variant_builder_add (builder, "{sv}", "is-floss", g_variant_new_boolean (priv->is_floss));
-  if (priv->project_group != NULL)
-    g_variant_builder_add (builder, "{sv}", "project-group", g_variant_new_string (priv->project_group));
-  if (priv->developer != NULL)
-    g_variant_builder_add (builder, "{sv}", "developer", g_variant_new_string (priv->developer));
-  if (priv->developer_id != NULL)
-    g_variant_builder_add (builder, "{sv}", "developer-id", g_variant_new_string (priv->developer_id));
-  if (priv->screenshot_paintables != NULL)
-    {
-      guint n_items = 0;
-
-      n_items = g_list_model_get_n_items (priv->screenshot_paintables);
-      if (n_items > 0)
-        {
-          g_autoptr (GVariantBuilder) sub_builder = NULL;
-
-          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
-          for (guint i = 0; i < n_items; i++)
-            {
-              g_autoptr (GdkPaintable) paintable = NULL;
-              g_autofree char *key               = NULL;
-
-              paintable = g_list_model_get_item (priv->screenshot_paintables, i);
-              key       = g_strdup_printf ("screenshot_%d.png", i);
-
-              maybe_save_paintable (priv, key, paintable, sub_builder);
-            }
-
-          g_variant_builder_add (builder, "{sv}", "screenshot-paintables", g_variant_builder_end (sub_builder));
-        }
-    }
-  if (priv->screenshot_captions != NULL)
-    {
-      guint n_items = 0;
-
-      n_items = g_list_model_get_n_items (priv->screenshot_captions);
-      if (n_items > 0)
-        {
-          g_autoptr (GVariantBuilder) sub_builder = NULL;
-
-          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-          for (guint i = 0; i < n_items; i++)
-            {
-              g_autoptr (GtkStringObject) string = NULL;
-
-              string = g_list_model_get_item (priv->screenshot_captions, i);
-              g_variant_builder_add (sub_builder, "s", gtk_string_object_get_string (string));
-            }
-
-          g_variant_builder_add (builder, "{sv}", "screenshot-captions", g_variant_builder_end (sub_builder));
-        }
-    }
-  if (priv->thumbnail_paintable != NULL)
-    maybe_save_paintable (priv, "thumbnail-paintable", priv->thumbnail_paintable, builder);
-  if (priv->share_urls != NULL)
-    {
-      guint n_items = 0;
-
-      n_items = g_list_model_get_n_items (priv->share_urls);
-      if (n_items > 0)
-        {
-          g_autoptr (GVariantBuilder) sub_builder = NULL;
-
-          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
-          for (guint i = 0; i < n_items; i++)
-            {
-              g_autoptr (BzUrl) url = NULL;
-              const char *id        = NULL;
-              const char *url_str   = NULL;
-
-              url     = g_list_model_get_item (priv->share_urls, i);
-              id      = bz_url_get_id (url);
-              url_str = bz_url_get_url (url);
-
-              g_variant_builder_add (sub_builder, "(ss)", id ? id : "", url_str ? url_str : "");
-            }
-          g_variant_builder_add (builder, "{sv}", "share-urls", g_variant_builder_end (sub_builder));
-        }
-    }
-  if (priv->donation_url != NULL)
-    g_variant_builder_add (builder, "{sv}", "donation-url", g_variant_new_string (priv->donation_url));
-  if (priv->version_history != NULL)
-    {
-      guint n_items = 0;
-
-      n_items = g_list_model_get_n_items (priv->version_history);
-      if (n_items > 0)
-        {
-          g_autoptr (GVariantBuilder) sub_builder = NULL;
-
-          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(mstmsms)"));
-          for (guint i = 0; i < n_items; i++)
-            {
-              g_autoptr (BzRelease) release = NULL;
-              guint64     timestamp         = 0;
-              const char *url               = NULL;
-              const char *version           = NULL;
-              const char *description       = NULL;
-
-              release     = g_list_model_get_item (priv->version_history, i);
-              timestamp   = bz_release_get_timestamp (release);
-              url         = bz_release_get_url (release);
-              version     = bz_release_get_version (release);
-              description = bz_release_get_description (release);
-
-              g_variant_builder_add (
-                  sub_builder,
-                  "(mstmsms)",
-                  description,
-                  timestamp,
-                  url,
-                  version);
-            }
-
-          g_variant_builder_add (builder, "{sv}", "version-history", g_variant_builder_end (sub_builder));
-        }
-    }
-  if (priv->light_accent_color != NULL)
-    g_variant_builder_add (builder, "{sv}", "light-accent-color", g_variant_new_string (priv->light_accent_color));
-  if (priv->dark_accent_color != NULL)
-    g_variant_builder_add (builder, "{sv}", "dark-accent-color", g_variant_new_string (priv->dark_accent_color));
-  g_variant_builder_add (builder, "{sv}", "is-mobile-friendly", g_variant_new_boolean (priv->is_mobile_friendly));
-  if (priv->required_controls != BZ_CONTROL_NONE)
-    g_variant_builder_add (builder, "{sv}", "required-controls", g_variant_new_uint32 (priv->required_controls));
-  if (priv->recommended_controls != BZ_CONTROL_NONE)
-    g_variant_builder_add (builder, "{sv}", "recommended-controls", g_variant_new_uint32 (priv->recommended_controls));
-  if (priv->supported_controls != BZ_CONTROL_NONE)
-    g_variant_builder_add (builder, "{sv}", "supported-controls", g_variant_new_uint32 (priv->supported_controls));
-  if (priv->min_display_length > 0)
-    g_variant_builder_add (builder, "{sv}", "min-display-length", g_variant_new_int32 (priv->min_display_length));
-  if (priv->max_display_length > 0)
-    g_variant_builder_add (builder, "{sv}", "max-display-length", g_variant_new_int32 (priv->max_display_length));
-  if (priv->content_rating != NULL)
-    {
-      const gchar *kind                       = as_content_rating_get_kind (priv->content_rating);
-      g_autoptr (GVariantBuilder) sub_builder = NULL;
-      g_autofree const gchar **rating_ids     = NULL;
-
-      sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
-      rating_ids  = as_content_rating_get_all_rating_ids ();
-
-      for (gsize i = 0; rating_ids[i] != NULL; i++)
-        {
-          AsContentRatingValue value     = as_content_rating_get_value (priv->content_rating, rating_ids[i]);
-          const gchar         *value_str = as_content_rating_value_to_string (value);
-
-          if (value != AS_CONTENT_RATING_VALUE_UNKNOWN)
-            g_variant_builder_add (sub_builder, "(ss)", rating_ids[i], value_str);
-        }
-
-      g_variant_builder_add (builder, "{sv}", "content-rating-kind", g_variant_new_string (kind ? kind : "oars-1.1"));
-      g_variant_builder_add (builder, "{sv}", "content-rating-values", g_variant_builder_end (sub_builder));
-    }
-  if (priv->keywords != NULL)
-    {
-      guint n_items = 0;
-
-      n_items = g_list_model_get_n_items (priv->keywords);
-      if (n_items > 0)
-        {
-          g_autoptr (GVariantBuilder) sub_builder = NULL;
-
-          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-          for (guint i = 0; i < n_items; i++)
-            {
-              g_autoptr (GtkStringObject) string = NULL;
-
-              string = g_list_model_get_item (priv->keywords, i);
-              g_variant_builder_add (sub_builder, "s", gtk_string_object_get_string (string));
-            }
-
-          g_variant_builder_add (builder, "{sv}", "keywords", g_variant_builder_end (sub_builder));
-        }
-    }
-  if (priv->categories != BZ_CATEGORY_FLAGS_NONE)
-    g_variant_builder_add (builder, "{sv}", "categories",
-                           g_variant_new_uint32 (priv->categories));
   if (priv->verification_status != NULL)
     {
       gboolean         verified              = FALSE;
@@ -1338,12 +1264,22 @@ bz_entry_real_serialize (BzSerializable  *serializable,
       g_variant_builder_add (builder, "{sv}", "verification-login-is-organization", g_variant_new_boolean (login_is_organization));
     }
 
-  if (priv->permissions != NULL)
+  /* An entry whose cold record was never decoded can
+   * pass it straight through
+   */
+  locker = g_mutex_locker_new (&priv->cold_mutex);
+  if (priv->cold != NULL)
+    g_variant_builder_add (builder, "{sv}", "cold", priv->cold);
+  else
     {
-      bz_app_permissions_serialize (priv->permissions, builder);
+      g_autoptr (GVariantBuilder) cold_builder = NULL;
+
+      cold_builder = g_variant_builder_new (G_VARIANT_TYPE_VARDICT);
+      serialize_cold (priv, cold_builder);
+      g_variant_builder_add (builder, "{sv}", "cold", g_variant_builder_end (cold_builder));
     }
+  g_clear_pointer (&locker, g_mutex_locker_free);
 
-  g_variant_builder_add (builder, "{sv}", "is-flathub", g_variant_new_boolean (priv->is_flathub));
   if (priv->is_flathub)
     {
       if (priv->flathub_prop_queries != NULL)
@@ -1404,16 +1340,11 @@ bz_entry_real_deserialize (BzSerializable *serializable,
       if (!g_variant_iter_next (iter, "{sv}", &key, &value))
         break;
 
-      if (g_strcmp0 (key, "installed") == 0)
-        priv->installed = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "installed-version") == 0)
-        priv->installed_version = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "kinds") == 0)
-        priv->kinds = g_variant_get_uint32 (value);
-      else if (g_strcmp0 (key, "reinstallable") == 0)
-        priv->reinstallable = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "searchable") == 0)
-        priv->searchable = g_variant_get_boolean (value);
+      if (g_strcmp0 (key, "fields") == 0)
+        {
+          if (!bz_serializable_schema_unpack (&hot_schema, priv, value, error))
+            return FALSE;
+        }
       else if (g_strcmp0 (key, "addons") == 0)
         {
           g_autoptr (GListStore) store        = NULL;
@@ -1435,242 +1366,37 @@ bz_entry_real_deserialize (BzSerializable *serializable,
 
           priv->addons = G_LIST_MODEL (g_steal_pointer (&store));
         }
-      else if (g_strcmp0 (key, "id") == 0)
-        priv->id = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "unique-id") == 0)
-        priv->unique_id = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "unique-id-checksum") == 0)
-        priv->unique_id_checksum = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "title") == 0)
-        priv->title = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "eol") == 0)
-        priv->eol = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "description") == 0)
-        priv->description = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "long-description") == 0)
-        priv->long_description = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "remote-repo-name") == 0)
-        priv->remote_repo_name = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "url") == 0)
-        priv->url = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "size") == 0)
-        priv->size = g_variant_get_uint64 (value);
-      else if (g_strcmp0 (key, "installed-size") == 0)
-        priv->installed_size = g_variant_get_uint64 (value);
       else if (g_strcmp0 (key, "icon-paintable") == 0)
         priv->icon_paintable = make_async_texture (value);
       else if (g_strcmp0 (key, "mini-icon") == 0)
         priv->mini_icon = g_icon_deserialize (value);
       else if (g_strcmp0 (key, "remote-repo-icon") == 0)
         priv->remote_repo_icon = make_async_texture (value);
-      else if (g_strcmp0 (key, "search-tokens") == 0)
-        priv->search_tokens = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "metadata-license") == 0)
-        priv->metadata_license = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "project-license") == 0)
-        priv->project_license = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "is-floss") == 0)
-        priv->is_floss = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "developer") == 0)
-        priv->developer = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "developer-id") == 0)
-        priv->developer_id = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "screenshot-paintables") == 0)
+      else if (g_strcmp0 (key, "verification-verified") == 0)
         {
-          g_autoptr (GListStore) store             = NULL;
-          g_autoptr (GVariantIter) screenshot_iter = NULL;
-
-          store = g_list_store_new (BZ_TYPE_ASYNC_TEXTURE);
-
-          screenshot_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree char *basename        = NULL;
-              g_autoptr (GVariant) screenshot  = NULL;
-              g_autoptr (GdkPaintable) texture = NULL;
-
-              if (!g_variant_iter_next (screenshot_iter, "{sv}", &basename, &screenshot))
-                break;
-              texture = make_async_texture (screenshot);
-              g_list_store_append (store, texture);
-            }
-
-          priv->screenshot_paintables = G_LIST_MODEL (g_steal_pointer (&store));
+          if (priv->verification_status == NULL)
+            priv->verification_status = bz_verification_status_new ();
+          g_object_set (priv->verification_status, "verified", g_variant_get_boolean (value), NULL);
         }
-      else if (g_strcmp0 (key, "screenshot-captions") == 0)
+      else if (g_strcmp0 (key, "verification-method") == 0)
         {
-          g_autoptr (GListStore) store          = NULL;
-          g_autoptr (GVariantIter) caption_iter = NULL;
-
-          store = g_list_store_new (GTK_TYPE_STRING_OBJECT);
-
-          caption_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree char *caption           = NULL;
-              g_autoptr (GtkStringObject) string = NULL;
-
-              if (!g_variant_iter_next (caption_iter, "s", &caption))
-                break;
-              string = gtk_string_object_new (caption);
-              g_list_store_append (store, string);
-            }
-
-          priv->screenshot_captions = G_LIST_MODEL (g_steal_pointer (&store));
+          if (priv->verification_status == NULL)
+            priv->verification_status = bz_verification_status_new ();
+          g_object_set (priv->verification_status, "method", g_variant_get_string (value, NULL), NULL);
         }
-      else if (g_strcmp0 (key, "thumbnail-paintable") == 0)
-        priv->thumbnail_paintable = make_async_texture (value);
-      else if (g_strcmp0 (key, "share-urls") == 0)
+      else if (g_strcmp0 (key, "verification-website") == 0)
         {
-          g_autoptr (GListStore) store      = NULL;
-          g_autoptr (GVariantIter) url_iter = NULL;
-
-          store    = g_list_store_new (BZ_TYPE_URL);
-          url_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree char *id      = NULL;
-              g_autofree char *url_str = NULL;
-              g_autoptr (BzUrl) url    = NULL;
-
-              if (!g_variant_iter_next (url_iter, "(ss)", &id, &url_str))
-                break;
-              url = bz_url_new ();
-              bz_url_set_id (url, id);
-              bz_url_set_url (url, url_str);
-              g_list_store_append (store, url);
-            }
-
-          priv->share_urls = G_LIST_MODEL (g_steal_pointer (&store));
+          if (priv->verification_status == NULL)
+            priv->verification_status = bz_verification_status_new ();
+          g_object_set (priv->verification_status, "website", g_variant_get_string (value, NULL), NULL);
         }
-      else if (g_strcmp0 (key, "donation-url") == 0)
-        priv->donation_url = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "version-history") == 0)
+      else if (g_strcmp0 (key, "verification-login-name") == 0)
         {
-          g_autoptr (GListStore) store          = NULL;
-          g_autoptr (GVariantIter) version_iter = NULL;
-
-          store = g_list_store_new (BZ_TYPE_RELEASE);
-
-          version_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              guint64          timestamp    = 0;
-              g_autofree char *url          = NULL;
-              g_autofree char *description  = NULL;
-              g_autofree char *version      = NULL;
-              g_autoptr (BzRelease) release = NULL;
-
-              if (!g_variant_iter_next (version_iter, "(mstmsms)", &description, &timestamp, &url, &version))
-                break;
-
-              release = bz_release_new ();
-              bz_release_set_timestamp (release, timestamp);
-              bz_release_set_url (release, url);
-              bz_release_set_version (release, version);
-              bz_release_set_description (release, description);
-              g_list_store_append (store, release);
-            }
-
-          priv->version_history = G_LIST_MODEL (g_steal_pointer (&store));
+          if (priv->verification_status == NULL)
+            priv->verification_status = bz_verification_status_new ();
+          g_object_set (priv->verification_status, "login-name", g_variant_get_string (value, NULL), NULL);
         }
-      else if (g_strcmp0 (key, "light-accent-color") == 0)
-        priv->light_accent_color = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "dark-accent-color") == 0)
-        priv->dark_accent_color = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "is-mobile-friendly") == 0)
-        priv->is_mobile_friendly = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "required-controls") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
-        priv->required_controls = g_variant_get_uint32 (value);
-      else if (g_strcmp0 (key, "recommended-controls") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
-        priv->recommended_controls = g_variant_get_uint32 (value);
-      else if (g_strcmp0 (key, "supported-controls") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
-        priv->supported_controls = g_variant_get_uint32 (value);
-      else if (g_strcmp0 (key, "min-display-length") == 0)
-        priv->min_display_length = g_variant_get_int32 (value);
-      else if (g_strcmp0 (key, "max-display-length") == 0)
-        priv->max_display_length = g_variant_get_int32 (value);
-      else if (g_strcmp0 (key, "content-rating-kind") == 0)
-        {
-          g_autofree gchar *kind = NULL;
-
-          kind = g_variant_dup_string (value, NULL);
-
-          if (priv->content_rating == NULL)
-            priv->content_rating = as_content_rating_new ();
-
-          as_content_rating_set_kind (priv->content_rating, kind);
-        }
-      else if (g_strcmp0 (key, "content-rating-values") == 0)
-        {
-          g_autoptr (GVariantIter) rating_iter = NULL;
-
-          if (priv->content_rating == NULL)
-            priv->content_rating = as_content_rating_new ();
-
-          rating_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree gchar    *rating_id        = NULL;
-              g_autofree gchar    *rating_value_str = NULL;
-              AsContentRatingValue rating_value;
-
-              if (!g_variant_iter_next (rating_iter, "(ss)", &rating_id, &rating_value_str))
-                break;
-
-              rating_value = as_content_rating_value_from_string (rating_value_str);
-              if (rating_value != AS_CONTENT_RATING_VALUE_UNKNOWN)
-                as_content_rating_set_value (priv->content_rating, rating_id, rating_value);
-            }
-        }
-      else if (g_strcmp0 (key, "keywords") == 0)
-        {
-          g_autoptr (GListStore) store           = NULL;
-          g_autoptr (GVariantIter) keywords_iter = NULL;
-
-          store = g_list_store_new (GTK_TYPE_STRING_OBJECT);
-
-          keywords_iter = g_variant_iter_new (value);
-          for (;;)
-            {
-              g_autofree char *keyword           = NULL;
-              g_autoptr (GtkStringObject) string = NULL;
-
-              if (!g_variant_iter_next (keywords_iter, "s", &keyword))
-                break;
-              string = gtk_string_object_new (keyword);
-              g_list_store_append (store, string);
-            }
-
-          priv->keywords = G_LIST_MODEL (g_steal_pointer (&store));
-        }
-      else if (g_strcmp0 (key, "categories") == 0)
-        priv->categories = g_variant_get_uint32 (value);
-      else if (g_strcmp0 (key, "verification-verified") == 0)
-        {
-          if (priv->verification_status == NULL)
-            priv->verification_status = bz_verification_status_new ();
-          g_object_set (priv->verification_status, "verified", g_variant_get_boolean (value), NULL);
-        }
-      else if (g_strcmp0 (key, "verification-method") == 0)
-        {
-          if (priv->verification_status == NULL)
-            priv->verification_status = bz_verification_status_new ();
-          g_object_set (priv->verification_status, "method", g_variant_get_string (value, NULL), NULL);
-        }
-      else if (g_strcmp0 (key, "verification-website") == 0)
-        {
-          if (priv->verification_status == NULL)
-            priv->verification_status = bz_verification_status_new ();
-          g_object_set (priv->verification_status, "website", g_variant_get_string (value, NULL), NULL);
-        }
-      else if (g_strcmp0 (key, "verification-login-name") == 0)
-        {
-          if (priv->verification_status == NULL)
-            priv->verification_status = bz_verification_status_new ();
-          g_object_set (priv->verification_status, "login-name", g_variant_get_string (value, NULL), NULL);
-        }
-      else if (g_strcmp0 (key, "verification-login-provider") == 0)
+      else if (g_strcmp0 (key, "verification-login-provider") == 0)
         {
           if (priv->verification_status == NULL)
             priv->verification_status = bz_verification_status_new ();
@@ -1688,20 +1414,26 @@ bz_entry_real_deserialize (BzSerializable *serializable,
             priv->verification_status = bz_verification_status_new ();
           g_object_set (priv->verification_status, "login-is-organization", g_variant_get_boolean (value), NULL);
         }
-      else if (g_strcmp0 (key, "is-flathub") == 0)
-        priv->is_flathub = g_variant_get_boolean (value);
-      else if (g_str_has_prefix (key, "permissions-"))
+      else if (g_strcmp0 (key, "cold") == 0)
+        priv->cold = g_variant_ref (value);
+      else if (!bz_serializable_schema_unpack_legacy (&hot_schema, priv, key, value))
         {
-          continue;
+          /* Caches from before the hot/cold split keep
+           * everything at the top level
+           */
+          deserialize_cold_field (priv, key, value);
         }
     }
 
-  if (priv->permissions == NULL)
-    priv->permissions = bz_app_permissions_new ();
-
-  if (!bz_app_permissions_deserialize (priv->permissions, import, error))
+  if (priv->cold == NULL)
     {
-      g_warning ("Failed to deserialize app permissions");
+      if (priv->permissions == NULL)
+        priv->permissions = bz_app_permissions_new ();
+
+      if (!bz_app_permissions_deserialize (priv->permissions, import, error))
+        {
+          g_warning ("Failed to deserialize app permissions");
+        }
     }
 
   return TRUE;
@@ -1958,6 +1690,7 @@ bz_entry_get_long_description (BzEntry *self)
   g_return_val_if_fail (BZ_IS_ENTRY (self), NULL);
   priv = bz_entry_get_instance_private (self);
 
+  ensure_cold (self);
   return priv->long_description;
 }
 
@@ -2013,6 +1746,7 @@ bz_entry_get_screenshot_paintables (BzEntry *self)
   g_return_val_if_fail (BZ_IS_ENTRY (self), NULL);
   priv = bz_entry_get_instance_private (self);
 
+  ensure_cold (self);
   return priv->screenshot_paintables;
 }
 
@@ -2046,6 +1780,7 @@ bz_entry_get_share_urls (BzEntry *self)
   g_return_val_if_fail (BZ_IS_ENTRY (self), NULL);
   priv = bz_entry_get_instance_private (self);
 
+  ensure_cold (self);
   return priv->share_urls;
 }
 
@@ -2057,6 +1792,7 @@ bz_entry_get_url (BzEntry *self)
   g_return_val_if_fail (BZ_IS_ENTRY (self), NULL);
   priv = bz_entry_get_instance_private (self);
 
+  ensure_cold (self);
   return priv->url;
 }
 
@@ -2151,6 +1887,7 @@ bz_entry_get_is_mobile_friendly (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), FALSE);
 
+  ensure_cold (self);
   return priv->is_mobile_friendly;
 }
 
@@ -2161,6 +1898,7 @@ bz_entry_get_required_controls (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), BZ_CONTROL_NONE);
 
+  ensure_cold (self);
   return priv->required_controls;
 }
 
@@ -2171,6 +1909,7 @@ bz_entry_get_recommended_controls (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), BZ_CONTROL_NONE);
 
+  ensure_cold (self);
   return priv->recommended_controls;
 }
 
@@ -2181,6 +1920,7 @@ bz_entry_get_supported_controls (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), BZ_CONTROL_NONE);
 
+  ensure_cold (self);
   return priv->supported_controls;
 }
 
@@ -2193,6 +1933,7 @@ bz_entry_has_control (BzEntry       *self,
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), FALSE);
 
+  ensure_cold (self);
   switch (relation)
     {
     case BZ_RELATION_REQUIRES:
@@ -2213,6 +1954,7 @@ bz_entry_get_min_display_length (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), 0);
 
+  ensure_cold (self);
   return priv->min_display_length;
 }
 
@@ -2223,6 +1965,7 @@ bz_entry_get_max_display_length (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), 0);
 
+  ensure_cold (self);
   return priv->max_display_length;
 }
 
@@ -2235,6 +1978,7 @@ bz_entry_supports_form_factor (BzEntry *self,
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), FALSE);
 
+  ensure_cold (self);
   if (priv->required_controls != BZ_CONTROL_NONE)
     {
       if ((priv->required_controls & available_controls) != priv->required_controls)
@@ -2257,9 +2001,23 @@ bz_entry_get_content_rating (BzEntry *self)
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), NULL);
 
+  ensure_cold (self);
   return priv->content_rating;
 }
 
+gint
+bz_entry_get_content_age (BzEntry *self)
+{
+  BzEntryPrivate *priv = NULL;
+
+  g_return_val_if_fail (BZ_IS_ENTRY (self), -1);
+  priv = bz_entry_get_instance_private (self);
+
+  if (g_atomic_pointer_get (&priv->cold) != NULL)
+    return priv->cold_content_age;
+  return calc_content_age (priv);
+}
+
 BzCategoryFlags
 bz_entry_get_category_flags (BzEntry *self)
 {
@@ -2285,28 +2043,37 @@ bz_entry_get_is_flathub (BzEntry *self)
 gint
 bz_entry_calc_usefulness (BzEntry *self)
 {
-  BzEntryPrivate *priv  = NULL;
-  gint            score = 0;
+  BzEntryPrivate *priv     = NULL;
+  guint           presence = 0;
+  gint            score    = 0;
 
   g_return_val_if_fail (BZ_IS_ENTRY (self), FALSE);
   priv = bz_entry_get_instance_private (self);
 
+  /* Groups call this for every entry they take in, so
+   * don't decode the cold record just to score it
+   */
+  if (g_atomic_pointer_get (&priv->cold) != NULL)
+    presence = priv->cold_presence;
+  else
+    presence = calc_cold_presence (priv);
+
   score += priv->is_flathub ? 1000 : 0;
 
   score += priv->title != NULL ? 5 : 0;
   score += priv->description != NULL ? 1 : 0;
-  score += priv->long_description != NULL ? 5 : 0;
-  score += priv->url != NULL ? 1 : 0;
+  score += (presence & COLD_HAS_LONG_DESCRIPTION) ? 5 : 0;
+  score += (presence & COLD_HAS_URL) ? 1 : 0;
   score += priv->size > 0 ? 1 : 0;
   score += priv->icon_paintable != NULL ? 15 : 0;
   score += priv->remote_repo_icon != NULL ? 1 : 0;
-  score += priv->metadata_license != NULL ? 1 : 0;
-  score += priv->project_license != NULL ? 1 : 0;
-  score += priv->project_group != NULL ? 1 : 0;
+  score += (presence & COLD_HAS_METADATA_LICENSE) ? 1 : 0;
+  score += (presence & COLD_HAS_PROJECT_LICENSE) ? 1 : 0;
+  score += (presence & COLD_HAS_PROJECT_GROUP) ? 1 : 0;
   score += priv->developer != NULL ? 1 : 0;
   score += priv->developer_id != NULL ? 1 : 0;
-  score += priv->screenshot_paintables != NULL ? 5 : 0;
-  score += priv->share_urls != NULL ? 5 : 0;
+  score += (presence & COLD_HAS_SCREENSHOTS) ? 5 : 0;
+  score += (presence & COLD_HAS_SHARE_URLS) ? 5 : 0;
 
   score -= priv->eol != NULL ? 500 : 0;
 
@@ -2334,6 +2101,12 @@ bz_entry_deserialize (BzEntry  *self,
   return bz_entry_real_deserialize (BZ_SERIALIZABLE (self), import, error);
 }
 
+guint
+bz_entry_get_serialization_version (void)
+{
+  return ENTRY_FIELDS_VERSION;
+}
+
 GIcon *
 bz_load_mini_icon_sync (const char *unique_id_checksum,
                         const char *path)
@@ -2823,4 +2596,431 @@ clear_entry (BzEntry *self)
   g_clear_object (&priv->content_rating);
   g_clear_object (&priv->keywords);
   g_clear_object (&priv->permissions);
+  g_clear_pointer (&priv->cold, g_variant_unref);
+}
+
+static gboolean
+is_cold_prop (guint prop_id)
+{
+  switch (prop_id)
+    {
+    case PROP_LONG_DESCRIPTION:
+    case PROP_URL:
+    case PROP_METADATA_LICENSE:
+    case PROP_PROJECT_LICENSE:
+    case PROP_PROJECT_GROUP:
+    case PROP_SCREENSHOT_PAINTABLES:
+    case PROP_SCREENSHOT_CAPTIONS:
+    case PROP_THUMBNAIL_PAINTABLE:
+    case PROP_SHARE_URLS:
+    case PROP_VERSION_HISTORY:
+    case PROP_IS_MOBILE_FRIENDLY:
+    case PROP_REQUIRED_CONTROLS:
+    case PROP_RECOMMENDED_CONTROLS:
+    case PROP_SUPPORTED_CONTROLS:
+    case PROP_MIN_DISPLAY_LENGTH:
+    case PROP_MAX_DISPLAY_LENGTH:
+    case PROP_CONTENT_RATING:
+    case PROP_KEYWORDS:
+    case PROP_PERMISSIONS:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static void
+ensure_cold (BzEntry *self)
+{
+  BzEntryPrivate *priv            = bz_entry_get_instance_private (self);
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autoptr (GVariantIter) iter   = NULL;
+  g_autoptr (GVariant) cold       = NULL;
+  g_autoptr (GError) local_error  = NULL;
+
+  if (g_atomic_pointer_get (&priv->cold) == NULL)
+    return;
+
+  locker = g_mutex_locker_new (&priv->cold_mutex);
+  if (priv->cold == NULL)
+    return;
+
+  iter = g_variant_iter_new (priv->cold);
+  for (;;)
+    {
+      g_autofree char *key       = NULL;
+      g_autoptr (GVariant) value = NULL;
+
+      if (!g_variant_iter_next (iter, "{sv}", &key, &value))
+        break;
+      deserialize_cold_field (priv, key, value);
+    }
+
+  if (priv->permissions == NULL)
+    priv->permissions = bz_app_permissions_new ();
+  if (!bz_app_permissions_deserialize (priv->permissions, priv->cold, &local_error))
+    g_warning ("Failed to deserialize app permissions: %s", local_error->message);
+
+  /* Only publish once every field is in place */
+  cold = priv->cold;
+  g_atomic_pointer_set (&priv->cold, NULL);
+}
+
+static void
+serialize_cold (BzEntryPrivate  *priv,
+                GVariantBuilder *builder)
+{
+  g_variant_builder_add (builder, "{sv}", "fields", bz_serializable_schema_pack (&cold_schema, priv));
+  if (priv->screenshot_paintables != NULL)
+    {
+      guint n_items = 0;
+
+      n_items = g_list_model_get_n_items (priv->screenshot_paintables);
+      if (n_items > 0)
+        {
+          g_autoptr (GVariantBuilder) sub_builder = NULL;
+
+          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+          for (guint i = 0; i < n_items; i++)
+            {
+              g_autoptr (GdkPaintable) paintable = NULL;
+              g_autofree char *key               = NULL;
+
+              paintable = g_list_model_get_item (priv->screenshot_paintables, i);
+              key       = g_strdup_printf ("screenshot_%d.png", i);
+
+              maybe_save_paintable (priv, key, paintable, sub_builder);
+            }
+
+          g_variant_builder_add (builder, "{sv}", "screenshot-paintables", g_variant_builder_end (sub_builder));
+        }
+    }
+  if (priv->screenshot_captions != NULL)
+    {
+      guint n_items = 0;
+
+      n_items = g_list_model_get_n_items (priv->screenshot_captions);
+      if (n_items > 0)
+        {
+          g_autoptr (GVariantBuilder) sub_builder = NULL;
+
+          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+          for (guint i = 0; i < n_items; i++)
+            {
+              g_autoptr (GtkStringObject) string = NULL;
+
+              string = g_list_model_get_item (priv->screenshot_captions, i);
+              g_variant_builder_add (sub_builder, "s", gtk_string_object_get_string (string));
+            }
+
+          g_variant_builder_add (builder, "{sv}", "screenshot-captions", g_variant_builder_end (sub_builder));
+        }
+    }
+  if (priv->thumbnail_paintable != NULL)
+    maybe_save_paintable (priv, "thumbnail-paintable", priv->thumbnail_paintable, builder);
+  if (priv->share_urls != NULL)
+    {
+      guint n_items = 0;
+
+      n_items = g_list_model_get_n_items (priv->share_urls);
+      if (n_items > 0)
+        {
+          g_autoptr (GVariantBuilder) sub_builder = NULL;
+
+          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
+          for (guint i = 0; i < n_items; i++)
+            {
+              g_autoptr (BzUrl) url = NULL;
+              const char *id        = NULL;
+              const char *url_str   = NULL;
+
+              url     = g_list_model_get_item (priv->share_urls, i);
+              id      = bz_url_get_id (url);
+              url_str = bz_url_get_url (url);
+
+              g_variant_builder_add (sub_builder, "(ss)", id ? id : "", url_str ? url_str : "");
+            }
+          g_variant_builder_add (builder, "{sv}", "share-urls", g_variant_builder_end (sub_builder));
+        }
+    }
+  if (priv->version_history != NULL)
+    {
+      guint n_items = 0;
+
+      n_items = g_list_model_get_n_items (priv->version_history);
+      if (n_items > 0)
+        {
+          g_autoptr (GVariantBuilder) sub_builder = NULL;
+
+          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(mstmsms)"));
+          for (guint i = 0; i < n_items; i++)
+            {
+              g_autoptr (BzRelease) release = NULL;
+              guint64     timestamp         = 0;
+              const char *url               = NULL;
+              const char *version           = NULL;
+              const char *description       = NULL;
+
+              release     = g_list_model_get_item (priv->version_history, i);
+              timestamp   = bz_release_get_timestamp (release);
+              url         = bz_release_get_url (release);
+              version     = bz_release_get_version (release);
+              description = bz_release_get_description (release);
+
+              g_variant_builder_add (
+                  sub_builder,
+                  "(mstmsms)",
+                  description,
+                  timestamp,
+                  url,
+                  version);
+            }
+
+          g_variant_builder_add (builder, "{sv}", "version-history", g_variant_builder_end (sub_builder));
+        }
+    }
+  if (priv->content_rating != NULL)
+    {
+      const gchar *kind                       = as_content_rating_get_kind (priv->content_rating);
+      g_autoptr (GVariantBuilder) sub_builder = NULL;
+      g_autofree const gchar **rating_ids     = NULL;
+
+      sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
+      rating_ids  = as_content_rating_get_all_rating_ids ();
+
+      for (gsize i = 0; rating_ids[i] != NULL; i++)
+        {
+          AsContentRatingValue value     = as_content_rating_get_value (priv->content_rating, rating_ids[i]);
+          const gchar         *value_str = as_content_rating_value_to_string (value);
+
+          if (value != AS_CONTENT_RATING_VALUE_UNKNOWN)
+            g_variant_builder_add (sub_builder, "(ss)", rating_ids[i], value_str);
+        }
+
+      g_variant_builder_add (builder, "{sv}", "content-rating-kind", g_variant_new_string (kind ? kind : "oars-1.1"));
+      g_variant_builder_add (builder, "{sv}", "content-rating-values", g_variant_builder_end (sub_builder));
+    }
+  if (priv->keywords != NULL)
+    {
+      guint n_items = 0;
+
+      n_items = g_list_model_get_n_items (priv->keywords);
+      if (n_items > 0)
+        {
+          g_autoptr (GVariantBuilder) sub_builder = NULL;
+
+          sub_builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+          for (guint i = 0; i < n_items; i++)
+            {
+              g_autoptr (GtkStringObject) string = NULL;
+
+              string = g_list_model_get_item (priv->keywords, i);
+              g_variant_builder_add (sub_builder, "s", gtk_string_object_get_string (string));
+            }
+
+          g_variant_builder_add (builder, "{sv}", "keywords", g_variant_builder_end (sub_builder));
+        }
+    }
+  if (priv->permissions != NULL)
+    {
+      bz_app_permissions_serialize (priv->permissions, builder);
+    }
+}
+
+static void
+deserialize_cold_field (BzEntryPrivate *priv,
+                        const char     *key,
+                        GVariant       *value)
+{
+  if (g_strcmp0 (key, "fields") == 0)
+    {
+      g_autoptr (GError) local_error = NULL;
+
+      if (!bz_serializable_schema_unpack (&cold_schema, priv, value, &local_error))
+        g_warning ("Failed to unpack cold entry fields: %s", local_error->message);
+    }
+  else if (g_strcmp0 (key, "screenshot-paintables") == 0)
+    {
+      g_autoptr (GListStore) store             = NULL;
+      g_autoptr (GVariantIter) screenshot_iter = NULL;
+
+      store = g_list_store_new (BZ_TYPE_ASYNC_TEXTURE);
+
+      screenshot_iter = g_variant_iter_new (value);
+      for (;;)
+        {
+          g_autofree char *basename        = NULL;
+          g_autoptr (GVariant) screenshot  = NULL;
+          g_autoptr (GdkPaintable) texture = NULL;
+
+          if (!g_variant_iter_next (screenshot_iter, "{sv}", &basename, &screenshot))
+            break;
+          texture = make_async_texture (screenshot);
+          g_list_store_append (store, texture);
+        }
+
+      priv->screenshot_paintables = G_LIST_MODEL (g_steal_pointer (&store));
+    }
+  else if (g_strcmp0 (key, "screenshot-captions") == 0)
+    {
+      g_autoptr (GListStore) store          = NULL;
+      g_autoptr (GVariantIter) caption_iter = NULL;
+
+      store = g_list_store_new (GTK_TYPE_STRING_OBJECT);
+
+      caption_iter = g_variant_iter_new (value);
+      for (;;)
+        {
+          g_autofree char *caption           = NULL;
+          g_autoptr (GtkStringObject) string = NULL;
+
+          if (!g_variant_iter_next (caption_iter, "s", &caption))
+            break;
+          string = gtk_string_object_new (caption);
+          g_list_store_append (store, string);
+        }
+
+      priv->screenshot_captions = G_LIST_MODEL (g_steal_pointer (&store));
+    }
+  else if (g_strcmp0 (key, "thumbnail-paintable") == 0)
+    priv->thumbnail_paintable = make_async_texture (value);
+  else if (g_strcmp0 (key, "share-urls") == 0)
+    {
+      g_autoptr (GListStore) store      = NULL;
+      g_autoptr (GVariantIter) url_iter = NULL;
+
+      store    = g_list_store_new (BZ_TYPE_URL);
+      url_iter = g_variant_iter_new (value);
+      for (;;)
+        {
+          g_autofree char *id      = NULL;
+          g_autofree char *url_str = NULL;
+          g_autoptr (BzUrl) url    = NULL;
+
+          if (!g_variant_iter_next (url_iter, "(ss)", &id, &url_str))
+            break;
+          url = bz_url_new ();
+          bz_url_set_id (url, id);
+          bz_url_set_url (url, url_str);
+          g_list_store_append (store, url);
+        }
+
+      priv->share_urls = G_LIST_MODEL (g_steal_pointer (&store));
+    }
+  else if (g_strcmp0 (key, "version-history") == 0)
+    {
+      g_autoptr (GListStore) store          = NULL;
+      g_autoptr (GVariantIter) version_iter = NULL;
+
+      store = g_list_store_new (BZ_TYPE_RELEASE);
+
+      version_iter = g_variant_iter_new (value);
+      for (;;)
+        {
+          guint64          timestamp    = 0;
+          g_autofree char *url          = NULL;
+          g_autofree char *description  = NULL;
+          g_autofree char *version      = NULL;
+          g_autoptr (BzRelease) release = NULL;
+
+          if (!g_variant_iter_next (version_iter, "(mstmsms)", &description, &timestamp, &url, &version))
+            break;
+
+          release = bz_release_new ();
+          bz_release_set_timestamp (release, timestamp);
+          bz_release_set_url (release, url);
+          bz_release_set_version (release, version);
+          bz_release_set_description (release, description);
+          g_list_store_append (store, release);
+        }
+
+      priv->version_history = G_LIST_MODEL (g_steal_pointer (&store));
+    }
+  else if (g_strcmp0 (key, "content-rating-kind") == 0)
+    {
+      g_autofree gchar *kind = NULL;
+
+      kind = g_variant_dup_string (value, NULL);
+
+      if (priv->content_rating == NULL)
+        priv->content_rating = as_content_rating_new ();
+
+      as_content_rating_set_kind (priv->content_rating, kind);
+    }
+  else if (g_strcmp0 (key, "content-rating-values") == 0)
+    {
+      g_autoptr (GVariantIter) rating_iter = NULL;
+
+      if (priv->content_rating == NULL)
+        priv->content_rating = as_content_rating_new ();
+
+      rating_iter = g_variant_iter_new (value);
+      for (;;)
+        {
+          g_autofree gchar    *rating_id        = NULL;
+          g_autofree gchar    *rating_value_str = NULL;
+          AsContentRatingValue rating_value;
+
+          if (!g_variant_iter_next (rating_iter, "(ss)", &rating_id, &rating_value_str))
+            break;
+
+          rating_value = as_content_rating_value_from_string (rating_value_str);
+          if (rating_value != AS_CONTENT_RATING_VALUE_UNKNOWN)
+            as_content_rating_set_value (priv->content_rating, rating_id, rating_value);
+        }
+    }
+  else if (g_strcmp0 (key, "keywords") == 0)
+    {
+      g_autoptr (GListStore) store           = NULL;
+      g_autoptr (GVariantIter) keywords_iter = NULL;
+
+      store = g_list_store_new (GTK_TYPE_STRING_OBJECT);
+
+      keywords_iter = g_variant_iter_new (value);
+      for (;;)
+        {
+          g_autofree char *keyword           = NULL;
+          g_autoptr (GtkStringObject) string = NULL;
+
+          if (!g_variant_iter_next (keywords_iter, "s", &keyword))
+            break;
+          string = gtk_string_object_new (keyword);
+          g_list_store_append (store, string);
+        }
+
+      priv->keywords = G_LIST_MODEL (g_steal_pointer (&store));
+    }
+  else
+    bz_serializable_schema_unpack_legacy (&cold_schema, priv, key, value);
+}
+
+static guint
+calc_cold_presence (BzEntryPrivate *priv)
+{
+  guint presence = 0;
+
+  if (priv->long_description != NULL)
+    presence |= COLD_HAS_LONG_DESCRIPTION;
+  if (priv->url != NULL)
+    presence |= COLD_HAS_URL;
+  if (priv->metadata_license != NULL)
+    presence |= COLD_HAS_METADATA_LICENSE;
+  if (priv->project_license != NULL)
+    presence |= COLD_HAS_PROJECT_LICENSE;
+  if (priv->project_group != NULL)
+    presence |= COLD_HAS_PROJECT_GROUP;
+  if (priv->screenshot_paintables != NULL)
+    presence |= COLD_HAS_SCREENSHOTS;
+  if (priv->share_urls != NULL)
+    presence |= COLD_HAS_SHARE_URLS;
+
+  return presence;
+}
+
+static gint
+calc_content_age (BzEntryPrivate *priv)
+{
+  if (priv->content_rating == NULL)
+    return -1;
+  return as_content_rating_get_minimum_age (priv->content_rating);
 }
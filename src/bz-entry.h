@@ -223,6 +223,9 @@ bz_entry_get_age_rating (BzEntry *self);
 AsContentRating *
 bz_entry_get_content_rating (BzEntry *self);
 
+gint
+bz_entry_get_content_age (BzEntry *self);
+
 BzCategoryFlags
 bz_entry_get_category_flags (BzEntry *self);
 
@@ -238,6 +241,9 @@ bz_entry_deserialize (BzEntry  *self,
                       GVariant *import,
                       GError  **error);
 
+guint
+bz_entry_get_serialization_version (void);
+
 GIcon *
 bz_load_mini_icon_sync (const char *unique_id_checksum,
                         const char *path);
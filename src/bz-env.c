@@ -153,3 +153,145 @@ bz_get_desktop_search_provider_icon_size (void)
 
   return (guint) icon_size;
 }
+
+guint64
+bz_get_entry_cache_budget (void)
+{
+  static gsize   initialized = 0;
+  static guint64 budget      = 0;
+
+  /* Zero is a valid budget, so it can't double as the
+   * "not yet initialized" value like the others above
+   */
+  if (g_once_init_enter (&initialized))
+    {
+      const char *envvar = NULL;
+      guint64     value  = 0;
+
+      /* default 16 MiB worth of serialized entries */
+      value = 16 * 1024 * 1024;
+
+      envvar = g_getenv ("BAZAAR_ENTRY_CACHE_BUDGET");
+      if (envvar != NULL)
+        {
+          g_autoptr (GError) local_error = NULL;
+          g_autoptr (GVariant) variant   = NULL;
+
+          variant = g_variant_parse (
+              G_VARIANT_TYPE_UINT64, envvar,
+              NULL, NULL, &local_error);
+          if (variant != NULL)
+            value = g_variant_get_uint64 (variant);
+          else
+            g_warning ("BAZAAR_ENTRY_CACHE_BUDGET is invalid: %s", local_error->message);
+        }
+
+      budget = value;
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return budget;
+}
+
+guint64
+bz_get_entry_cache_max_size (void)
+{
+  static gsize   initialized = 0;
+  static guint64 max_size    = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const char *envvar = NULL;
+      guint64     value  = 0;
+
+      /* default no limit */
+      envvar = g_getenv ("BAZAAR_ENTRY_CACHE_MAX_SIZE");
+      if (envvar != NULL)
+        {
+          g_autoptr (GError) local_error = NULL;
+          g_autoptr (GVariant) variant   = NULL;
+
+          variant = g_variant_parse (
+              G_VARIANT_TYPE_UINT64, envvar,
+              NULL, NULL, &local_error);
+          if (variant != NULL)
+            value = g_variant_get_uint64 (variant);
+          else
+            g_warning ("BAZAAR_ENTRY_CACHE_MAX_SIZE is invalid: %s", local_error->message);
+        }
+
+      max_size = value;
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return max_size;
+}
+
+int
+bz_get_entry_cache_compression_level (void)
+{
+  static gsize initialized = 0;
+  static int   level       = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const char *envvar = NULL;
+      int         value  = 0;
+
+      /* Entries are mostly text, so even the fastest level
+       * gets most of the benefit. 0 stores records as is.
+       */
+      value = 1;
+
+      envvar = g_getenv ("BAZAAR_ENTRY_CACHE_COMPRESSION");
+      if (envvar != NULL)
+        {
+          g_autoptr (GError) local_error = NULL;
+          g_autoptr (GVariant) variant   = NULL;
+
+          variant = g_variant_parse (
+              G_VARIANT_TYPE_INT32, envvar,
+              NULL, NULL, &local_error);
+          if (variant != NULL)
+            {
+              gint32 parse_result = 0;
+
+              parse_result = g_variant_get_int32 (variant);
+              if (parse_result < -1 || parse_result > 9)
+                g_warning ("BAZAAR_ENTRY_CACHE_COMPRESSION must be a zlib level from -1 to 9");
+              else
+                value = parse_result;
+            }
+          else
+            g_warning ("BAZAAR_ENTRY_CACHE_COMPRESSION is invalid: %s", local_error->message);
+        }
+
+      level = value;
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return level;
+}
+
+const char *
+bz_get_trace_file (void)
+{
+  static gsize initialized = 0;
+  static char *trace_file  = NULL;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const char *envvar = NULL;
+
+      /* When set, timing spans are written here as Chrome
+       * trace-event JSON for Perfetto or about:tracing
+       */
+      envvar = g_getenv ("BAZAAR_TRACE_FILE");
+      if (envvar != NULL && *envvar != '\0')
+        trace_file = g_strdup (envvar);
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return trace_file;
+}
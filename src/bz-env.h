@@ -33,4 +33,16 @@ bz_get_n_download_workers (void);
 guint
 bz_get_desktop_search_provider_icon_size (void);
 
+guint64
+bz_get_entry_cache_budget (void);
+
+guint64
+bz_get_entry_cache_max_size (void);
+
+int
+bz_get_entry_cache_compression_level (void);
+
+const char *
+bz_get_trace_file (void);
+
 G_END_DECLS
@@ -89,6 +89,27 @@ enum
 };
 static GParamSpec *props[LAST_PROP] = { 0 };
 
+/* Bump the version whenever this table changes */
+static const BzSerializableField flatpak_fields[] = {
+  BZ_SERIALIZABLE_FIELD ("user", BOOLEAN, BzFlatpakEntry, user),
+  BZ_SERIALIZABLE_FIELD ("is-bundle", BOOLEAN, BzFlatpakEntry, is_bundle),
+  BZ_SERIALIZABLE_FIELD ("is-installed-ref", BOOLEAN, BzFlatpakEntry, is_installed_ref),
+  BZ_SERIALIZABLE_FIELD ("bundle-path", STRING, BzFlatpakEntry, bundle_path),
+  BZ_SERIALIZABLE_FIELD ("flatpak-name", STRING, BzFlatpakEntry, flatpak_name),
+  BZ_SERIALIZABLE_FIELD ("flatpak-id", STRING, BzFlatpakEntry, flatpak_id),
+  BZ_SERIALIZABLE_FIELD ("flatpak-version", STRING, BzFlatpakEntry, flatpak_version),
+  BZ_SERIALIZABLE_FIELD ("application-name", STRING, BzFlatpakEntry, application_name),
+  BZ_SERIALIZABLE_FIELD ("application-runtime", STRING, BzFlatpakEntry, application_runtime),
+  BZ_SERIALIZABLE_FIELD ("application-command", STRING, BzFlatpakEntry, application_command),
+  BZ_SERIALIZABLE_FIELD ("runtime-name", STRING, BzFlatpakEntry, runtime_name),
+  BZ_SERIALIZABLE_FIELD ("addon-extension-of-ref", STRING, BzFlatpakEntry, addon_extension_of_ref),
+};
+static BzSerializableSchema flatpak_schema = {
+  .version  = 1,
+  .fields   = flatpak_fields,
+  .n_fields = G_N_ELEMENTS (flatpak_fields),
+};
+
 static void
 clear_entry (BzFlatpakEntry *self);
 
@@ -281,27 +302,8 @@ bz_flatpak_entry_real_serialize (BzSerializable  *serializable,
 {
   BzFlatpakEntry *self = BZ_FLATPAK_ENTRY (serializable);
 
-  g_variant_builder_add (builder, "{sv}", "user", g_variant_new_boolean (self->user));
-  g_variant_builder_add (builder, "{sv}", "is-bundle", g_variant_new_boolean (self->is_bundle));
-  g_variant_builder_add (builder, "{sv}", "is-installed-ref", g_variant_new_boolean (self->is_installed_ref));
-  if (self->bundle_path != NULL)
-    g_variant_builder_add (builder, "{sv}", "bundle-path", g_variant_new_string (self->bundle_path));
-  if (self->flatpak_name != NULL)
-    g_variant_builder_add (builder, "{sv}", "flatpak-name", g_variant_new_string (self->flatpak_name));
-  if (self->flatpak_id != NULL)
-    g_variant_builder_add (builder, "{sv}", "flatpak-id", g_variant_new_string (self->flatpak_id));
-  if (self->flatpak_version != NULL)
-    g_variant_builder_add (builder, "{sv}", "flatpak-version", g_variant_new_string (self->flatpak_version));
-  if (self->application_name != NULL)
-    g_variant_builder_add (builder, "{sv}", "application-name", g_variant_new_string (self->application_name));
-  if (self->application_runtime != NULL)
-    g_variant_builder_add (builder, "{sv}", "application-runtime", g_variant_new_string (self->application_runtime));
-  if (self->application_command != NULL)
-    g_variant_builder_add (builder, "{sv}", "application-command", g_variant_new_string (self->application_command));
-  if (self->runtime_name != NULL)
-    g_variant_builder_add (builder, "{sv}", "runtime-name", g_variant_new_string (self->runtime_name));
-  if (self->addon_extension_of_ref != NULL)
-    g_variant_builder_add (builder, "{sv}", "addon-extension-of-ref", g_variant_new_string (self->addon_extension_of_ref));
+  g_variant_builder_add (builder, "{sv}", "flatpak-fields",
+                         bz_serializable_schema_pack (&flatpak_schema, self));
 
   bz_entry_serialize (BZ_ENTRY (self), builder);
 }
@@ -312,43 +314,30 @@ bz_flatpak_entry_real_deserialize (BzSerializable *serializable,
                                    GError        **error)
 {
   BzFlatpakEntry *self          = BZ_FLATPAK_ENTRY (serializable);
+  g_autoptr (GVariant) packed   = NULL;
   g_autoptr (GVariantIter) iter = NULL;
 
   clear_entry (self);
 
-  iter = g_variant_iter_new (import);
-  for (;;)
+  packed = g_variant_lookup_value (import, "flatpak-fields", NULL);
+  if (packed != NULL)
+    {
+      if (!bz_serializable_schema_unpack (&flatpak_schema, self, packed, error))
+        return FALSE;
+    }
+  else
     {
-      g_autofree char *key       = NULL;
-      g_autoptr (GVariant) value = NULL;
-
-      if (!g_variant_iter_next (iter, "{sv}", &key, &value))
-        break;
-
-      if (g_strcmp0 (key, "user") == 0)
-        self->user = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "is-bundle") == 0)
-        self->is_bundle = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "is-installed-ref") == 0)
-        self->is_installed_ref = g_variant_get_boolean (value);
-      else if (g_strcmp0 (key, "bundle-path") == 0)
-        self->bundle_path = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "flatpak-name") == 0)
-        self->flatpak_name = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "flatpak-id") == 0)
-        self->flatpak_id = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "flatpak-version") == 0)
-        self->flatpak_version = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "application-name") == 0)
-        self->application_name = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "application-runtime") == 0)
-        self->application_runtime = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "application-command") == 0)
-        self->application_command = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "runtime-name") == 0)
-        self->runtime_name = g_variant_dup_string (value, NULL);
-      else if (g_strcmp0 (key, "addon-extension-of-ref") == 0)
-        self->addon_extension_of_ref = g_variant_dup_string (value, NULL);
+      /* Older caches stored each field under its own key */
+      iter = g_variant_iter_new (import);
+      for (;;)
+        {
+          g_autofree char *key       = NULL;
+          g_autoptr (GVariant) value = NULL;
+
+          if (!g_variant_iter_next (iter, "{sv}", &key, &value))
+            break;
+          bz_serializable_schema_unpack_legacy (&flatpak_schema, self, key, value);
+        }
     }
 
   if (self->is_installed_ref)
@@ -840,6 +829,12 @@ bz_flatpak_entry_launch (BzFlatpakEntry    *self,
 #endif
 }
 
+guint
+bz_flatpak_entry_get_serialization_version (void)
+{
+  return flatpak_schema.version;
+}
+
 static void
 clear_entry (BzFlatpakEntry *self)
 {
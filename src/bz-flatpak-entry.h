@@ -74,4 +74,7 @@ bz_flatpak_entry_launch (BzFlatpakEntry    *self,
                          BzFlatpakInstance *flatpak,
                          GError           **error);
 
+guint
+bz_flatpak_entry_get_serialization_version (void);
+
 G_END_DECLS
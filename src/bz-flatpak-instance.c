@@ -21,6 +21,8 @@
 #define G_LOG_DOMAIN  "BAZAAR::FLATPAK"
 #define BAZAAR_MODULE "flatpak"
 
+#include <errno.h>
+#include <glib/gstdio.h>
 #include <malloc.h>
 #include <xmlb.h>
 
@@ -39,6 +41,12 @@
 #include "bz-repository.h"
 #include "bz-util.h"
 
+/* Kept outside of the module directory, which is
+ * discarded every time an instance is initialized
+ */
+#define REMOTE_FINGERPRINTS_MODULE "remote-fingerprints"
+#define REMOTE_FINGERPRINT_FORMAT  "(sas)"
+
 /* clang-format off */
 G_DEFINE_QUARK (bz-flatpak-error-quark, bz_flatpak_error);
 /* clang-format on */
@@ -68,6 +76,11 @@ struct _BzFlatpakInstance
   GMutex transactions_mutex;
   /* BzEntry* -> GPtrArray* -> GCancellable* */
   GHashTable *ongoing_cancellables;
+
+  GMutex      fingerprints_mutex;
+  GHashTable *cached_entries;
+  /* char* record path -> GVariant* record */
+  GHashTable *pending_fingerprints;
 };
 
 static void
@@ -195,6 +208,17 @@ retrieve_refs_for_noenumerable_remote (BzFlatpakInstance   *self,
                                        FlatpakInstallation *installation,
                                        FlatpakRemote       *remote);
 
+static char *
+dup_remote_fingerprint (FlatpakInstallation *installation,
+                        FlatpakRemote       *remote,
+                        const char          *appstream_dir_path,
+                        GPtrArray           *refs);
+
+static GHashTable *
+dup_retainable_entries (BzFlatpakInstance *self,
+                        const char        *record_path,
+                        const char        *fingerprint);
+
 BZ_DEFINE_DATA (
     transaction,
     Transaction,
@@ -389,6 +413,10 @@ bz_flatpak_instance_dispose (GObject *object)
   g_clear_pointer (&self->ongoing_cancellables, g_hash_table_unref);
   g_mutex_clear (&self->transactions_mutex);
 
+  g_clear_pointer (&self->cached_entries, g_hash_table_unref);
+  g_clear_pointer (&self->pending_fingerprints, g_hash_table_unref);
+  g_mutex_clear (&self->fingerprints_mutex);
+
   G_OBJECT_CLASS (bz_flatpak_instance_parent_class)->dispose (object);
 }
 
@@ -415,6 +443,10 @@ bz_flatpak_instance_init (BzFlatpakInstance *self)
   self->ongoing_cancellables = g_hash_table_new_full (
       g_direct_hash, g_direct_equal, g_object_unref, (GDestroyNotify) g_ptr_array_unref);
   g_mutex_init (&self->transactions_mutex);
+
+  self->pending_fingerprints = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  g_mutex_init (&self->fingerprints_mutex);
 }
 
 static DexChannel *
@@ -700,6 +732,77 @@ bz_flatpak_instance_ensure_has_flathub (BzFlatpakInstance *self,
       ensure_flathub_data_ref (data), ensure_flathub_data_unref);
 }
 
+/* Enumerable remotes whose fingerprint is unchanged since the
+ * last commit, and whose entries are all in @checksums, are
+ * reported with a single RETAIN_ENTRIES notification instead
+ * of being enumerated again. Pass NULL to always enumerate.
+ */
+void
+bz_flatpak_instance_set_cached_entries (BzFlatpakInstance *self,
+                                        GHashTable        *checksums)
+{
+  g_return_if_fail (BZ_IS_FLATPAK_INSTANCE (self));
+
+  g_mutex_lock (&self->fingerprints_mutex);
+  g_clear_pointer (&self->cached_entries, g_hash_table_unref);
+  if (checksums != NULL)
+    self->cached_entries = g_hash_table_ref (checksums);
+  g_mutex_unlock (&self->fingerprints_mutex);
+}
+
+/* Persists the fingerprints of remotes fully enumerated so
+ * far. Only call this once their entries are safely cached.
+ */
+gboolean
+bz_flatpak_instance_commit_remote_fingerprints (BzFlatpakInstance *self,
+                                                GError           **error)
+{
+  g_autofree char *dir           = NULL;
+  g_autoptr (GHashTable) pending = NULL;
+  GHashTableIter iter            = { 0 };
+
+  g_return_val_if_fail (BZ_IS_FLATPAK_INSTANCE (self), FALSE);
+
+  g_mutex_lock (&self->fingerprints_mutex);
+  pending                    = g_steal_pointer (&self->pending_fingerprints);
+  self->pending_fingerprints = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  g_mutex_unlock (&self->fingerprints_mutex);
+
+  if (g_hash_table_size (pending) == 0)
+    return TRUE;
+
+  dir = bz_dup_cache_dir (REMOTE_FINGERPRINTS_MODULE);
+  if (g_mkdir_with_parents (dir, 0755) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to make fingerprint directory '%s': %s",
+                   dir, g_strerror (errsv));
+      return FALSE;
+    }
+
+  g_hash_table_iter_init (&iter, pending);
+  for (;;)
+    {
+      const char *path   = NULL;
+      GVariant   *record = NULL;
+
+      if (!g_hash_table_iter_next (&iter, (gpointer *) &path, (gpointer *) &record))
+        break;
+
+      if (!g_file_set_contents (
+              path,
+              g_variant_get_data (record),
+              g_variant_get_size (record),
+              error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static DexFuture *
 init_fiber (InitData *data)
 {
@@ -1541,6 +1644,13 @@ retrieve_refs_for_enumerable_remote (BzFlatpakInstance   *self,
   g_autoptr (GPtrArray) children        = NULL;
   g_autoptr (GHashTable) component_hash = NULL;
   g_autoptr (GPtrArray) refs            = NULL;
+  g_autofree char *fingerprint          = NULL;
+  g_autofree char *fingerprints_dir     = NULL;
+  g_autofree char *record_basename      = NULL;
+  g_autofree char *record_path          = NULL;
+  g_autoptr (GHashTable) retained       = NULL;
+  g_autoptr (GVariantBuilder) checksums = NULL;
+  GVariant *record                      = NULL;
 
   g_debug ("Remote '%s' is enumerable, listing all remote refs", remote_name);
 
@@ -1591,6 +1701,45 @@ retrieve_refs_for_enumerable_remote (BzFlatpakInstance   *self,
         appstream_xml_path,
         remote_name);
 
+  refs = flatpak_installation_list_remote_refs_sync (
+      installation, remote_name, cancellable, &local_error);
+  if (refs == NULL)
+    SEND_AND_RETURN_ERROR (
+        self, TRUE,
+        BZ_FLATPAK_ERROR_REMOTE_SYNCHRONIZATION_FAILURE,
+        "Failed to enumerate refs for remote '%s': %s",
+        remote_name,
+        local_error->message);
+
+  /* Everything an entry is built from is either in the appstream
+   * checkout or in the ref list, so if neither moved since the
+   * entries were last cached, there is nothing to rebuild
+   */
+  fingerprint      = dup_remote_fingerprint (installation, remote, appstream_dir_path, refs);
+  fingerprints_dir = bz_dup_cache_dir (REMOTE_FINGERPRINTS_MODULE);
+  record_basename  = g_strdup_printf (
+      "%s-%s",
+      installation == self->user ? "user" : "system",
+      remote_name);
+  record_path      = g_build_filename (fingerprints_dir, record_basename, NULL);
+
+  retained = dup_retainable_entries (self, record_path, fingerprint);
+  if (retained != NULL)
+    {
+      g_autoptr (BzBackendNotification) notif = NULL;
+
+      g_debug ("Remote '%s' is unchanged since it was last cached, retaining %u entries",
+               remote_name, g_hash_table_size (retained));
+
+      notif = bz_backend_notification_new ();
+      bz_backend_notification_set_kind (notif, BZ_BACKEND_NOTIFICATION_KIND_RETAIN_ENTRIES);
+      bz_backend_notification_set_remote_name (notif, remote_name);
+      bz_backend_notification_set_checksums (notif, retained);
+
+      send_notif_all (self, notif, TRUE);
+      return dex_future_new_true ();
+    }
+
   appstream_xml = g_file_new_for_path (appstream_xml_path);
 
   source = xb_builder_source_new ();
@@ -1662,16 +1811,6 @@ retrieve_refs_for_enumerable_remote (BzFlatpakInstance   *self,
       g_hash_table_replace (component_hash, (gpointer) id, component);
     }
 
-  refs = flatpak_installation_list_remote_refs_sync (
-      installation, remote_name, cancellable, &local_error);
-  if (refs == NULL)
-    SEND_AND_RETURN_ERROR (
-        self, TRUE,
-        BZ_FLATPAK_ERROR_REMOTE_SYNCHRONIZATION_FAILURE,
-        "Failed to enumerate refs for remote '%s': %s",
-        remote_name,
-        local_error->message);
-
   {
     g_autoptr (BzBackendNotification) notif = NULL;
 
@@ -1688,6 +1827,7 @@ retrieve_refs_for_enumerable_remote (BzFlatpakInstance   *self,
   g_ptr_array_sort_values_with_data (
       refs, (GCompareDataFunc) cmp_rref, component_hash);
 
+  checksums = g_variant_builder_new (G_VARIANT_TYPE_STRING_ARRAY);
   for (guint i = 0; i < refs->len; i++)
     {
       FlatpakRemoteRef *rref           = NULL;
@@ -1717,6 +1857,11 @@ retrieve_refs_for_enumerable_remote (BzFlatpakInstance   *self,
       if (entry != NULL)
         {
           g_autoptr (BzBackendNotification) notif = NULL;
+          const char *checksum                    = NULL;
+
+          checksum = bz_entry_get_unique_id_checksum (BZ_ENTRY (entry));
+          if (checksum != NULL)
+            g_variant_builder_add (checksums, "s", checksum);
 
           notif = bz_backend_notification_new ();
           bz_backend_notification_set_kind (notif, BZ_BACKEND_NOTIFICATION_KIND_REPLACE_ENTRY);
@@ -1736,6 +1881,15 @@ retrieve_refs_for_enumerable_remote (BzFlatpakInstance   *self,
         }
     }
 
+  /* Held back until the consumer has cached the entries */
+  record = g_variant_new (REMOTE_FINGERPRINT_FORMAT, fingerprint, checksums);
+  g_mutex_lock (&self->fingerprints_mutex);
+  g_hash_table_replace (
+      self->pending_fingerprints,
+      g_steal_pointer (&record_path),
+      g_variant_ref_sink (record));
+  g_mutex_unlock (&self->fingerprints_mutex);
+
   return dex_future_new_true ();
 }
 
@@ -3351,3 +3505,146 @@ extract_first_component_for_silo (XbSilo  *silo,
       g_ptr_array_index (children, 0),
       error);
 }
+
+static char *
+dup_remote_fingerprint (FlatpakInstallation *installation,
+                        FlatpakRemote       *remote,
+                        const char          *appstream_dir_path,
+                        GPtrArray           *refs)
+{
+  g_autoptr (GChecksum) checksum     = NULL;
+  g_autofree char *versions          = NULL;
+  g_autoptr (GFile) installation_dir = NULL;
+  g_autofree char *installation_path = NULL;
+  g_autofree char *url               = NULL;
+  g_autofree char *active            = NULL;
+  g_autofree char *appstream_xml     = NULL;
+  GStatBuf         appstream_stat    = { 0 };
+  g_autofree char *stamp             = NULL;
+  g_autoptr (GPtrArray) lines        = NULL;
+
+#define UPDATE(_s)                                             \
+  G_STMT_START                                                 \
+  {                                                            \
+    const char *_str = (_s);                                   \
+                                                               \
+    if (_str != NULL)                                          \
+      g_checksum_update (checksum, (const guchar *) _str, -1); \
+    g_checksum_update (checksum, (const guchar *) "\n", 1);    \
+  }                                                            \
+  G_STMT_END
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  /* Retained records are only usable by a build that
+   * serializes entries the same way
+   */
+  versions = g_strdup_printf (
+      "%s %u %u",
+      PACKAGE_VERSION,
+      bz_entry_get_serialization_version (),
+      bz_flatpak_entry_get_serialization_version ());
+  UPDATE (versions);
+
+  installation_dir  = flatpak_installation_get_path (installation);
+  installation_path = g_file_get_path (installation_dir);
+  url               = flatpak_remote_get_url (remote);
+  UPDATE (installation_path);
+  UPDATE (flatpak_remote_get_name (remote));
+  UPDATE (url);
+
+  /* The active appstream checkout is a symlink named after the
+   * commit it was deployed from. The bundle's stat covers setups
+   * where that is not the case.
+   */
+  active        = g_file_read_link (appstream_dir_path, NULL);
+  appstream_xml = g_build_filename (appstream_dir_path, "appstream.xml.gz", NULL);
+  if (g_stat (appstream_xml, &appstream_stat) == 0)
+    stamp = g_strdup_printf (
+        "%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+        (gint64) appstream_stat.st_size,
+        (gint64) appstream_stat.st_mtime);
+  UPDATE (active);
+  UPDATE (stamp);
+
+  /* The remote doesn't guarantee any ordering */
+  lines = g_ptr_array_new_full (refs->len, g_free);
+  for (guint i = 0; i < refs->len; i++)
+    {
+      FlatpakRef      *ref       = NULL;
+      g_autofree char *formatted = NULL;
+
+      ref       = g_ptr_array_index (refs, i);
+      formatted = flatpak_ref_format_ref (ref);
+      g_ptr_array_add (
+          lines,
+          g_strdup_printf (
+              "%s %s %" G_GUINT64_FORMAT,
+              formatted,
+              flatpak_ref_get_commit (ref),
+              flatpak_remote_ref_get_download_size (FLATPAK_REMOTE_REF (ref))));
+    }
+  g_ptr_array_sort_values (lines, (GCompareFunc) g_strcmp0);
+  for (guint i = 0; i < lines->len; i++)
+    UPDATE (g_ptr_array_index (lines, i));
+
+#undef UPDATE
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static GHashTable *
+dup_retainable_entries (BzFlatpakInstance *self,
+                        const char        *record_path,
+                        const char        *fingerprint)
+{
+  g_autoptr (GHashTable) cached   = NULL;
+  g_autofree char *contents       = NULL;
+  gsize            length         = 0;
+  g_autoptr (GBytes) bytes        = NULL;
+  g_autoptr (GVariant) record     = NULL;
+  const char *stored              = NULL;
+  g_autoptr (GVariant) checksums  = NULL;
+  GVariantIter iter               = { 0 };
+  g_autoptr (GHashTable) retained = NULL;
+
+  g_mutex_lock (&self->fingerprints_mutex);
+  if (self->cached_entries != NULL)
+    cached = g_hash_table_ref (self->cached_entries);
+  g_mutex_unlock (&self->fingerprints_mutex);
+
+  if (cached == NULL)
+    return NULL;
+  if (!g_file_get_contents (record_path, &contents, &length, NULL))
+    return NULL;
+
+  bytes  = g_bytes_new_take (g_steal_pointer (&contents), length);
+  record = g_variant_new_from_bytes (G_VARIANT_TYPE (REMOTE_FINGERPRINT_FORMAT), bytes, FALSE);
+  g_variant_ref_sink (record);
+
+  g_variant_get_child (record, 0, "&s", &stored);
+  if (g_strcmp0 (stored, fingerprint) != 0)
+    return NULL;
+
+  /* A record can outlive its entries, for example
+   * when the cache was trimmed to size
+   */
+  checksums = g_variant_get_child_value (record, 1);
+  retained  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_variant_iter_init (&iter, checksums);
+  for (;;)
+    {
+      const char *checksum = NULL;
+
+      if (!g_variant_iter_next (&iter, "&s", &checksum))
+        break;
+      if (!g_hash_table_contains (cached, checksum))
+        return NULL;
+
+      g_hash_table_add (retained, g_strdup (checksum));
+    }
+
+  return g_hash_table_size (retained) > 0
+             ? g_steal_pointer (&retained)
+             : NULL;
+}
@@ -52,4 +52,12 @@ DexFuture *
 bz_flatpak_instance_ensure_has_flathub (BzFlatpakInstance *self,
                                         GCancellable      *cancellable);
 
+void
+bz_flatpak_instance_set_cached_entries (BzFlatpakInstance *self,
+                                        GHashTable        *checksums);
+
+gboolean
+bz_flatpak_instance_commit_remote_fingerprints (BzFlatpakInstance *self,
+                                                GError           **error);
+
 G_END_DECLS
@@ -21,10 +21,14 @@
 #include "bz-gnome-shell-search-provider.h"
 #include "bz-entry-group.h"
 #include "bz-finished-search-query.h"
-#include "bz-search-result.h"
+#include "bz-search-result-model.h"
 #include "bz-util.h"
 #include "gs-shell-search-provider-generated.h"
 
+/* The shell only shows a handful of results per provider; leave some room
+   for the installed groups we skip */
+#define MAX_RESULTS 32
+
 struct _BzGnomeShellSearchProvider
 {
   GObject parent_instance;
@@ -36,6 +40,9 @@ struct _BzGnomeShellSearchProvider
   DexFuture              *task;
 
   GHashTable *last_results;
+  /* Whether last_results is only the top MAX_RESULTS of a
+     longer list, so it can't be refined against */
+  gboolean last_truncated;
 };
 
 G_DEFINE_FINAL_TYPE (BzGnomeShellSearchProvider, bz_gnome_shell_search_provider, G_TYPE_OBJECT);
@@ -68,7 +75,8 @@ request_finally (DexFuture   *future,
 static void
 start_request (BzGnomeShellSearchProvider *self,
                GDBusMethodInvocation      *invocation,
-               const char *const          *terms);
+               const char *const          *terms,
+               const char *const          *previous_results);
 
 static void
 bz_gnome_shell_search_provider_dispose (GObject *object)
@@ -159,7 +167,7 @@ get_initial_result_set (BzShellSearchProvider2     *skeleton,
                         gchar                     **terms,
                         BzGnomeShellSearchProvider *self)
 {
-  start_request (self, invocation, (const char *const *) terms);
+  start_request (self, invocation, (const char *const *) terms, NULL);
   return TRUE;
 }
 
@@ -170,7 +178,10 @@ get_subsearch_result_set (BzShellSearchProvider2     *skeleton,
                           gchar                     **terms,
                           BzGnomeShellSearchProvider *self)
 {
-  start_request (self, invocation, (const char *const *) terms);
+  start_request (
+      self, invocation,
+      (const char *const *) terms,
+      (const char *const *) previous_results);
   return TRUE;
 }
 
@@ -374,7 +385,8 @@ request_finally (DexFuture   *future,
   g_autoptr (GError) local_error         = NULL;
   const GValue          *value           = NULL;
   BzFinishedSearchQuery *finished        = NULL;
-  GPtrArray             *results         = NULL;
+  BzSearchResultModel   *results         = NULL;
+  guint                  n_results       = 0;
   g_autoptr (GVariantBuilder) builder    = NULL;
 
   value = dex_future_get_value (future, &local_error);
@@ -384,14 +396,16 @@ request_finally (DexFuture   *future,
       results  = bz_finished_search_query_get_results (finished);
       builder  = g_variant_builder_new (G_VARIANT_TYPE ("as"));
 
-      for (guint i = 0; i < results->len; i++)
+      n_results            = g_list_model_get_n_items (G_LIST_MODEL (results));
+      self->last_truncated = bz_finished_search_query_get_n_results (finished) > n_results;
+      for (guint i = 0; i < n_results; i++)
         {
-          BzSearchResult *result = NULL;
-          BzEntryGroup   *group  = NULL;
-          const char     *id     = NULL;
+          const BzSearchHit *hit   = NULL;
+          BzEntryGroup      *group = NULL;
+          const char        *id    = NULL;
 
-          result = g_ptr_array_index (results, i);
-          group  = bz_search_result_get_group (result);
+          hit   = bz_search_result_model_get_hit (results, i);
+          group = hit->group;
           if (bz_entry_group_get_removable (group) > 0)
             /* Skip already installed groups */
             continue;
@@ -422,7 +436,8 @@ request_finally (DexFuture   *future,
 static void
 start_request (BzGnomeShellSearchProvider *self,
                GDBusMethodInvocation      *invocation,
-               const char *const          *terms)
+               const char *const          *terms,
+               const char *const          *previous_results)
 {
   g_autoptr (RequestData) data = NULL;
   g_autoptr (DexFuture) future = NULL;
@@ -430,6 +445,14 @@ start_request (BzGnomeShellSearchProvider *self,
   dex_clear (&self->task);
   g_hash_table_remove_all (self->last_results);
 
+  /* A group outside the previous top results may well rank
+     higher for the narrower query, so only refine against
+     complete result sets. This also covers the previous
+     request never finishing. */
+  if (self->last_truncated)
+    previous_results = NULL;
+  self->last_truncated = TRUE;
+
   if (g_strv_length ((gchar **) terms) == 1 &&
       g_utf8_strlen (terms[0], -1) == 1)
     {
@@ -455,7 +478,8 @@ start_request (BzGnomeShellSearchProvider *self,
   data->application = g_application_get_default ();
   g_application_hold (data->application);
 
-  future = bz_search_engine_query (self->engine, terms);
+  future = bz_search_engine_refine_query (
+      self->engine, terms, previous_results, MAX_RESULTS);
   future = dex_future_finally (
       future, (DexFutureCallback) request_finally,
       request_data_ref (data), request_data_unref);
@@ -20,13 +20,19 @@
 
 #define G_LOG_DOMAIN "BAZAAR::INSPECTOR"
 
+#define BENCHMARK_FIBERS        32
+#define BENCHMARK_ITERATIONS    256
+#define KERNEL_BENCHMARK_PASSES 20
+
 #include <json-glib/json-glib.h>
 
 #include "bz-entry-inspector.h"
 #include "bz-env.h"
 #include "bz-inspector.h"
+#include "bz-io.h"
 #include "bz-serializable.h"
 #include "bz-template-callbacks.h"
+#include "bz-util.h"
 #include "bz-window.h"
 
 struct _BzInspector
@@ -44,6 +50,9 @@ struct _BzInspector
   GtkEditable        *serialize_all_entries_path_entry;
   GtkButton          *serialize_all_entries_btn;
   GtkProgressBar     *serialize_all_entries_progress;
+  GtkLabel           *cache_benchmark_label;
+  GtkButton          *cache_benchmark_btn;
+  GtkLabel           *kernel_benchmark_label;
   GtkEditable        *search_entry;
   GtkFilterListModel *filter_model;
   GtkSingleSelection *groups_selection;
@@ -64,6 +73,25 @@ static GParamSpec *props[LAST_PROP] = { 0 };
 static DexFuture *
 serialize_all_entries_fiber (BzInspector *self);
 
+BZ_DEFINE_DATA (
+    benchmark,
+    Benchmark,
+    {
+      BzEntryCacheManager *cache;
+      GPtrArray           *checksums;
+      int                  next_seed;
+      int                  gets;
+      int                  adds;
+      int                  failures;
+    },
+    BZ_RELEASE_DATA (cache, g_object_unref);
+    BZ_RELEASE_DATA (checksums, g_ptr_array_unref))
+static DexFuture *
+benchmark_worker_fiber (BenchmarkData *data);
+
+static DexFuture *
+cache_benchmark_fiber (BzInspector *self);
+
 static gboolean
 filter_func (BzEntryGroup *group,
              BzInspector  *self);
@@ -132,6 +160,103 @@ serialize_all_entries_cb (BzInspector *self,
           g_object_ref (self), g_object_unref));
 }
 
+static void
+cache_benchmark_cb (BzInspector *self,
+                    GtkButton   *button)
+{
+  dex_future_disown (
+      dex_scheduler_spawn (
+          dex_scheduler_get_default (),
+          bz_get_dex_stack_size (),
+          (DexFiberFunc) cache_benchmark_fiber,
+          g_object_ref (self), g_object_unref));
+}
+
+static void
+kernel_benchmark_cb (BzInspector *self,
+                     GtkButton   *button)
+{
+  BzSearchEngine  *engine = NULL;
+  g_autofree char *report = NULL;
+
+  if (self->state == NULL)
+    return;
+  engine = bz_state_info_get_search_engine (self->state);
+  if (engine == NULL)
+    return;
+
+  /* The engine only hands out its corpus on the main
+   * thread, so this blocks the inspector while it runs
+   */
+  report = bz_search_engine_benchmark_kernels (
+      engine,
+      (const char *const[]) {
+          "fire",
+          "libreoffice",
+          "zz",
+          "game",
+          "video editor",
+          "text",
+          "office",
+          "music player",
+          NULL,
+      },
+      KERNEL_BENCHMARK_PASSES);
+  g_debug ("Search kernel benchmark: %s", report);
+
+  gtk_label_set_label (self->kernel_benchmark_label, report);
+}
+
+static char *
+format_lru_occupancy (gpointer object,
+                      guint64  usage,
+                      guint64  budget,
+                      guint    n_entries)
+{
+  g_autofree char *usage_str  = NULL;
+  g_autofree char *budget_str = NULL;
+
+  if (budget == 0)
+    return g_strdup ("Disabled");
+
+  usage_str  = g_format_size (usage);
+  budget_str = g_format_size (budget);
+  return g_strdup_printf ("%s of %s (%u entries)", usage_str, budget_str, n_entries);
+}
+
+static char *
+format_compression (gpointer object,
+                    guint64  raw_bytes,
+                    guint64  stored_bytes,
+                    guint64  deflate_usec,
+                    guint64  inflate_usec,
+                    guint64  inflated_bytes)
+{
+  g_autofree char *raw_str      = NULL;
+  g_autofree char *stored_str   = NULL;
+  g_autofree char *inflated_str = NULL;
+
+  /* Bytes per microsecond is the same as MB/s */
+  inflated_str = g_format_size (inflated_bytes);
+  if (raw_bytes == 0)
+    return g_strdup_printf ("Nothing written, %s inflated in %.1f ms (%.0f MB/s)",
+                            inflated_str,
+                            inflate_usec / 1000.0,
+                            (double) inflated_bytes / MAX (inflate_usec, 1));
+
+  raw_str    = g_format_size (raw_bytes);
+  stored_str = g_format_size (stored_bytes);
+  return g_strdup_printf ("%s stored as %s (%.0f%%), %.1f ms deflating (%.0f MB/s), "
+                          "%s inflated in %.1f ms (%.0f MB/s)",
+                          raw_str, stored_str,
+                          100.0 * stored_bytes / raw_bytes,
+                          deflate_usec / 1000.0,
+                          (double) raw_bytes / MAX (deflate_usec, 1),
+                          inflated_str,
+                          inflate_usec / 1000.0,
+                          (double) inflated_bytes / MAX (inflate_usec, 1));
+}
+
 static void
 preview_changed (BzInspector    *self,
                  GParamSpec     *pspec,
@@ -272,10 +397,17 @@ bz_inspector_class_init (BzInspectorClass *klass)
   gtk_widget_class_bind_template_child (widget_class, BzInspector, serialize_all_entries_path_entry);
   gtk_widget_class_bind_template_child (widget_class, BzInspector, serialize_all_entries_btn);
   gtk_widget_class_bind_template_child (widget_class, BzInspector, serialize_all_entries_progress);
+  gtk_widget_class_bind_template_child (widget_class, BzInspector, cache_benchmark_label);
+  gtk_widget_class_bind_template_child (widget_class, BzInspector, cache_benchmark_btn);
+  gtk_widget_class_bind_template_child (widget_class, BzInspector, kernel_benchmark_label);
   gtk_widget_class_bind_template_child (widget_class, BzInspector, search_entry);
   gtk_widget_class_bind_template_child (widget_class, BzInspector, filter_model);
   gtk_widget_class_bind_template_child (widget_class, BzInspector, groups_selection);
   gtk_widget_class_bind_template_callback (widget_class, serialize_all_entries_cb);
+  gtk_widget_class_bind_template_callback (widget_class, cache_benchmark_cb);
+  gtk_widget_class_bind_template_callback (widget_class, kernel_benchmark_cb);
+  gtk_widget_class_bind_template_callback (widget_class, format_lru_occupancy);
+  gtk_widget_class_bind_template_callback (widget_class, format_compression);
   gtk_widget_class_bind_template_callback (widget_class, preview_changed);
   gtk_widget_class_bind_template_callback (widget_class, selected_group_changed);
   gtk_widget_class_bind_template_callback (widget_class, decache_and_inspect_cb);
@@ -488,6 +620,138 @@ err:
   return dex_future_new_for_error (g_steal_pointer (&local_error));
 }
 
+static DexFuture *
+cache_benchmark_fiber (BzInspector *self)
+{
+  g_autoptr (GError) local_error        = NULL;
+  g_autoptr (BzEntryCacheManager) cache = NULL;
+  g_autoptr (GHashTable) cached_set     = NULL;
+  g_autoptr (BenchmarkData) data        = NULL;
+  g_autoptr (GPtrArray) workers         = NULL;
+  g_autoptr (GTimer) timer              = NULL;
+  g_autofree char *report               = NULL;
+  GHashTableIter iter                   = { 0 };
+  double         elapsed                = 0.0;
+
+  if (self->state == NULL)
+    return dex_future_new_false ();
+  cache = bz_state_info_get_cache_manager (self->state);
+  if (cache == NULL)
+    return dex_future_new_false ();
+  g_object_ref (cache);
+
+  gtk_widget_set_sensitive (GTK_WIDGET (self->cache_benchmark_btn), FALSE);
+  gtk_label_set_label (self->cache_benchmark_label, "Running...");
+
+  cached_set = dex_await_boxed (
+      bz_entry_cache_manager_enumerate_disk (cache),
+      &local_error);
+  if (cached_set == NULL)
+    goto err;
+  if (g_hash_table_size (cached_set) == 0)
+    {
+      local_error = g_error_new (
+          G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+          "The entry cache is empty");
+      goto err;
+    }
+
+  data            = benchmark_data_new ();
+  data->cache     = g_object_ref (cache);
+  data->checksums = g_ptr_array_new_with_free_func (g_free);
+
+  g_hash_table_iter_init (&iter, cached_set);
+  for (;;)
+    {
+      const char *checksum = NULL;
+
+      if (!g_hash_table_iter_next (&iter, (gpointer *) &checksum, NULL))
+        break;
+      g_ptr_array_add (data->checksums, g_strdup (checksum));
+    }
+
+  /* Every worker runs on the thread pool so they really
+   * do compete for the cache at the same time
+   */
+  workers = g_ptr_array_new_with_free_func (dex_unref);
+  timer   = g_timer_new ();
+  for (guint i = 0; i < BENCHMARK_FIBERS; i++)
+    g_ptr_array_add (
+        workers,
+        dex_scheduler_spawn (
+            bz_get_io_scheduler (),
+            bz_get_dex_stack_size (),
+            (DexFiberFunc) benchmark_worker_fiber,
+            benchmark_data_ref (data),
+            benchmark_data_unref));
+  dex_await (dex_future_allv (
+                 (DexFuture *const *) workers->pdata,
+                 workers->len),
+             NULL);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  report = g_strdup_printf (
+      "%d fibers over %u entries: %d gets and %d adds "
+      "(%d failed) in %.3f seconds, %.0f operations per second",
+      BENCHMARK_FIBERS, data->checksums->len,
+      g_atomic_int_get (&data->gets),
+      g_atomic_int_get (&data->adds),
+      g_atomic_int_get (&data->failures),
+      elapsed,
+      (g_atomic_int_get (&data->gets) + g_atomic_int_get (&data->adds)) / MAX (elapsed, 0.000001));
+  g_debug ("Entry cache benchmark: %s", report);
+
+  gtk_label_set_label (self->cache_benchmark_label, report);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->cache_benchmark_btn), TRUE);
+  return dex_future_new_true ();
+
+err:
+  gtk_label_set_label (self->cache_benchmark_label, local_error->message);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->cache_benchmark_btn), TRUE);
+  return dex_future_new_for_error (g_steal_pointer (&local_error));
+}
+
+static DexFuture *
+benchmark_worker_fiber (BenchmarkData *data)
+{
+  guint seed = 0;
+
+  seed = g_atomic_int_add (&data->next_seed, 1);
+  for (guint i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+      const char *checksum           = NULL;
+      g_autoptr (BzEntry) entry      = NULL;
+      g_autoptr (GError) local_error = NULL;
+
+      /* Stride through the set so workers overlap on
+       * some checksums but mostly touch their own
+       */
+      checksum = g_ptr_array_index (
+          data->checksums,
+          (seed * 7919 + i * 31) % data->checksums->len);
+
+      entry = dex_await_object (
+          bz_entry_cache_manager_get_by_checksum (data->cache, checksum),
+          &local_error);
+      g_atomic_int_inc (&data->gets);
+      if (entry == NULL)
+        {
+          g_atomic_int_inc (&data->failures);
+          continue;
+        }
+
+      /* Entries held by the UI can't be written back */
+      if (i % 4 == 0 && !bz_entry_is_holding (entry))
+        {
+          if (!dex_await (bz_entry_cache_manager_add (data->cache, entry), NULL))
+            g_atomic_int_inc (&data->failures);
+          g_atomic_int_inc (&data->adds);
+        }
+    }
+
+  return dex_future_new_true ();
+}
+
 static gboolean
 filter_func (BzEntryGroup *group,
              BzInspector  *self)
@@ -0,0 +1,55 @@
+/* bz-refresh-delta.h
+ *
+ * Copyright 2026 agent
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* When started with BZ_REFRESH_DELTA_ARG, the refresh worker
+ * writes a frame on stdout for every entry that differs from
+ * what was cached before it ran, as soon as it knows. Each
+ * frame is a BzRefreshDeltaFrame in host byte order followed
+ * by the unique id checksum and the entry serialized as a
+ * vardict, which is empty for removed entries. The digest is
+ * bz_entry_cache_manager_digest() of the serialized entry.
+ */
+#define BZ_REFRESH_DELTA_ARG "--emit-deltas"
+
+/* Anything longer is a corrupt frame */
+#define BZ_REFRESH_DELTA_MAX_CHECKSUM 256
+
+typedef enum
+{
+  BZ_REFRESH_DELTA_KIND_ADDED = 0,
+  BZ_REFRESH_DELTA_KIND_CHANGED,
+  BZ_REFRESH_DELTA_KIND_REMOVED,
+} BzRefreshDeltaKind;
+
+typedef struct
+{
+  guint32 kind;
+  guint32 checksum_length;
+  guint64 digest;
+  guint64 length;
+} BzRefreshDeltaFrame;
+
+G_END_DECLS
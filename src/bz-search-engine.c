@@ -20,11 +20,16 @@
 
 #define G_LOG_DOMAIN "BAZAAR::SEARCH-ENGINE"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
 #include "bz-search-engine.h"
 #include "bz-entry-group.h"
 #include "bz-env.h"
 #include "bz-finished-search-query.h"
-#include "bz-search-result.h"
+#include "bz-search-result-model.h"
 #include "bz-util.h"
 
 struct _BzSearchEngine
@@ -35,6 +40,44 @@ struct _BzSearchEngine
   GListModel *biases;
 
   GPtrArray *biases_mirror;
+
+  /* Inverted trigram index over the searchable fields of every group in
+     `model`, kept in sync with items-changed and group notifications so that
+     queries only need to score groups which could possibly match */
+  GPtrArray  *docs;
+  GHashTable *doc_ids;
+  GHashTable *appids;
+  GHashTable *index;
+  GHashTable *dirty_docs;
+  guint       next_doc_id;
+  guint       reindex_idle;
+
+  /* Bumped whenever positions or match results computed earlier may have
+     become stale */
+  guint model_generation;
+  guint biases_generation;
+
+  /* What the last unrestricted query could have matched, so that a query
+     which only narrows it down (typing another character) can skip
+     everything else */
+  gpointer last_refine;
+
+  /* Immutable view of every corpus in model order, republished from the
+     reindex idle whenever it falls behind `model_generation`. Only the main
+     thread touches this pointer; queries take their own reference and hand
+     it to the worker, so they never take any locks */
+  gpointer snapshot;
+
+  /* Recently finished queries keyed by interpreted query, generations and
+     result bound, most recently used at the head of `cache_lru` */
+  GHashTable *cache;
+  GQueue      cache_lru;
+  guint       cache_model_generation;
+  guint       cache_biases_generation;
+  guint       cache_hits;
+  guint       cache_misses;
+
+  gboolean fuzzy;
 };
 
 G_DEFINE_FINAL_TYPE (BzSearchEngine, bz_search_engine, G_TYPE_OBJECT);
@@ -45,6 +88,9 @@ enum
 
   PROP_MODEL,
   PROP_BIASES,
+  PROP_CACHE_HITS,
+  PROP_CACHE_MISSES,
+  PROP_FUZZY,
 
   LAST_PROP
 };
@@ -57,10 +103,16 @@ biases_changed (BzSearchEngine *self,
                 guint           added,
                 GListModel     *model);
 
-static double
-test_strings (const char *query,
-              const char *against,
-              gssize      accept_min_size);
+static void
+model_changed (BzSearchEngine *self,
+               guint           position,
+               guint           removed,
+               guint           added,
+               GListModel     *model);
+
+static GPtrArray *
+activate_biases (GPtrArray *biases,
+                 char     **query_utf8);
 
 typedef struct
 {
@@ -72,6 +124,11 @@ static gint
 cmp_scores (Score *a,
             Score *b);
 
+static void
+score_heap_push (GArray      *heap,
+                 const Score *score,
+                 guint        capacity);
+
 enum
 {
   LINEAR,
@@ -105,58 +162,448 @@ BZ_DEFINE_DATA (
     BZ_RELEASE_DATA (convert_to, g_free);
     BZ_RELEASE_DATA (boost, g_hash_table_unref));
 
+enum
+{
+  FIELD_TITLE,
+  FIELD_DEVELOPER,
+  FIELD_DESCRIPTION,
+  FIELD_SEARCH_TOKENS,
+
+  N_FIELDS
+};
+
+/* Casefolded, NFKD-normalized and mark-stripped text, split into tokens
+   ahead of time. The per-token arrays and the text live in one allocation
+   (`arena`) so the scoring loop only ever walks flat memory. The text of each
+   field is its tokens joined by single spaces and terminated by a NUL, and
+   the arena is padded past the text so vector loads may overrun it. An
+   immutable corpus is created whenever a group's searchable fields change. */
+BZ_DEFINE_DATA (
+    search_corpus,
+    SearchCorpus,
+    {
+      BzEntryGroup *group;
+      char         *id;
+      gboolean      searchable;
+      guint         n_fields;
+      guint         n_tokens;
+      guint         field_tokens[N_FIELDS + 1];
+      guint         field_bytes[N_FIELDS + 1];
+      guint32      *tok_offsets;
+      guint32      *tok_bytes;
+      guint32      *tok_chars;
+      guint8       *tok_flags;
+      char         *text;
+      gpointer      arena;
+    },
+    BZ_RELEASE_DATA (group, g_object_unref);
+    BZ_RELEASE_DATA (id, g_free);
+    BZ_RELEASE_DATA (arena, g_free));
+
+enum
+{
+  TOKEN_FLAG_ASCII = 1 << 0,
+};
+
+/* Widest vector load of the substring kernels */
+#define CORPUS_PADDING 32
+
+typedef const char *(*FindSubstringFunc) (const char *haystack,
+                                          gsize       haystack_len,
+                                          const char *needle,
+                                          gsize       needle_len);
+
+/* Chosen once in class_init */
+static FindSubstringFunc find_substring_kernel = NULL;
+
+static SearchCorpus *
+search_corpus_new_for_group (BzEntryGroup *group);
+
+static SearchCorpus *
+search_corpus_new_for_query (const char *query_utf8);
+
+static void
+search_corpus_build (SearchCorpus      *corpus,
+                     const char *const *fields,
+                     guint              n_fields);
+
+static char *
+fold_string (const char *string);
+
+static double
+test_strings (const SearchCorpus *query,
+              const SearchCorpus *against,
+              guint               field,
+              gssize              accept_min_size);
+
+static double
+test_strings_with (const SearchCorpus *query,
+                   const SearchCorpus *against,
+                   guint               field,
+                   gssize              accept_min_size,
+                   FindSubstringFunc   kernel);
+
+static gboolean
+field_equals (const SearchCorpus *query,
+              const SearchCorpus *against,
+              guint               field);
+
+static gboolean
+field_contains_all (const SearchCorpus *query,
+                    const SearchCorpus *against,
+                    guint               field);
+
+BZ_DEFINE_DATA (
+    search_doc,
+    SearchDoc,
+    {
+      BzSearchEngine *engine;
+      gulong          notify_handler;
+      guint           doc_id;
+      guint           position;
+      SearchCorpus   *corpus;
+      GArray         *grams;
+    },
+    BZ_RELEASE_DATA (corpus, search_corpus_data_unref);
+    BZ_RELEASE_DATA (grams, g_array_unref));
+
+static SearchDoc *
+attach_doc (BzSearchEngine *self,
+            BzEntryGroup   *group);
+
+static void
+detach_doc (BzSearchEngine *self,
+            SearchDoc      *doc);
+
+static void
+index_doc (BzSearchEngine *self,
+           SearchDoc      *doc);
+
+static void
+unindex_doc (BzSearchEngine *self,
+             SearchDoc      *doc);
+
+static void
+flush_dirty_docs (BzSearchEngine *self);
+
+static void
+schedule_reindex (BzSearchEngine *self);
+
+static void
+group_notify (SearchDoc    *doc,
+              GParamSpec   *pspec,
+              BzEntryGroup *group);
+
+static gboolean
+reindex_idle_cb (BzSearchEngine *self);
+
+static void
+clear_docs (BzSearchEngine *self);
+
+static GArray *
+lookup_candidates (BzSearchEngine     *self,
+                   const SearchCorpus *query,
+                   GPtrArray          *active_biases);
+
+static void
+append_corpus_grams (GArray             *grams,
+                     const SearchCorpus *corpus);
+
+static void
+append_string_grams (GArray     *grams,
+                     const char *string);
+
+static void
+sort_and_dedup_guint64 (GArray *array);
+
+static gboolean
+posting_find (GArray *posting,
+              guint   doc_id,
+              guint  *idx_out);
+
+static gint
+cmp_guint64 (const guint64 *a,
+             const guint64 *b);
+
+static gint
+cmp_guint (const guint *a,
+           const guint *b);
+
+static gint
+cmp_postings_by_length (GArray **a,
+                        GArray **b);
+
+/* Every group a query could have matched, as sorted model positions: those
+   whose fields contain all of the query tokens (ignoring the minimum token
+   sizes), exact matches and boosted groups. A later query in which every
+   token contains a token of this one can only match these groups, provided
+   neither the model nor the biases changed in between. `survivors` is
+   written by the query fiber before `complete` is set */
+BZ_DEFINE_DATA (
+    refine_state,
+    RefineState,
+    {
+      SearchCorpus *query;
+      GPtrArray    *active_biases;
+      guint         model_generation;
+      guint         biases_generation;
+      GArray       *survivors;
+      int           complete;
+    },
+    BZ_RELEASE_DATA (query, search_corpus_data_unref);
+    BZ_RELEASE_DATA (active_biases, g_ptr_array_unref);
+    BZ_RELEASE_DATA (survivors, g_array_unref));
+
+#define QUERY_CACHE_SIZE 32
+
+BZ_DEFINE_DATA (
+    cache_entry,
+    CacheEntry,
+    {
+      char                  *key;
+      BzFinishedSearchQuery *finished;
+      GList                 *link;
+    },
+    BZ_RELEASE_DATA (key, g_free);
+    BZ_RELEASE_DATA (finished, g_object_unref));
+
+BZ_DEFINE_DATA (
+    cache_store,
+    CacheStore,
+    {
+      GWeakRef *self;
+      char     *key;
+      guint     model_generation;
+      guint     biases_generation;
+    },
+    BZ_RELEASE_DATA (self, bz_weak_release);
+    BZ_RELEASE_DATA (key, g_free));
+static DexFuture *
+cache_store_then (DexFuture      *future,
+                  CacheStoreData *data);
+
+static void
+validate_cache (BzSearchEngine *self);
+
+static void
+clear_cache (BzSearchEngine *self);
+
+static DexFuture *
+start_query (BzSearchEngine    *self,
+             const char *const *terms,
+             const char *const *previous_ids,
+             guint              max_results);
+
+static gboolean
+can_refine (BzSearchEngine *self,
+            RefineState    *last,
+            SearchCorpus   *query,
+            GPtrArray      *active_biases);
+
+static GArray *
+intersect_positions (GArray *a,
+                     GArray *b);
+
+static void
+sort_and_dedup_guint (GArray *array);
+
+BZ_DEFINE_DATA (
+    search_snapshot,
+    SearchSnapshot,
+    {
+      GPtrArray *corpora;
+      guint      generation;
+    },
+    BZ_RELEASE_DATA (corpora, g_ptr_array_unref));
+
+static void
+publish_snapshot (BzSearchEngine *self);
+
+static SearchSnapshot *
+acquire_snapshot (BzSearchEngine *self);
+
+enum
+{
+  PASS_EXACT,
+  PASS_FUZZY,
+};
+
+/* The fuzzy pass only runs if the exact pass found fewer matches than
+   this, and only tolerates typos in ASCII tokens of at least
+   `FUZZY_MIN_TOKEN_LENGTH` characters; longer tokens tolerate more */
+#define FUZZY_MIN_MATCHES      5
+#define FUZZY_MIN_TOKEN_LENGTH 4
+#define FUZZY_LONG_TOKEN       8
+#define FUZZY_PENALTY          0.5
+
+static const struct
+{
+  guint  field;
+  double weight;
+} fuzzy_fields[] = {
+  { FIELD_TITLE, 2.0 },
+  { FIELD_DEVELOPER, 1.0 },
+  { FIELD_SEARCH_TOKENS, 1.5 },
+};
+
+/* Myers' bit-vector approximate matcher for one query token; a `length` of
+   0 means the token has to occur exactly */
+typedef struct
+{
+  guint64 peq[256];
+  guint   length;
+  guint   max_errors;
+} FuzzyPattern;
+
 BZ_DEFINE_DATA (
     query_task,
     QueryTask,
     {
-      char     **terms;
-      GPtrArray *snapshot;
-      GPtrArray *biases;
+      char           *query_utf8;
+      SearchCorpus   *query;
+      SearchSnapshot *snapshot;
+      GArray         *indices;
+      GArray         *allowed;
+      GPtrArray      *active_biases;
+      RefineState    *refine;
+      guint           max_results;
+      gboolean        fuzzy;
+      gboolean        inline_only;
+      FuzzyPattern   *patterns;
+      GArray         *exact_hits;
+      int             pass;
+      guint           n_work;
+      int             next_chunk;
+      int             cancelled;
     },
-    BZ_RELEASE_DATA (terms, g_strfreev);
-    BZ_RELEASE_DATA (snapshot, g_ptr_array_unref);
-    BZ_RELEASE_DATA (biases, g_ptr_array_unref))
+    BZ_RELEASE_DATA (query_utf8, g_free);
+    BZ_RELEASE_DATA (query, search_corpus_data_unref);
+    BZ_RELEASE_DATA (snapshot, search_snapshot_data_unref);
+    BZ_RELEASE_DATA (indices, g_array_unref);
+    BZ_RELEASE_DATA (allowed, g_array_unref);
+    BZ_RELEASE_DATA (active_biases, g_ptr_array_unref);
+    BZ_RELEASE_DATA (refine, refine_state_data_unref);
+    BZ_RELEASE_DATA (patterns, g_free);
+    BZ_RELEASE_DATA (exact_hits, g_array_unref))
 static DexFuture *
 query_task_fiber (QueryTaskData *data);
 
+static DexFuture *
+query_watch_finally (DexFuture     *future,
+                     QueryTaskData *data);
+
+static void
+cancel_query_task (QueryTaskData *data);
+
+/* Candidates are scored in chunks of this many, and searches with at most
+   `INLINE_WORK_LIMIT` candidates are scored without any threads at all */
+#define WORK_CHUNK_SIZE   64
+#define INLINE_WORK_LIMIT 256
+
 BZ_DEFINE_DATA (
     query_sub_task,
     QuerySubTask,
     {
-      char      *query_utf8;
-      GPtrArray *shallow_mirror;
-      double     threshold;
-      guint      work_offset;
-      guint      work_length;
-      GPtrArray *active_biases;
+      QueryTaskData *task;
+      GArray        *scores_out;
+      GArray        *survivors_out;
+      guint          n_matches_out;
+      guint          n_chunks_out;
+      gint64         busy_usec_out;
     },
-    BZ_RELEASE_DATA (query_utf8, g_free);
-    BZ_RELEASE_DATA (shallow_mirror, g_ptr_array_unref);
-    BZ_RELEASE_DATA (active_biases, g_ptr_array_unref));
+    BZ_RELEASE_DATA (task, query_task_data_unref);
+    BZ_RELEASE_DATA (scores_out, g_array_unref);
+    BZ_RELEASE_DATA (survivors_out, g_array_unref));
 static DexFuture *
 query_sub_task_fiber (QuerySubTaskData *data);
 
+static QuerySubTaskData *
+query_sub_task_data_new_for_task (QueryTaskData *task);
+
+static void
+score_range (QueryTaskData    *task,
+             QuerySubTaskData *out,
+             guint             work_offset,
+             guint             work_length);
+
+static GPtrArray *
+run_pass (QueryTaskData *data,
+          int            pass,
+          guint          n_work,
+          GError       **error);
+
+static gboolean
+prepare_fuzzy_patterns (QueryTaskData *data);
+
+static void
+score_range_fuzzy (QueryTaskData    *task,
+                   QuerySubTaskData *out,
+                   guint             work_offset,
+                   guint             work_length);
+
+static gboolean
+fuzzy_match_field (const SearchCorpus *query,
+                   const FuzzyPattern *patterns,
+                   const SearchCorpus *against,
+                   guint               field,
+                   double             *score_out,
+                   guint              *errors_out);
+
+static guint
+myers_search (const FuzzyPattern *pattern,
+              const char         *text,
+              gsize               text_len);
+
 static inline GUnicodeType
 utf8_char_class (const char *s,
                  gunichar   *ch_out);
 
-static inline const char *
-utf8_skip_to_next_of_class (const char **s,
-                            GUnicodeType class,
-                            gsize       *read_utf8);
+static const char *
+find_substring (const char *haystack,
+                gsize       haystack_len,
+                const char *needle,
+                gsize       needle_len);
+
+#ifdef HAVE_X86_KERNELS
+static const char *
+find_substring_sse2 (const char *haystack,
+                     gsize       haystack_len,
+                     const char *needle,
+                     gsize       needle_len);
+
+__attribute__ ((target ("avx2"))) static const char *
+find_substring_avx2 (const char *haystack,
+                     gsize       haystack_len,
+                     const char *needle,
+                     gsize       needle_len);
+#endif
 
 static void
 bz_search_engine_dispose (GObject *object)
 {
   BzSearchEngine *self = BZ_SEARCH_ENGINE (object);
 
+  if (self->model != NULL)
+    g_signal_handlers_disconnect_by_func (self->model, model_changed, self);
   if (self->biases != NULL)
     g_signal_handlers_disconnect_by_func (self->biases, biases_changed, self);
 
+  clear_docs (self);
+  g_clear_handle_id (&self->reindex_idle, g_source_remove);
+
   g_clear_object (&self->model);
   g_clear_object (&self->biases);
 
   g_clear_pointer (&self->biases_mirror, g_ptr_array_unref);
+  g_clear_pointer (&self->last_refine, refine_state_data_unref);
+  g_clear_pointer (&self->snapshot, search_snapshot_data_unref);
+  g_clear_pointer (&self->docs, g_ptr_array_unref);
+  g_clear_pointer (&self->doc_ids, g_hash_table_unref);
+  g_clear_pointer (&self->appids, g_hash_table_unref);
+  g_clear_pointer (&self->index, g_hash_table_unref);
+  g_clear_pointer (&self->dirty_docs, g_hash_table_unref);
+  clear_cache (self);
+  g_clear_pointer (&self->cache, g_hash_table_unref);
 
   G_OBJECT_CLASS (bz_search_engine_parent_class)->dispose (object);
 }
@@ -177,6 +624,15 @@ bz_search_engine_get_property (GObject    *object,
     case PROP_BIASES:
       g_value_set_object (value, bz_search_engine_get_biases (self));
       break;
+    case PROP_CACHE_HITS:
+      g_value_set_uint (value, bz_search_engine_get_cache_hits (self));
+      break;
+    case PROP_CACHE_MISSES:
+      g_value_set_uint (value, bz_search_engine_get_cache_misses (self));
+      break;
+    case PROP_FUZZY:
+      g_value_set_boolean (value, bz_search_engine_get_fuzzy (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -198,6 +654,9 @@ bz_search_engine_set_property (GObject      *object,
     case PROP_BIASES:
       bz_search_engine_set_biases (self, g_value_get_object (value));
       break;
+    case PROP_FUZZY:
+      bz_search_engine_set_fuzzy (self, g_value_get_boolean (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -226,13 +685,53 @@ bz_search_engine_class_init (BzSearchEngineClass *klass)
           G_TYPE_LIST_MODEL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
 
+  props[PROP_CACHE_HITS] =
+      g_param_spec_uint (
+          "cache-hits",
+          NULL, NULL,
+          0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_CACHE_MISSES] =
+      g_param_spec_uint (
+          "cache-misses",
+          NULL, NULL,
+          0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  props[PROP_FUZZY] =
+      g_param_spec_boolean (
+          "fuzzy",
+          NULL, NULL,
+          TRUE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (object_class, LAST_PROP, props);
+
+  find_substring_kernel = find_substring;
+#ifdef HAVE_X86_KERNELS
+  find_substring_kernel = find_substring_sse2;
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    find_substring_kernel = find_substring_avx2;
+#endif
 }
 
 static void
 bz_search_engine_init (BzSearchEngine *self)
 {
   self->biases_mirror = g_ptr_array_new_with_free_func (bias_data_unref);
+
+  self->docs       = g_ptr_array_new_with_free_func (search_doc_data_unref);
+  self->doc_ids    = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->appids     = g_hash_table_new (g_str_hash, g_str_equal);
+  self->index      = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, (GDestroyNotify) g_array_unref);
+  self->dirty_docs = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  self->cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cache_entry_data_unref);
+  g_queue_init (&self->cache_lru);
+
+  self->fuzzy = TRUE;
 }
 
 BzSearchEngine *
@@ -259,6 +758,7 @@ bz_search_engine_set_biases (BzSearchEngine *self,
     g_signal_handlers_disconnect_by_func (self->biases, biases_changed, self);
   g_clear_object (&self->biases);
   g_ptr_array_set_size (self->biases_mirror, 0);
+  self->biases_generation++;
 
   if (biases != NULL)
     {
@@ -291,9 +791,24 @@ bz_search_engine_set_model (BzSearchEngine *self,
   g_return_if_fail (BZ_IS_SEARCH_ENGINE (self));
   g_return_if_fail (model == NULL || G_IS_LIST_MODEL (model));
 
+  if (self->model != NULL)
+    g_signal_handlers_disconnect_by_func (self->model, model_changed, self);
   g_clear_object (&self->model);
+  clear_docs (self);
+
   if (model != NULL)
-    self->model = g_object_ref (model);
+    {
+      guint n_items = 0;
+
+      self->model = g_object_ref (model);
+
+      n_items = g_list_model_get_n_items (model);
+      model_changed (self, 0, 0, n_items, model);
+
+      g_signal_connect_swapped (
+          model, "items-changed",
+          G_CALLBACK (model_changed), self);
+    }
 
   g_object_notify_by_pspec (G_OBJECT (self), props[PROP_MODEL]);
 }
@@ -302,11 +817,163 @@ DexFuture *
 bz_search_engine_query (BzSearchEngine    *self,
                         const char *const *terms)
 {
-  guint n_groups = 0;
+  dex_return_error_if_fail (BZ_IS_SEARCH_ENGINE (self));
+  dex_return_error_if_fail (terms != NULL && *terms != NULL);
+
+  return start_query (self, terms, NULL, 0);
+}
+
+gboolean
+bz_search_engine_get_fuzzy (BzSearchEngine *self)
+{
+  g_return_val_if_fail (BZ_IS_SEARCH_ENGINE (self), FALSE);
+  return self->fuzzy;
+}
+
+void
+bz_search_engine_set_fuzzy (BzSearchEngine *self,
+                            gboolean        fuzzy)
+{
+  g_return_if_fail (BZ_IS_SEARCH_ENGINE (self));
+
+  if (!!fuzzy == self->fuzzy)
+    return;
+  self->fuzzy = !!fuzzy;
+
+  /* Cached results were computed with the other setting */
+  clear_cache (self);
 
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_FUZZY]);
+}
+
+guint
+bz_search_engine_get_cache_hits (BzSearchEngine *self)
+{
+  g_return_val_if_fail (BZ_IS_SEARCH_ENGINE (self), 0);
+  return self->cache_hits;
+}
+
+guint
+bz_search_engine_get_cache_misses (BzSearchEngine *self)
+{
+  g_return_val_if_fail (BZ_IS_SEARCH_ENGINE (self), 0);
+  return self->cache_misses;
+}
+
+DexFuture *
+bz_search_engine_refine_query (BzSearchEngine    *self,
+                               const char *const *terms,
+                               const char *const *previous_ids,
+                               guint              max_results)
+{
   dex_return_error_if_fail (BZ_IS_SEARCH_ENGINE (self));
   dex_return_error_if_fail (terms != NULL && *terms != NULL);
 
+  return start_query (self, terms, previous_ids, max_results);
+}
+
+/* Times the substring kernels against the current corpus
+ * for the inspector. Must be called on the main thread.
+ */
+char *
+bz_search_engine_benchmark_kernels (BzSearchEngine    *self,
+                                    const char *const *queries,
+                                    guint              n_passes)
+{
+  g_autoptr (SearchSnapshot) snapshot = NULL;
+  g_autoptr (GPtrArray) corpora       = NULL;
+  g_autoptr (GString) report          = NULL;
+  struct
+  {
+    const char       *name;
+    FindSubstringFunc kernel;
+  } kernels[4]    = { 0 };
+  guint n_kernels = 0;
+  /* Same fields and minimum sizes as score_range_fuzzy */
+  const struct
+  {
+    guint  field;
+    gssize accept_min_size;
+  } fields[] = {
+    {         FIELD_TITLE,  2 },
+    {     FIELD_DEVELOPER,  2 },
+    {   FIELD_DESCRIPTION,  3 },
+    { FIELD_SEARCH_TOKENS, -1 },
+  };
+
+  g_return_val_if_fail (BZ_IS_SEARCH_ENGINE (self), NULL);
+  g_return_val_if_fail (queries != NULL, NULL);
+
+  flush_dirty_docs (self);
+  snapshot = acquire_snapshot (self);
+
+  corpora = g_ptr_array_new_with_free_func (search_corpus_data_unref);
+  for (const char *const *query = queries; *query != NULL; query++)
+    g_ptr_array_add (corpora, search_corpus_new_for_query (*query));
+
+  /* NULL runs every token through the scalar per token path */
+  kernels[n_kernels++] = (typeof (kernels[0])) { "scalar, per token", NULL };
+  kernels[n_kernels++] = (typeof (kernels[0])) { "scalar, whole field", find_substring };
+#ifdef HAVE_X86_KERNELS
+  kernels[n_kernels++] = (typeof (kernels[0])) { "SSE2, whole field", find_substring_sse2 };
+  if (__builtin_cpu_supports ("avx2"))
+    kernels[n_kernels++] = (typeof (kernels[0])) { "AVX2, whole field", find_substring_avx2 };
+#endif
+
+  report = g_string_new (NULL);
+  g_string_append_printf (
+      report, "%u groups, %u queries, %u passes",
+      snapshot->corpora->len, corpora->len, n_passes);
+
+  for (guint k = 0; k < n_kernels; k++)
+    {
+      guint  matches = 0;
+      gint64 start   = 0;
+      gint64 elapsed = 0;
+
+      start = g_get_monotonic_time ();
+      for (guint pass = 0; pass < n_passes; pass++)
+        {
+          for (guint q = 0; q < corpora->len; q++)
+            {
+              SearchCorpus *query = g_ptr_array_index (corpora, q);
+
+              for (guint i = 0; i < snapshot->corpora->len; i++)
+                {
+                  SearchCorpus *corpus = g_ptr_array_index (snapshot->corpora, i);
+
+                  for (guint f = 0; f < G_N_ELEMENTS (fields); f++)
+                    {
+                      if (test_strings_with (
+                              query, corpus,
+                              fields[f].field,
+                              fields[f].accept_min_size,
+                              kernels[k].kernel) > 0.0)
+                        matches++;
+                    }
+                }
+            }
+        }
+      elapsed = g_get_monotonic_time () - start;
+
+      g_string_append_printf (
+          report, "\n%s: %.2f ms per pass, %u matching fields",
+          kernels[k].name,
+          (double) elapsed / 1000.0 / MAX (n_passes, 1),
+          matches / MAX (n_passes, 1));
+    }
+
+  return g_string_free (g_steal_pointer (&report), FALSE);
+}
+
+static DexFuture *
+start_query (BzSearchEngine    *self,
+             const char *const *terms,
+             const char *const *previous_ids,
+             guint              max_results)
+{
+  guint n_groups = 0;
+
   if (self->model != NULL)
     n_groups = g_list_model_get_n_items (self->model);
 
@@ -314,24 +981,22 @@ bz_search_engine_query (BzSearchEngine    *self,
       n_groups == 0 ||
       **terms == '\0')
     {
-      g_autoptr (GPtrArray) results              = NULL;
+      guint n_hits                               = 0;
+      g_autoptr (GArray) hits                    = NULL;
+      g_autoptr (BzSearchResultModel) results    = NULL;
       g_autoptr (BzFinishedSearchQuery) finished = NULL;
 
-      results = g_ptr_array_new_with_free_func (g_object_unref);
-      g_ptr_array_set_size (results, n_groups);
-
-      for (guint i = 0; i < results->len; i++)
+      n_hits = max_results > 0 ? MIN (n_groups, max_results) : n_groups;
+      hits   = bz_search_hit_array_new (n_hits);
+      for (guint i = 0; i < n_hits; i++)
         {
-          g_autoptr (BzEntryGroup) group    = NULL;
-          g_autoptr (BzSearchResult) result = NULL;
-
-          group = g_list_model_get_item (self->model, i);
+          BzSearchHit hit = { 0 };
 
-          result = bz_search_result_new ();
-          bz_search_result_set_group (result, group);
-          bz_search_result_set_original_index (result, i);
-          g_ptr_array_index (results, i) = g_steal_pointer (&result);
+          hit.group          = g_list_model_get_item (self->model, i);
+          hit.original_index = i;
+          g_array_append_val (hits, hit);
         }
+      results = bz_search_result_model_new (hits);
 
       finished = bz_finished_search_query_new ();
       bz_finished_search_query_set_interpreted_query (finished, "");
@@ -343,25 +1008,172 @@ bz_search_engine_query (BzSearchEngine    *self,
     }
   else
     {
-      g_autoptr (GPtrArray) snapshot = NULL;
-      g_autoptr (QueryTaskData) data = NULL;
+      g_autofree char *query_utf8        = NULL;
+      g_autoptr (GPtrArray) active_biases = NULL;
+      g_autoptr (SearchCorpus) query      = NULL;
+      g_autoptr (GArray) indices          = NULL;
+      g_autoptr (GArray) allowed          = NULL;
+      RefineState *last                   = NULL;
+      g_autoptr (RefineState) refine      = NULL;
+      g_autoptr (SearchSnapshot) snapshot = NULL;
+      g_autoptr (QueryTaskData) data      = NULL;
+      g_autofree char *cache_key          = NULL;
+      guint n_work                        = 0;
+      g_autoptr (DexFuture) future        = NULL;
+
+      query_utf8    = g_strjoinv (" ", (gchar **) terms);
+      active_biases = activate_biases (self->biases_mirror, &query_utf8);
+      query         = search_corpus_new_for_query (query_utf8);
+
+      flush_dirty_docs (self);
+
+      /* Results restricted to a caller's previous ids aren't reusable */
+      if (previous_ids == NULL || *previous_ids == NULL)
+        {
+          CacheEntry *entry = NULL;
+
+          validate_cache (self);
+          cache_key = g_strdup_printf (
+              "%u:%u:%u:%d:%s",
+              self->model_generation,
+              self->biases_generation,
+              max_results,
+              self->fuzzy,
+              query_utf8);
+
+          entry = g_hash_table_lookup (self->cache, cache_key);
+          if (entry != NULL)
+            {
+              g_queue_unlink (&self->cache_lru, entry->link);
+              g_queue_push_head_link (&self->cache_lru, entry->link);
 
-      snapshot = g_ptr_array_new_with_free_func (g_object_unref);
-      g_ptr_array_set_size (snapshot, n_groups);
+              self->cache_hits++;
+              g_object_notify_by_pspec (G_OBJECT (self), props[PROP_CACHE_HITS]);
 
-      for (guint i = 0; i < snapshot->len; i++)
-        g_ptr_array_index (snapshot, i) = g_list_model_get_item (self->model, i);
+              return dex_future_new_for_object (entry->finished);
+            }
 
-      data           = query_task_data_new ();
-      data->terms    = g_strdupv ((gchar **) terms);
-      data->snapshot = g_steal_pointer (&snapshot);
-      data->biases   = g_ptr_array_ref (self->biases_mirror);
+          self->cache_misses++;
+          g_object_notify_by_pspec (G_OBJECT (self), props[PROP_CACHE_MISSES]);
+        }
 
-      return dex_scheduler_spawn (
-          dex_thread_pool_scheduler_get_default (),
-          bz_get_dex_stack_size (),
-          (DexFiberFunc) query_task_fiber,
-          query_task_data_ref (data), query_task_data_unref);
+      indices = lookup_candidates (self, query, active_biases);
+
+      last = self->last_refine;
+      if (last != NULL &&
+          can_refine (self, last, query, active_biases))
+        {
+          g_autoptr (GArray) narrowed = NULL;
+          SearchDoc *exact            = NULL;
+
+          narrowed = intersect_positions (indices, last->survivors);
+
+          /* The appid exact match is the only way to match a group without
+             containing the previous query */
+          exact = g_hash_table_lookup (self->appids, query_utf8);
+          if (exact != NULL)
+            {
+              g_array_append_val (narrowed, exact->position);
+              sort_and_dedup_guint (narrowed);
+            }
+
+          g_clear_pointer (&indices, g_array_unref);
+          indices = g_steal_pointer (&narrowed);
+        }
+
+      if (previous_ids != NULL && *previous_ids != NULL)
+        {
+          g_autoptr (GArray) previous = NULL;
+          g_autoptr (GArray) narrowed = NULL;
+
+          /* The caller vouches that the new terms only narrow down a query
+             which yielded `previous_ids` */
+          previous = g_array_new (FALSE, FALSE, sizeof (guint));
+          for (const char *const *id = previous_ids; *id != NULL; id++)
+            {
+              SearchDoc *doc = NULL;
+
+              doc = g_hash_table_lookup (self->appids, *id);
+              if (doc != NULL)
+                g_array_append_val (previous, doc->position);
+            }
+          sort_and_dedup_guint (previous);
+
+          narrowed = intersect_positions (indices, previous);
+          g_clear_pointer (&indices, g_array_unref);
+          indices = g_steal_pointer (&narrowed);
+
+          /* The fuzzy pass ignores the candidate index, but it must
+             still stay inside this set */
+          allowed = g_steal_pointer (&previous);
+        }
+      else
+        {
+          /* Only unrestricted queries say anything about what later
+             queries could match */
+          refine                    = refine_state_data_new ();
+          refine->query             = search_corpus_data_ref (query);
+          refine->active_biases     = g_ptr_array_ref (active_biases);
+          refine->model_generation  = self->model_generation;
+          refine->biases_generation = self->biases_generation;
+
+          g_clear_pointer (&self->last_refine, refine_state_data_unref);
+          self->last_refine = refine_state_data_ref (refine);
+        }
+
+      snapshot = acquire_snapshot (self);
+
+      data                = query_task_data_new ();
+      data->query_utf8    = g_steal_pointer (&query_utf8);
+      data->query         = g_steal_pointer (&query);
+      data->snapshot      = g_steal_pointer (&snapshot);
+      data->indices       = g_steal_pointer (&indices);
+      data->allowed       = g_steal_pointer (&allowed);
+      data->active_biases = g_steal_pointer (&active_biases);
+      data->refine        = g_steal_pointer (&refine);
+      data->max_results   = max_results;
+      data->fuzzy         = self->fuzzy;
+
+      n_work = data->indices != NULL
+                   ? data->indices->len
+                   : data->snapshot->corpora->len;
+      if (n_work <= INLINE_WORK_LIMIT)
+        {
+          /* Not worth leaving the main thread for, unless it turns out a
+             fuzzy pass over everything is needed */
+          data->inline_only = TRUE;
+          future            = query_task_fiber (data);
+          data->inline_only = FALSE;
+        }
+      if (future == NULL)
+        future = dex_scheduler_spawn (
+            dex_thread_pool_scheduler_get_default (),
+            bz_get_dex_stack_size (),
+            (DexFiberFunc) query_task_fiber,
+            query_task_data_ref (data), query_task_data_unref);
+
+      if (cache_key != NULL)
+        {
+          g_autoptr (CacheStoreData) store = NULL;
+
+          store                    = cache_store_data_new ();
+          store->self              = bz_track_weak (self);
+          store->key               = g_steal_pointer (&cache_key);
+          store->model_generation  = self->model_generation;
+          store->biases_generation = self->biases_generation;
+
+          future = dex_future_then (
+              future, (DexFutureCallback) cache_store_then,
+              cache_store_data_ref (store), cache_store_data_unref);
+        }
+
+      /* Callers drop the future of a query they no longer care about, which
+         lets the workers stop at their next chunk */
+      future = dex_future_finally (
+          future, (DexFutureCallback) query_watch_finally,
+          query_task_data_ref (data), (GDestroyNotify) cancel_query_task);
+
+      return g_steal_pointer (&future);
     }
 }
 
@@ -509,193 +1321,457 @@ biases_changed (BzSearchEngine *self,
 
   g_clear_pointer (&self->biases_mirror, g_ptr_array_unref);
   self->biases_mirror = g_steal_pointer (&new_mirror);
+  self->biases_generation++;
 }
 
-static DexFuture *
-query_task_fiber (QueryTaskData *data)
+static void
+model_changed (BzSearchEngine *self,
+               guint           position,
+               guint           removed,
+               guint           added,
+               GListModel     *model)
 {
-  char     **terms                           = data->terms;
-  GPtrArray *shallow_mirror                  = data->snapshot;
-  GPtrArray *biases                          = data->biases;
-  g_autoptr (GError) local_error             = NULL;
-  gboolean result                            = FALSE;
-  g_autoptr (GTimer) timer                   = NULL;
-  g_autofree char *query_utf8                = NULL;
-  guint            n_sub_tasks               = 0;
-  guint            scores_per_task           = 0;
-  g_autoptr (GPtrArray) active_biases        = NULL;
-  g_autoptr (GPtrArray) sub_futures          = NULL;
-  g_autoptr (GArray) scores                  = NULL;
-  g_autoptr (GPtrArray) results              = NULL;
-  g_autoptr (BzFinishedSearchQuery) finished = NULL;
+  g_autoptr (GHashTable) recycle = NULL;
 
-  timer = g_timer_new ();
+  /* Filter models tend to emit huge removals followed by huge additions of
+     mostly the same groups, so hold on to removed docs in case we can reuse
+     them without touching the index */
+  recycle = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, search_doc_data_unref);
+  for (guint i = 0; i < removed; i++)
+    {
+      SearchDoc *doc = NULL;
 
-  query_utf8      = g_strjoinv (" ", terms);
-  n_sub_tasks     = MAX (1, MIN (shallow_mirror->len / 512, g_get_num_processors ()));
-  scores_per_task = shallow_mirror->len / n_sub_tasks;
+      doc = g_ptr_array_index (self->docs, position + i);
+      if (g_hash_table_contains (recycle, doc->corpus->group))
+        detach_doc (self, doc);
+      else
+        g_hash_table_replace (recycle, doc->corpus->group, search_doc_data_ref (doc));
+    }
+  if (removed > 0)
+    g_ptr_array_remove_range (self->docs, position, removed);
 
-  active_biases = g_ptr_array_new_with_free_func (bias_data_unref);
-  for (guint i = 0; i < biases->len; i++)
+  for (guint i = 0; i < added; i++)
     {
-      BiasData *bias = NULL;
+      g_autoptr (BzEntryGroup) group = NULL;
+      g_autoptr (SearchDoc) doc      = NULL;
 
-      bias = g_ptr_array_index (biases, i);
-      if (bias->invalid)
-        continue;
+      group = g_list_model_get_item (model, position + i);
 
-      if (!g_regex_match (bias->regex, query_utf8, G_REGEX_MATCH_DEFAULT, NULL))
-        continue;
+      if (!g_hash_table_steal_extended (recycle, group, NULL, (gpointer *) &doc))
+        doc = attach_doc (self, group);
 
-      if (bias->convert_to != NULL)
-        {
-          g_autofree char *tmp = NULL;
+      g_ptr_array_insert (self->docs, position + i, search_doc_data_ref (doc));
+    }
+
+  if (g_hash_table_size (recycle) > 0)
+    {
+      GHashTableIter iter = { 0 };
+
+      g_hash_table_iter_init (&iter, recycle);
+      for (SearchDoc *doc = NULL;
+           g_hash_table_iter_next (&iter, NULL, (gpointer *) &doc);)
+        detach_doc (self, doc);
+    }
+
+  for (guint i = position; i < self->docs->len; i++)
+    {
+      SearchDoc *doc = NULL;
+
+      doc           = g_ptr_array_index (self->docs, i);
+      doc->position = i;
+    }
+
+  self->model_generation++;
+  schedule_reindex (self);
+}
+
+static GPtrArray *
+activate_biases (GPtrArray *biases,
+                 char     **query_utf8)
+{
+  g_autoptr (GPtrArray) active_biases = NULL;
+
+  active_biases = g_ptr_array_new_with_free_func (bias_data_unref);
+  for (guint i = 0; i < biases->len; i++)
+    {
+      BiasData *bias = NULL;
+
+      bias = g_ptr_array_index (biases, i);
+      if (bias->invalid)
+        continue;
+
+      if (!g_regex_match (bias->regex, *query_utf8, G_REGEX_MATCH_DEFAULT, NULL))
+        continue;
+
+      if (bias->convert_to != NULL)
+        {
+          g_autofree char *tmp = NULL;
 
           tmp = g_regex_replace (
-              bias->regex, query_utf8,
+              bias->regex, *query_utf8,
               -1, 0, bias->convert_to,
               G_REGEX_MATCH_DEFAULT, NULL);
           if (tmp != NULL)
             {
-              g_clear_pointer (&query_utf8, g_free);
-              query_utf8 = g_steal_pointer (&tmp);
+              g_clear_pointer (query_utf8, g_free);
+              *query_utf8 = g_steal_pointer (&tmp);
             }
         }
 
       g_ptr_array_add (active_biases, bias_data_ref (bias));
     }
 
-  sub_futures = g_ptr_array_new_with_free_func (dex_unref);
-  for (guint i = 0; i < n_sub_tasks; i++)
+  return g_steal_pointer (&active_biases);
+}
+
+static DexFuture *
+query_task_fiber (QueryTaskData *data)
+{
+  char         *query_utf8                   = data->query_utf8;
+  GPtrArray    *corpora                      = data->snapshot->corpora;
+  GArray       *indices                      = data->indices;
+  GArray       *allowed                      = data->allowed;
+  RefineState  *refine                       = data->refine;
+  guint         max_results                  = data->max_results;
+  g_autoptr (GError) local_error             = NULL;
+  g_autoptr (GTimer) timer                   = NULL;
+  g_autoptr (GPtrArray) exact                = NULL;
+  g_autoptr (GPtrArray) fuzzy                = NULL;
+  guint n_matches                            = 0;
+  g_autoptr (GArray) scores                  = NULL;
+  g_autoptr (GArray) hits                    = NULL;
+  g_autoptr (BzSearchResultModel) results    = NULL;
+  g_autoptr (BzFinishedSearchQuery) finished = NULL;
+
+  timer = g_timer_new ();
+
+  exact = run_pass (
+      data, PASS_EXACT,
+      indices != NULL ? indices->len : corpora->len,
+      &local_error);
+  if (exact == NULL)
+    return dex_future_new_for_error (g_steal_pointer (&local_error));
+  if (g_atomic_int_get (&data->cancelled))
+    goto cancelled;
+
+  for (guint i = 0; i < exact->len; i++)
+    n_matches += ((QuerySubTaskData *) g_ptr_array_index (exact, i))->n_matches_out;
+
+  /* Typos make the exact pass come up (nearly) empty, and only then is it
+     worth looking at every group again */
+  if (data->fuzzy &&
+      n_matches < FUZZY_MIN_MATCHES &&
+      prepare_fuzzy_patterns (data))
+    {
+      if (data->inline_only &&
+          (allowed != NULL ? allowed->len : corpora->len) > INLINE_WORK_LIMIT)
+        /* Let the caller start over on a thread */
+        return NULL;
+
+      /* Groups the exact pass already scored must not show up twice */
+      data->exact_hits = g_array_new (FALSE, FALSE, sizeof (guint));
+      for (guint i = 0; i < exact->len; i++)
+        {
+          GArray *scores_out = NULL;
+
+          scores_out = ((QuerySubTaskData *) g_ptr_array_index (exact, i))->scores_out;
+          for (guint j = 0; j < scores_out->len; j++)
+            g_array_append_val (data->exact_hits, g_array_index (scores_out, Score, j).idx);
+        }
+      sort_and_dedup_guint (data->exact_hits);
+
+      fuzzy = run_pass (
+          data, PASS_FUZZY,
+          allowed != NULL ? allowed->len : corpora->len,
+          &local_error);
+      if (fuzzy == NULL)
+        return dex_future_new_for_error (g_steal_pointer (&local_error));
+      if (g_atomic_int_get (&data->cancelled))
+        goto cancelled;
+
+      g_ptr_array_extend_and_steal (exact, g_steal_pointer (&fuzzy));
+    }
+
+  n_matches = 0;
+  scores    = g_array_new (FALSE, FALSE, sizeof (Score));
+  for (guint i = 0; i < exact->len; i++)
+    {
+      QuerySubTaskData *sub_data   = NULL;
+      GArray           *scores_out = NULL;
+
+      sub_data   = g_ptr_array_index (exact, i);
+      scores_out = sub_data->scores_out;
+
+      n_matches += sub_data->n_matches_out;
+      if (max_results > 0)
+        {
+          /* Each sub task already kept only its own best `max_results`
+             scores, so merging them stays bounded too */
+          for (guint j = 0; j < scores_out->len; j++)
+            score_heap_push (scores, &g_array_index (scores_out, Score, j), max_results);
+        }
+      else if (scores_out->len > 0)
+        g_array_append_vals (scores, scores_out->data, scores_out->len);
+    }
+  if (scores->len > 0)
+    g_array_sort (scores, (GCompareFunc) cmp_scores);
+
+  if (refine != NULL)
+    {
+      g_autoptr (GArray) survivors = NULL;
+
+      /* Only the exact pass records survivors, so fuzzy sub tasks add
+         nothing here */
+      survivors = g_array_new (FALSE, FALSE, sizeof (guint));
+      for (guint i = 0; i < exact->len; i++)
+        {
+          QuerySubTaskData *sub_data = NULL;
+
+          sub_data = g_ptr_array_index (exact, i);
+          if (sub_data->survivors_out->len > 0)
+            g_array_append_vals (
+                survivors,
+                sub_data->survivors_out->data,
+                sub_data->survivors_out->len);
+        }
+      /* Chunks are handed out in no particular order */
+      sort_and_dedup_guint (survivors);
+
+      refine->survivors = g_steal_pointer (&survivors);
+      g_atomic_int_set (&refine->complete, TRUE);
+    }
+
+  /* BzSearchResult objects are only created once something looks at them */
+  hits = bz_search_hit_array_new (scores->len);
+  for (guint i = 0; i < scores->len; i++)
+    {
+      Score        *score  = NULL;
+      SearchCorpus *corpus = NULL;
+      BzSearchHit   hit    = { 0 };
+
+      score  = &g_array_index (scores, Score, i);
+      corpus = g_ptr_array_index (corpora, score->idx);
+
+      hit.group          = g_object_ref (corpus->group);
+      hit.original_index = score->idx;
+      hit.score          = score->val;
+      g_array_append_val (hits, hit);
+    }
+  results = bz_search_result_model_new (hits);
+
+  finished = bz_finished_search_query_new ();
+  bz_finished_search_query_set_interpreted_query (finished, query_utf8);
+  bz_finished_search_query_set_results (finished, results);
+  bz_finished_search_query_set_n_results (finished, n_matches);
+  bz_finished_search_query_set_elapsed (finished, g_timer_elapsed (timer, NULL));
+
+  return dex_future_new_for_object (finished);
+
+cancelled:
+  return dex_future_new_reject (
+      G_IO_ERROR,
+      G_IO_ERROR_CANCELLED,
+      "Search for \"%s\" was superseded",
+      query_utf8);
+}
+
+static DexFuture *
+query_watch_finally (DexFuture     *future,
+                     QueryTaskData *data)
+{
+  /* Only here for its destroy notify, which runs once nobody holds on to
+     this query anymore; a finished query won't notice */
+  return NULL;
+}
+
+static void
+cancel_query_task (QueryTaskData *data)
+{
+  g_atomic_int_set (&data->cancelled, TRUE);
+  query_task_data_unref (data);
+}
+
+static GPtrArray *
+run_pass (QueryTaskData *data,
+          int            pass,
+          guint          n_work,
+          GError       **error)
+{
+  g_autoptr (GPtrArray) sub_datas   = NULL;
+  g_autoptr (GPtrArray) sub_futures = NULL;
+  guint    n_workers                = 0;
+  gboolean result                   = FALSE;
+  gint64   busiest                  = 0;
+  gint64   total                    = 0;
+  guint    n_min                    = G_MAXUINT;
+  guint    n_max                    = 0;
+
+  data->pass   = pass;
+  data->n_work = n_work;
+  g_atomic_int_set (&data->next_chunk, 0);
+
+  sub_datas = g_ptr_array_new_with_free_func (query_sub_task_data_unref);
+
+  if (n_work <= INLINE_WORK_LIMIT)
     {
       g_autoptr (QuerySubTaskData) sub_data = NULL;
       g_autoptr (DexFuture) future          = NULL;
 
-      sub_data                 = query_sub_task_data_new ();
-      sub_data->query_utf8     = g_strdup (query_utf8);
-      sub_data->shallow_mirror = g_ptr_array_ref (shallow_mirror);
-      sub_data->threshold      = 1.0;
-      sub_data->work_offset    = i * scores_per_task;
-      sub_data->work_length    = scores_per_task;
-      sub_data->active_biases  = g_ptr_array_ref (active_biases);
+      /* Spawning costs more than scoring this little */
+      sub_data = query_sub_task_data_new_for_task (data);
+      future   = query_sub_task_fiber (sub_data);
+      g_ptr_array_add (sub_datas, g_steal_pointer (&sub_data));
+
+      return g_steal_pointer (&sub_datas);
+    }
 
-      if (i >= n_sub_tasks - 1)
-        sub_data->work_length += shallow_mirror->len % n_sub_tasks;
+  /* Workers pull small chunks off a shared counter until the work runs
+     out, so a slow chunk only holds up its own worker while the others
+     keep draining the rest */
+  n_workers   = MIN (g_get_num_processors (), (n_work + WORK_CHUNK_SIZE - 1) / WORK_CHUNK_SIZE);
+  sub_futures = g_ptr_array_new_with_free_func (dex_unref);
+  for (guint i = 0; i < n_workers; i++)
+    {
+      g_autoptr (QuerySubTaskData) sub_data = NULL;
+      g_autoptr (DexFuture) future          = NULL;
 
-      future = dex_scheduler_spawn (
+      sub_data = query_sub_task_data_new_for_task (data);
+      future   = dex_scheduler_spawn (
           dex_thread_pool_scheduler_get_default (),
           bz_get_dex_stack_size (),
           (DexFiberFunc) query_sub_task_fiber,
           query_sub_task_data_ref (sub_data),
           query_sub_task_data_unref);
 
+      g_ptr_array_add (sub_datas, g_steal_pointer (&sub_data));
       g_ptr_array_add (sub_futures, g_steal_pointer (&future));
     }
 
   result = dex_await (dex_future_allv (
                           (DexFuture *const *) sub_futures->pdata, sub_futures->len),
-                      &local_error);
+                      error);
   if (!result)
-    return dex_future_new_for_error (g_steal_pointer (&local_error));
+    return NULL;
 
-  scores = g_array_new (FALSE, FALSE, sizeof (Score));
-  for (guint i = 0; i < sub_futures->len; i++)
+  for (guint i = 0; i < sub_datas->len; i++)
     {
-      DexFuture *future     = NULL;
-      GArray    *scores_out = NULL;
+      QuerySubTaskData *sub_data = NULL;
 
-      future     = g_ptr_array_index (sub_futures, i);
-      scores_out = g_value_get_boxed (dex_future_get_value (future, NULL));
-
-      if (scores_out->len > 0)
-        g_array_append_vals (scores, scores_out->data, scores_out->len);
+      sub_data = g_ptr_array_index (sub_datas, i);
+      busiest  = MAX (busiest, sub_data->busy_usec_out);
+      total += sub_data->busy_usec_out;
+      n_min = MIN (n_min, sub_data->n_chunks_out);
+      n_max = MAX (n_max, sub_data->n_chunks_out);
     }
-  if (scores->len > 0)
-    g_array_sort (scores, (GCompareFunc) cmp_scores);
 
-  results = g_ptr_array_new_with_free_func (g_object_unref);
-  g_ptr_array_set_size (results, scores->len);
-  for (guint i = 0; i < scores->len; i++)
+  g_debug ("Query \"%s\" %s pass scored %u candidates in chunks of %u across %u workers; "
+           "chunks per worker %u-%u, busiest worker %.3fms against a mean of %.3fms "
+           "(imbalance %.2f)",
+           data->query_utf8,
+           pass == PASS_FUZZY ? "fuzzy" : "exact",
+           n_work, WORK_CHUNK_SIZE, sub_datas->len,
+           n_min, n_max,
+           busiest / 1000.0,
+           total / 1000.0 / sub_datas->len,
+           total > 0 ? busiest * (double) sub_datas->len / (double) total : 1.0);
+
+  return g_steal_pointer (&sub_datas);
+}
+
+static DexFuture *
+query_sub_task_fiber (QuerySubTaskData *data)
+{
+  QueryTaskData *task = data->task;
+  gint64         busy = 0;
+
+  for (;;)
     {
-      Score        *score                      = NULL;
-      BzEntryGroup *group                      = NULL;
-      g_autoptr (BzSearchResult) search_result = NULL;
+      guint  offset = 0;
+      gint64 start  = 0;
 
-      score = &g_array_index (scores, Score, i);
-      group = g_ptr_array_index (shallow_mirror, score->idx);
+      if (g_atomic_int_get (&task->cancelled))
+        break;
 
-      search_result = bz_search_result_new ();
-      bz_search_result_set_group (search_result, group);
-      bz_search_result_set_original_index (search_result, score->idx);
-      bz_search_result_set_score (search_result, score->val);
+      offset = (guint) g_atomic_int_add (&task->next_chunk, WORK_CHUNK_SIZE);
+      if (offset >= task->n_work)
+        break;
 
-      g_ptr_array_index (results, i) = g_steal_pointer (&search_result);
+      start = g_get_monotonic_time ();
+      score_range (task, data, offset, MIN (WORK_CHUNK_SIZE, task->n_work - offset));
+      busy += g_get_monotonic_time () - start;
+      data->n_chunks_out++;
     }
 
-  finished = bz_finished_search_query_new ();
-  bz_finished_search_query_set_interpreted_query (finished, query_utf8);
-  bz_finished_search_query_set_results (finished, results);
-  bz_finished_search_query_set_n_results (finished, results->len);
-  bz_finished_search_query_set_elapsed (finished, g_timer_elapsed (timer, NULL));
-
-  return dex_future_new_for_object (finished);
+  data->busy_usec_out = busy;
+  return dex_future_new_true ();
 }
 
-static DexFuture *
-query_sub_task_fiber (QuerySubTaskData *data)
+static QuerySubTaskData *
+query_sub_task_data_new_for_task (QueryTaskData *task)
 {
-  GPtrArray *shallow_mirror     = data->shallow_mirror;
-  char      *query_utf8         = data->query_utf8;
-  double     threshold          = data->threshold;
-  guint      work_offset        = data->work_offset;
-  guint      work_length        = data->work_length;
-  GPtrArray *active_biases      = data->active_biases;
-  g_autoptr (GArray) scores_out = NULL;
+  g_autoptr (QuerySubTaskData) sub_data = NULL;
 
-  scores_out = g_array_new (FALSE, FALSE, sizeof (Score));
+  sub_data                = query_sub_task_data_new ();
+  sub_data->task          = query_task_data_ref (task);
+  sub_data->scores_out    = g_array_new (FALSE, FALSE, sizeof (Score));
+  sub_data->survivors_out = g_array_new (FALSE, FALSE, sizeof (guint));
 
-  for (guint i = 0; i < work_length; i++)
-    {
-      g_autoptr (GMutexLocker) locker = NULL;
-      BzEntryGroup *group             = NULL;
-      const char   *id                = NULL;
-      const char   *title             = NULL;
-      double        score             = 0.0;
+  return g_steal_pointer (&sub_data);
+}
 
-      group  = g_ptr_array_index (shallow_mirror, work_offset + i);
-      locker = bz_entry_group_lock (group);
+static void
+score_range (QueryTaskData    *task,
+             QuerySubTaskData *out,
+             guint             work_offset,
+             guint             work_length)
+{
+  GPtrArray    *corpora       = task->snapshot->corpora;
+  GArray       *indices       = task->indices;
+  char         *query_utf8    = task->query_utf8;
+  SearchCorpus *query         = task->query;
+  GPtrArray    *active_biases = task->active_biases;
+  guint         max_results   = task->max_results;
+  double        threshold     = 1.0;
+
+  if (task->pass == PASS_FUZZY)
+    {
+      score_range_fuzzy (task, out, work_offset, work_length);
+      return;
+    }
 
-      if (!bz_entry_group_is_searchable (group))
+  for (guint i = 0; i < work_length; i++)
+    {
+      guint         position = 0;
+      SearchCorpus *corpus   = NULL;
+      const char   *id       = NULL;
+      double        score    = 0.0;
+      gboolean      survives = FALSE;
+
+      position = indices != NULL
+                     ? g_array_index (indices, guint, work_offset + i)
+                     : work_offset + i;
+      corpus   = g_ptr_array_index (corpora, position);
+      if (!corpus->searchable)
         continue;
 
-      id    = bz_entry_group_get_id (group);
-      title = bz_entry_group_get_title (group);
+      id = corpus->id;
       if ((id != NULL && g_strcmp0 (query_utf8, id) == 0) ||
-          (title != NULL && strcasecmp (query_utf8, title) == 0))
+          field_equals (query, corpus, FIELD_TITLE))
         score = (double) G_MAXINT;
       else
         {
-          const char *developer     = NULL;
-          const char *description   = NULL;
-          const char *search_tokens = NULL;
-
-          developer     = bz_entry_group_get_developer (group);
-          description   = bz_entry_group_get_description (group);
-          search_tokens = bz_entry_group_get_search_tokens (group);
-
-#define EVALUATE_STRING(_s, _accept_min_size)                  \
-  ((_s) != NULL                                                \
-       ? (test_strings (query_utf8, (_s), (_accept_min_size))) \
-       : 0.0)
-
-          score += EVALUATE_STRING (title, 2) * 2.0;
-          score += EVALUATE_STRING (developer, 2) * 1.0;
-          score += EVALUATE_STRING (description, 3) * 1.0;
-          score += EVALUATE_STRING (search_tokens, -1) * 1.5;
-
-#undef EVALUATE_STRING
+          score += test_strings (query, corpus, FIELD_TITLE, 2) * 2.0;
+          score += test_strings (query, corpus, FIELD_DEVELOPER, 2) * 1.0;
+          score += test_strings (query, corpus, FIELD_DESCRIPTION, 3) * 1.0;
+          score += test_strings (query, corpus, FIELD_SEARCH_TOKENS, -1) * 1.5;
         }
 
+      survives = score > 0.0 ||
+                 field_contains_all (query, corpus, FIELD_TITLE) ||
+                 field_contains_all (query, corpus, FIELD_DEVELOPER) ||
+                 field_contains_all (query, corpus, FIELD_DESCRIPTION) ||
+                 field_contains_all (query, corpus, FIELD_SEARCH_TOKENS);
+
       for (guint j = 0; j < active_biases->len; j++)
         {
           BiasData *bias = NULL;
@@ -704,8 +1780,9 @@ query_sub_task_fiber (QuerySubTaskData *data)
           if (bias->boost == NULL)
             continue;
 
-          if (!g_hash_table_contains (bias->boost, id))
+          if (id == NULL || !g_hash_table_contains (bias->boost, id))
             continue;
+          survives = TRUE;
 
           switch (bias->boost_kind)
             {
@@ -720,163 +1797,1347 @@ query_sub_task_fiber (QuerySubTaskData *data)
             }
         }
 
+      if (survives)
+        g_array_append_val (out->survivors_out, position);
+
       if (score > threshold)
         {
           Score append = { 0 };
 
-          append.idx = work_offset + i;
+          append.idx = position;
           append.val = score;
-          g_array_append_val (scores_out, append);
+          if (max_results > 0)
+            score_heap_push (out->scores_out, &append, max_results);
+          else
+            g_array_append_val (out->scores_out, append);
+          out->n_matches_out++;
         }
     }
-
-  return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&scores_out));
 }
 
-#define UTF8_FOREACH_FORWARD(_var, _s) \
-  for (const char *_var = (_s);        \
-       _var != NULL && *_var != '\0';  \
-       _var = g_utf8_next_char (_var))
-
-#define UTF8_FOREACH_FORWARD_WITH_END(_var, _s, _end)  \
-  for (const char *_var = (_s);                        \
-       _var != NULL && *_var != '\0' && _var < (_end); \
-       _var = g_utf8_next_char (_var))
-
-#define UTF8_FOREACH_BACKWARD(_var, _s, _start) \
-  for (const char *_var = (_s);                 \
-       _var != NULL && _var >= (_start);        \
-       _var = g_utf8_prev_char (_var))
-
-#define UTF8_FOREACH_TOKEN_FORWARDS(_start_var, _end_var, _s, _token_len)                                                            \
-  for (const char *_start_var = (_s), *_end_var = utf8_skip_to_next_of_class (&_start_var, G_UNICODE_SPACE_SEPARATOR, (_token_len)); \
-       _start_var != NULL && *_start_var != '\0';                                                                                    \
-       _start_var = _end_var, _end_var = utf8_skip_to_next_of_class (&_start_var, G_UNICODE_SPACE_SEPARATOR, (_token_len)))
-
-static double
-test_strings (const char *query,
-              const char *against,
-              gssize      accept_min_size)
+static gboolean
+prepare_fuzzy_patterns (QueryTaskData *data)
 {
-  double score                = 0.0;
-  gsize  query_tok_utf8_len   = 0;
-  gsize  against_tok_utf8_len = 0;
+  SearchCorpus *query               = data->query;
+  g_autofree FuzzyPattern *patterns = NULL;
+  gboolean any_fuzzy                = FALSE;
 
-  UTF8_FOREACH_TOKEN_FORWARDS (query_tok_start, query_tok_end, query, &query_tok_utf8_len)
-  {
-    gboolean query_token_has_match = FALSE;
+  if (data->patterns != NULL)
+    return TRUE;
+  if (query->n_tokens == 0)
+    return FALSE;
 
-    UTF8_FOREACH_TOKEN_FORWARDS (against_tok_start, against_tok_end, against, &against_tok_utf8_len)
+  patterns = g_new0 (FuzzyPattern, query->n_tokens);
+  for (guint q = 0; q < query->n_tokens; q++)
     {
-      gboolean match    = FALSE;
-      gsize    consumed = 0;
+      FuzzyPattern *pattern = &patterns[q];
+      guint32       bytes   = query->tok_bytes[q];
 
-      if (accept_min_size > 0 &&
-          against_tok_utf8_len < accept_min_size)
+      if (!(query->tok_flags[q] & TOKEN_FLAG_ASCII) ||
+          bytes < FUZZY_MIN_TOKEN_LENGTH ||
+          bytes > 64)
         continue;
 
-      UTF8_FOREACH_FORWARD_WITH_END (against_ptr, against_tok_start, against_tok_end)
-      {
-        const char *against_check_ptr = NULL;
-        gunichar    against_ch        = 0;
+      pattern->length     = bytes;
+      pattern->max_errors = bytes >= FUZZY_LONG_TOKEN ? 2 : 1;
+      for (guint i = 0; i < bytes; i++)
+        pattern->peq[(guint8) query->text[query->tok_offsets[q] + i]] |= (guint64) 1 << i;
 
-        if (query_tok_utf8_len > against_tok_utf8_len - consumed)
-          break;
+      any_fuzzy = TRUE;
+    }
+
+  if (!any_fuzzy)
+    return FALSE;
 
-        match = TRUE;
+  data->patterns = g_steal_pointer (&patterns);
+  return TRUE;
+}
+
+static void
+score_range_fuzzy (QueryTaskData    *task,
+                   QuerySubTaskData *out,
+                   guint             work_offset,
+                   guint             work_length)
+{
+  GPtrArray    *corpora     = task->snapshot->corpora;
+  GArray       *allowed     = task->allowed;
+  SearchCorpus *query       = task->query;
+  FuzzyPattern *patterns    = task->patterns;
+  GArray       *exact_hits  = task->exact_hits;
+  guint         max_results = task->max_results;
+  double        threshold   = 1.0;
+
+  for (guint i = 0; i < work_length; i++)
+    {
+      guint         position = 0;
+      SearchCorpus *corpus   = NULL;
+      double        score    = 0.0;
+      gboolean      exact    = FALSE;
+
+      position = allowed != NULL
+                     ? g_array_index (allowed, guint, work_offset + i)
+                     : work_offset + i;
+      corpus   = g_ptr_array_index (corpora, position);
+      if (!corpus->searchable)
+        continue;
+      if (exact_hits != NULL &&
+          g_array_binary_search (exact_hits, &position, (GCompareFunc) cmp_guint, NULL))
+        continue;
 
-        against_check_ptr = against_ptr;
-        against_ch        = g_unichar_tolower (g_utf8_get_char (against_ptr));
-        UTF8_FOREACH_FORWARD_WITH_END (query_ptr, query_tok_start, query_tok_end)
+      /* Descriptions are long and full of near misses, so only the short
+         fields are worth the fuzzy scan */
+      for (guint j = 0; j < G_N_ELEMENTS (fuzzy_fields); j++)
         {
-          gunichar query_ch = 0;
+          double field_score = 0.0;
+          guint  errors      = 0;
+
+          if (!fuzzy_match_field (query, patterns, corpus, fuzzy_fields[j].field, &field_score, &errors))
+            continue;
 
-          query_ch = g_unichar_tolower (g_utf8_get_char (query_ptr));
-          if (against_ch != query_ch)
+          if (errors == 0)
             {
-              match = FALSE;
+              /* This was the exact pass's business */
+              exact = TRUE;
               break;
             }
+          score += field_score * fuzzy_fields[j].weight;
+        }
+      if (exact)
+        continue;
+
+      score *= FUZZY_PENALTY;
+      if (score > threshold)
+        {
+          Score append = { 0 };
 
-          against_check_ptr = g_utf8_next_char (against_check_ptr);
-          against_ch        = g_unichar_tolower (g_utf8_get_char (against_check_ptr));
+          append.idx = position;
+          append.val = score;
+          if (max_results > 0)
+            score_heap_push (out->scores_out, &append, max_results);
+          else
+            g_array_append_val (out->scores_out, append);
+          out->n_matches_out++;
         }
+    }
+}
 
-        if (match)
-          break;
-        else
-          consumed++;
-      }
+static gboolean
+fuzzy_match_field (const SearchCorpus *query,
+                   const FuzzyPattern *patterns,
+                   const SearchCorpus *against,
+                   guint               field,
+                   double             *score_out,
+                   guint              *errors_out)
+{
+  const char *field_text = NULL;
+  gsize       field_len  = 0;
+  double      score      = 0.0;
+  guint       errors     = 0;
+
+  if (field >= against->n_fields)
+    return FALSE;
 
-      if (match)
+  field_text = against->text + against->field_bytes[field];
+  field_len  = against->field_bytes[field + 1] - against->field_bytes[field] - 1;
+  if (field_len == 0)
+    return FALSE;
+
+  /* Like the exact pass, every query token has to show up in the field */
+  for (guint q = 0; q < query->n_tokens; q++)
+    {
+      const FuzzyPattern *pattern      = &patterns[q];
+      guint               token_errors = 0;
+
+      if (pattern->length == 0)
         {
-          score += (double) (query_tok_utf8_len * query_tok_utf8_len) / (double) against_tok_utf8_len;
-          query_token_has_match = TRUE;
+          if (find_substring_kernel (
+                  field_text, field_len,
+                  query->text + query->tok_offsets[q],
+                  query->tok_bytes[q]) == NULL)
+            return FALSE;
+
+          score += (double) query->tok_chars[q];
+          continue;
         }
+
+      token_errors = myers_search (pattern, field_text, field_len);
+      if (token_errors > pattern->max_errors)
+        return FALSE;
+
+      score += (double) ((pattern->length - token_errors) * (pattern->length - token_errors)) /
+               (double) pattern->length;
+      errors += token_errors;
     }
 
-    if (!query_token_has_match)
-      {
-        score = 0.0;
-        break;
-      }
-  }
+  *score_out  = score;
+  *errors_out = errors;
+  return TRUE;
+}
 
-  return score;
+/* Smallest edit distance between the pattern and any substring of `text`,
+   following Myers (1999) as formulated by Hyyrö: the vertical deltas of
+   one column of the dynamic programming matrix live in two bit vectors,
+   and the free top row makes it a search rather than a global alignment */
+static guint
+myers_search (const FuzzyPattern *pattern,
+              const char         *text,
+              gsize               text_len)
+{
+  guint64 pv    = ~(guint64) 0;
+  guint64 mv    = 0;
+  guint64 high  = (guint64) 1 << (pattern->length - 1);
+  guint   score = pattern->length;
+  guint   best  = pattern->length;
+
+  for (gsize i = 0; i < text_len && best > 0; i++)
+    {
+      guint64 eq = pattern->peq[(guint8) text[i]];
+      guint64 xv = eq | mv;
+      guint64 xh = (((eq & pv) + pv) ^ pv) | eq;
+      guint64 ph = mv | ~(xh | pv);
+      guint64 mh = pv & xh;
+
+      if (ph & high)
+        score++;
+      else if (mh & high)
+        score--;
+
+      ph <<= 1;
+      mh <<= 1;
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+
+      best = MIN (best, score);
+    }
+
+  return best;
 }
 
-static inline GUnicodeType
-utf8_char_class (const char *s,
-                 gunichar   *ch_out)
+#define UTF8_FOREACH_FORWARD(_var, _s) \
+  for (const char *_var = (_s);        \
+       _var != NULL && *_var != '\0';  \
+       _var = g_utf8_next_char (_var))
+
+static SearchCorpus *
+search_corpus_new_for_group (BzEntryGroup *group)
 {
-  gunichar     ch = 0;
-  GUnicodeType cl = 0;
+  g_autoptr (SearchCorpus) corpus = NULL;
+  const char *fields[N_FIELDS]    = { 0 };
 
-  ch = g_utf8_get_char (s);
-  cl = g_unichar_type (ch);
+  fields[FIELD_TITLE]         = bz_entry_group_get_title (group);
+  fields[FIELD_DEVELOPER]     = bz_entry_group_get_developer (group);
+  fields[FIELD_DESCRIPTION]   = bz_entry_group_get_description (group);
+  fields[FIELD_SEARCH_TOKENS] = bz_entry_group_get_search_tokens (group);
 
-  if (ch_out != NULL)
-    *ch_out = ch;
-  return cl;
+  corpus             = search_corpus_data_new ();
+  corpus->group      = g_object_ref (group);
+  corpus->id         = bz_maybe_strdup (bz_entry_group_get_id (group));
+  corpus->searchable = bz_entry_group_is_searchable (group);
+  search_corpus_build (corpus, fields, N_FIELDS);
+
+  return g_steal_pointer (&corpus);
 }
 
-static inline const char *
-utf8_skip_to_next_of_class (const char **s,
-                            GUnicodeType class,
-                            gsize       *read_utf8)
+static SearchCorpus *
+search_corpus_new_for_query (const char *query_utf8)
 {
-  gboolean skipped = FALSE;
+  g_autoptr (SearchCorpus) corpus = NULL;
 
-  if (read_utf8 != NULL)
-    *read_utf8 = 0;
+  corpus = search_corpus_data_new ();
+  search_corpus_build (corpus, (const char *const[]) { query_utf8 }, 1);
 
-  UTF8_FOREACH_FORWARD (p, *s)
-  {
-    if (utf8_char_class (p, NULL) == class)
-      {
-        if (skipped)
-          return p;
-      }
-    else
+  return g_steal_pointer (&corpus);
+}
+
+static void
+search_corpus_build (SearchCorpus      *corpus,
+                     const char *const *fields,
+                     guint              n_fields)
+{
+  g_autoptr (GString) text   = NULL;
+  g_autoptr (GArray) offsets = NULL;
+  g_autoptr (GArray) n_bytes = NULL;
+  g_autoptr (GArray) n_chars = NULL;
+  g_autoptr (GArray) flags   = NULL;
+  gsize   arrays_size        = 0;
+  guchar *arena              = NULL;
+
+  g_assert (n_fields <= N_FIELDS);
+
+  text    = g_string_new (NULL);
+  offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+  n_bytes = g_array_new (FALSE, FALSE, sizeof (guint32));
+  n_chars = g_array_new (FALSE, FALSE, sizeof (guint32));
+  flags   = g_array_new (FALSE, FALSE, sizeof (guint8));
+
+#define FINISH_TOKEN()                              \
+  G_STMT_START                                      \
+  {                                                 \
+    guint32 _tok_len = 0;                           \
+                                                    \
+    _tok_len = text->len - tok_offset;              \
+    g_array_append_val (offsets, tok_offset);       \
+    g_array_append_val (n_bytes, _tok_len);         \
+    g_array_append_val (n_chars, tok_chars);        \
+    g_array_append_val (flags, tok_flags);          \
+    in_token = FALSE;                               \
+  }                                                 \
+  G_STMT_END
+
+  for (guint i = 0; i < n_fields; i++)
+    {
+      g_autofree char *folded = NULL;
+      guint32  tok_offset     = 0;
+      guint32  tok_chars      = 0;
+      guint8   tok_flags      = 0;
+      gboolean in_token       = FALSE;
+
+      corpus->field_tokens[i] = offsets->len;
+      corpus->field_bytes[i]  = text->len;
+
+      if (fields[i] == NULL)
+        {
+          g_string_append_c (text, '\0');
+          continue;
+        }
+      folded = fold_string (fields[i]);
+
+      UTF8_FOREACH_FORWARD (ptr, folded)
       {
-        if (!skipped)
+        if (utf8_char_class (ptr, NULL) == G_UNICODE_SPACE_SEPARATOR)
+          {
+            if (in_token)
+              FINISH_TOKEN ();
+            continue;
+          }
+
+        if (!in_token)
           {
-            *s      = p;
-            skipped = TRUE;
+            if (text->len > corpus->field_bytes[i])
+              g_string_append_c (text, ' ');
+            tok_offset = text->len;
+            tok_chars  = 0;
+            tok_flags  = TOKEN_FLAG_ASCII;
+            in_token   = TRUE;
           }
-        if (read_utf8 != NULL)
-          (*read_utf8)++;
+        if ((guchar) *ptr >= 0x80)
+          tok_flags &= ~TOKEN_FLAG_ASCII;
+        g_string_append_len (text, ptr, g_utf8_next_char (ptr) - ptr);
+        tok_chars++;
       }
+      if (in_token)
+        FINISH_TOKEN ();
+
+      g_string_append_c (text, '\0');
+    }
+
+#undef FINISH_TOKEN
+
+  corpus->n_fields               = n_fields;
+  corpus->n_tokens               = offsets->len;
+  corpus->field_tokens[n_fields] = offsets->len;
+  corpus->field_bytes[n_fields]  = text->len;
+
+  arrays_size = (3 * sizeof (guint32) + sizeof (guint8)) * offsets->len;
+  arena       = g_malloc (arrays_size + text->len + CORPUS_PADDING);
+
+  corpus->tok_offsets = (guint32 *) arena;
+  corpus->tok_bytes   = corpus->tok_offsets + offsets->len;
+  corpus->tok_chars   = corpus->tok_bytes + offsets->len;
+  corpus->tok_flags   = (guint8 *) (corpus->tok_chars + offsets->len);
+  corpus->text        = (char *) arena + arrays_size;
+  corpus->arena       = arena;
+
+  if (offsets->len > 0)
+    {
+      memcpy (corpus->tok_offsets, offsets->data, sizeof (guint32) * offsets->len);
+      memcpy (corpus->tok_bytes, n_bytes->data, sizeof (guint32) * offsets->len);
+      memcpy (corpus->tok_chars, n_chars->data, sizeof (guint32) * offsets->len);
+      memcpy (corpus->tok_flags, flags->data, sizeof (guint8) * offsets->len);
+    }
+  memcpy (corpus->text, text->str, text->len);
+  memset (corpus->text + text->len, 0, CORPUS_PADDING);
+}
+
+static char *
+fold_string (const char *string)
+{
+  g_autofree char *casefolded = NULL;
+  g_autofree char *normalized = NULL;
+  g_autoptr (GString) folded  = NULL;
+
+  casefolded = g_utf8_casefold (string, -1);
+  normalized = g_utf8_normalize (casefolded, -1, G_NORMALIZE_NFKD);
+  if (normalized == NULL)
+    /* invalid utf8 */
+    return g_strdup ("");
+
+  /* Decomposing and then dropping combining marks is what makes matching
+     insensitive to diacritics */
+  folded = g_string_sized_new (strlen (normalized));
+  UTF8_FOREACH_FORWARD (ptr, normalized)
+  {
+    GUnicodeType class = 0;
+
+    class = utf8_char_class (ptr, NULL);
+    if (class != G_UNICODE_NON_SPACING_MARK &&
+        class != G_UNICODE_SPACING_MARK &&
+        class != G_UNICODE_ENCLOSING_MARK)
+      g_string_append_len (folded, ptr, g_utf8_next_char (ptr) - ptr);
   }
-  /* return the end of the string if nothing was found */
-  return *s + strlen (*s);
+
+  return g_string_free (g_steal_pointer (&folded), FALSE);
 }
 
-static gint
-cmp_scores (Score *a,
-            Score *b)
+static const char *
+find_substring (const char *haystack,
+                gsize       haystack_len,
+                const char *needle,
+                gsize       needle_len)
 {
-  return (b->val - a->val < 0.0) ? -1 : 1;
+  const char *last = NULL;
+
+  if (needle_len == 0)
+    return haystack;
+  if (needle_len > haystack_len)
+    return NULL;
+
+  last = haystack + haystack_len - needle_len;
+  for (const char *p = haystack; p <= last; p++)
+    {
+      p = memchr (p, needle[0], last - p + 1);
+      if (p == NULL)
+        return NULL;
+      if (memcmp (p + 1, needle + 1, needle_len - 1) == 0)
+        return p;
+    }
+
+  return NULL;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* These compare the first and last needle bytes against a whole vector of
+   candidate positions at once and only verify the positions where both
+   agree. They may read up to a vector width past the end of the haystack,
+   which is what `CORPUS_PADDING` is for. */
+
+static const char *
+find_substring_sse2 (const char *haystack,
+                     gsize       haystack_len,
+                     const char *needle,
+                     gsize       needle_len)
+{
+  __m128i first = { 0 };
+  __m128i last  = { 0 };
+
+  if (needle_len == 0)
+    return haystack;
+
+  first = _mm_set1_epi8 (needle[0]);
+  last  = _mm_set1_epi8 (needle[needle_len - 1]);
+
+  for (gsize i = 0; i + needle_len <= haystack_len; i += 16)
+    {
+      __m128i block_first = { 0 };
+      __m128i block_last  = { 0 };
+      guint   mask        = 0;
+
+      block_first = _mm_loadu_si128 ((const __m128i *) (haystack + i));
+      block_last  = _mm_loadu_si128 ((const __m128i *) (haystack + i + needle_len - 1));
+      mask        = _mm_movemask_epi8 (
+          _mm_and_si128 (
+              _mm_cmpeq_epi8 (first, block_first),
+              _mm_cmpeq_epi8 (last, block_last)));
+
+      while (mask != 0)
+        {
+          gsize pos = 0;
+
+          pos = i + __builtin_ctz (mask);
+          if (pos + needle_len > haystack_len)
+            return NULL;
+          if (memcmp (haystack + pos + 1, needle + 1, needle_len - 1) == 0)
+            return haystack + pos;
+
+          mask &= mask - 1;
+        }
+    }
+
+  return NULL;
+}
+
+__attribute__ ((target ("avx2"))) static const char *
+find_substring_avx2 (const char *haystack,
+                     gsize       haystack_len,
+                     const char *needle,
+                     gsize       needle_len)
+{
+  __m256i first = { 0 };
+  __m256i last  = { 0 };
+
+  if (needle_len == 0)
+    return haystack;
+
+  first = _mm256_set1_epi8 (needle[0]);
+  last  = _mm256_set1_epi8 (needle[needle_len - 1]);
+
+  for (gsize i = 0; i + needle_len <= haystack_len; i += 32)
+    {
+      __m256i block_first = { 0 };
+      __m256i block_last  = { 0 };
+      guint   mask        = 0;
+
+      block_first = _mm256_loadu_si256 ((const __m256i *) (haystack + i));
+      block_last  = _mm256_loadu_si256 ((const __m256i *) (haystack + i + needle_len - 1));
+      mask        = (guint) _mm256_movemask_epi8 (
+          _mm256_and_si256 (
+              _mm256_cmpeq_epi8 (first, block_first),
+              _mm256_cmpeq_epi8 (last, block_last)));
+
+      while (mask != 0)
+        {
+          gsize pos = 0;
+
+          pos = i + __builtin_ctz (mask);
+          if (pos + needle_len > haystack_len)
+            return NULL;
+          if (memcmp (haystack + pos + 1, needle + 1, needle_len - 1) == 0)
+            return haystack + pos;
+
+          mask &= mask - 1;
+        }
+    }
+
+  return NULL;
+}
+
+#endif
+
+static double
+test_strings (const SearchCorpus *query,
+              const SearchCorpus *against,
+              guint               field,
+              gssize              accept_min_size)
+{
+  return test_strings_with (query, against, field, accept_min_size, find_substring_kernel);
+}
+
+/* A NULL kernel sends every token down the per token path */
+static inline double
+test_strings_with (const SearchCorpus *query,
+                   const SearchCorpus *against,
+                   guint               field,
+                   gssize              accept_min_size,
+                   FindSubstringFunc   kernel)
+{
+  double score = 0.0;
+
+  if (field >= against->n_fields)
+    return 0.0;
+
+  for (guint q = query->field_tokens[0]; q < query->field_tokens[1]; q++)
+    {
+      const char *query_tok             = NULL;
+      guint32     query_tok_bytes       = 0;
+      guint32     query_tok_chars       = 0;
+      gboolean    query_token_has_match = FALSE;
+
+      query_tok       = query->text + query->tok_offsets[q];
+      query_tok_bytes = query->tok_bytes[q];
+      query_tok_chars = query->tok_chars[q];
+
+      if (kernel != NULL &&
+          (query->tok_flags[q] & TOKEN_FLAG_ASCII))
+        {
+          const char *field_text = NULL;
+          gsize       field_len  = 0;
+          gsize       pos        = 0;
+          guint       a          = 0;
+
+          /* Query tokens never contain spaces, so we can scan the whole
+             field at once and any hit lies inside exactly one token */
+          field_text = against->text + against->field_bytes[field];
+          field_len  = against->field_bytes[field + 1] - against->field_bytes[field] - 1;
+          a          = against->field_tokens[field];
+
+          while (pos + query_tok_bytes <= field_len)
+            {
+              const char *hit        = NULL;
+              gsize       hit_offset = 0;
+
+              hit = kernel (
+                  field_text + pos, field_len - pos,
+                  query_tok, query_tok_bytes);
+              if (hit == NULL)
+                break;
+
+              hit_offset = hit - against->text;
+              while (against->tok_offsets[a] + against->tok_bytes[a] <= hit_offset)
+                a++;
+
+              if (accept_min_size <= 0 ||
+                  against->tok_chars[a] >= accept_min_size)
+                {
+                  score += (double) (query_tok_chars * query_tok_chars) / (double) against->tok_chars[a];
+                  query_token_has_match = TRUE;
+                }
+
+              /* Each token counts once */
+              pos = against->tok_offsets[a] + against->tok_bytes[a] - against->field_bytes[field];
+              a++;
+            }
+
+          if (!query_token_has_match)
+            return 0.0;
+          continue;
+        }
+
+      for (guint a = against->field_tokens[field]; a < against->field_tokens[field + 1]; a++)
+        {
+          guint32 against_tok_chars = 0;
+
+          against_tok_chars = against->tok_chars[a];
+          if (accept_min_size > 0 &&
+              against_tok_chars < accept_min_size)
+            continue;
+          if (query_tok_chars > against_tok_chars)
+            continue;
+
+          if (find_substring (
+                  against->text + against->tok_offsets[a],
+                  against->tok_bytes[a],
+                  query_tok, query_tok_bytes) != NULL)
+            {
+              score += (double) (query_tok_chars * query_tok_chars) / (double) against_tok_chars;
+              query_token_has_match = TRUE;
+            }
+        }
+
+      if (!query_token_has_match)
+        return 0.0;
+    }
+
+  return score;
+}
+
+static gboolean
+field_equals (const SearchCorpus *query,
+              const SearchCorpus *against,
+              guint               field)
+{
+  guint query_len   = 0;
+  guint against_len = 0;
+
+  if (field >= against->n_fields)
+    return FALSE;
+
+  query_len   = query->field_bytes[1] - query->field_bytes[0];
+  against_len = against->field_bytes[field + 1] - against->field_bytes[field];
+
+  /* An empty field is just the NUL */
+  return against_len > 1 &&
+         query_len == against_len &&
+         memcmp (query->text + query->field_bytes[0],
+                 against->text + against->field_bytes[field],
+                 query_len) == 0;
+}
+
+static gboolean
+field_contains_all (const SearchCorpus *query,
+                    const SearchCorpus *against,
+                    guint               field)
+{
+  const char *field_text = NULL;
+  gsize       field_len  = 0;
+
+  if (field >= against->n_fields)
+    return FALSE;
+
+  field_text = against->text + against->field_bytes[field];
+  field_len  = against->field_bytes[field + 1] - against->field_bytes[field] - 1;
+
+  /* Query tokens never contain spaces, so a hit anywhere in the field text
+     lies inside a single token */
+  for (guint q = query->field_tokens[0]; q < query->field_tokens[1]; q++)
+    {
+      if (find_substring_kernel (
+              field_text, field_len,
+              query->text + query->tok_offsets[q],
+              query->tok_bytes[q]) == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static inline GUnicodeType
+utf8_char_class (const char *s,
+                 gunichar   *ch_out)
+{
+  gunichar     ch = 0;
+  GUnicodeType cl = 0;
+
+  ch = g_utf8_get_char (s);
+  cl = g_unichar_type (ch);
+
+  if (ch_out != NULL)
+    *ch_out = ch;
+  return cl;
+}
+
+static gint
+cmp_scores (Score *a,
+            Score *b)
+{
+  return (b->val - a->val < 0.0) ? -1 : 1;
+}
+
+/* Ranks scores the same way as `cmp_scores`, with positions breaking ties
+   so that truncated results are deterministic */
+static inline gboolean
+score_worse (const Score *a,
+             const Score *b)
+{
+  return a->val < b->val || (a->val == b->val && a->idx > b->idx);
+}
+
+/* Bounded binary min-heap with the worst kept score at the root */
+static void
+score_heap_push (GArray      *heap,
+                 const Score *score,
+                 guint        capacity)
+{
+  Score *data = NULL;
+  guint  i    = 0;
+
+  if (heap->len < capacity)
+    {
+      g_array_append_val (heap, *score);
+      data = (Score *) heap->data;
+
+      for (i = heap->len - 1; i > 0;)
+        {
+          guint parent = (i - 1) / 2;
+          Score tmp    = { 0 };
+
+          if (!score_worse (&data[i], &data[parent]))
+            break;
+
+          tmp          = data[i];
+          data[i]      = data[parent];
+          data[parent] = tmp;
+          i            = parent;
+        }
+      return;
+    }
+
+  data = (Score *) heap->data;
+  if (!score_worse (&data[0], score))
+    return;
+
+  data[0] = *score;
+  for (i = 0;;)
+    {
+      guint left     = 2 * i + 1;
+      guint right    = left + 1;
+      guint smallest = i;
+      Score tmp      = { 0 };
+
+      if (left < heap->len && score_worse (&data[left], &data[smallest]))
+        smallest = left;
+      if (right < heap->len && score_worse (&data[right], &data[smallest]))
+        smallest = right;
+      if (smallest == i)
+        break;
+
+      tmp            = data[i];
+      data[i]        = data[smallest];
+      data[smallest] = tmp;
+      i              = smallest;
+    }
+}
+
+static SearchDoc *
+attach_doc (BzSearchEngine *self,
+            BzEntryGroup   *group)
+{
+  g_autoptr (SearchDoc) doc = NULL;
+
+  doc         = search_doc_data_new ();
+  doc->engine = self;
+  doc->corpus = search_corpus_new_for_group (group);
+  doc->doc_id = ++self->next_doc_id;
+
+  doc->notify_handler = g_signal_connect_swapped (
+      group, "notify",
+      G_CALLBACK (group_notify), doc);
+  g_hash_table_replace (self->doc_ids, GUINT_TO_POINTER (doc->doc_id), doc);
+
+  index_doc (self, doc);
+  return g_steal_pointer (&doc);
+}
+
+static void
+detach_doc (BzSearchEngine *self,
+            SearchDoc      *doc)
+{
+  unindex_doc (self, doc);
+
+  g_clear_signal_handler (&doc->notify_handler, doc->corpus->group);
+  g_hash_table_remove (self->dirty_docs, doc);
+  g_hash_table_remove (self->doc_ids, GUINT_TO_POINTER (doc->doc_id));
+  doc->engine = NULL;
+}
+
+static void
+index_doc (BzSearchEngine *self,
+           SearchDoc      *doc)
+{
+  g_autoptr (GArray) grams = NULL;
+  const char *appid        = NULL;
+
+  grams = g_array_new (FALSE, FALSE, sizeof (guint64));
+  appid = doc->corpus->id;
+
+  if (appid != NULL)
+    {
+      g_autofree char *folded_appid = NULL;
+
+      folded_appid = fold_string (appid);
+      append_string_grams (grams, folded_appid);
+    }
+  append_corpus_grams (grams, doc->corpus);
+  sort_and_dedup_guint64 (grams);
+
+  for (guint i = 0; i < grams->len; i++)
+    {
+      guint64 gram    = 0;
+      GArray *posting = NULL;
+      guint   idx     = 0;
+
+      gram    = g_array_index (grams, guint64, i);
+      posting = g_hash_table_lookup (self->index, &gram);
+      if (posting == NULL)
+        {
+          posting = g_array_new (FALSE, FALSE, sizeof (guint));
+          g_hash_table_replace (self->index, g_memdup2 (&gram, sizeof (gram)), posting);
+        }
+
+      if (!posting_find (posting, doc->doc_id, &idx))
+        g_array_insert_val (posting, idx, doc->doc_id);
+    }
+  doc->grams = g_steal_pointer (&grams);
+
+  if (appid != NULL)
+    g_hash_table_replace (self->appids, (gpointer) appid, doc);
+}
+
+static void
+unindex_doc (BzSearchEngine *self,
+             SearchDoc      *doc)
+{
+  if (doc->grams != NULL)
+    {
+      for (guint i = 0; i < doc->grams->len; i++)
+        {
+          guint64 gram    = 0;
+          GArray *posting = NULL;
+          guint   idx     = 0;
+
+          gram    = g_array_index (doc->grams, guint64, i);
+          posting = g_hash_table_lookup (self->index, &gram);
+          if (posting == NULL)
+            continue;
+
+          if (posting_find (posting, doc->doc_id, &idx))
+            g_array_remove_index (posting, idx);
+          if (posting->len == 0)
+            g_hash_table_remove (self->index, &gram);
+        }
+      g_clear_pointer (&doc->grams, g_array_unref);
+    }
+
+  if (doc->corpus->id != NULL &&
+      g_hash_table_lookup (self->appids, doc->corpus->id) == doc)
+    g_hash_table_remove (self->appids, doc->corpus->id);
+}
+
+static void
+flush_dirty_docs (BzSearchEngine *self)
+{
+  GHashTableIter iter = { 0 };
+
+  g_clear_handle_id (&self->reindex_idle, g_source_remove);
+  if (g_hash_table_size (self->dirty_docs) == 0)
+    return;
+
+  g_hash_table_iter_init (&iter, self->dirty_docs);
+  for (SearchDoc *doc = NULL;
+       g_hash_table_iter_next (&iter, (gpointer *) &doc, NULL);)
+    {
+      g_autoptr (SearchCorpus) corpus = NULL;
+
+      unindex_doc (self, doc);
+
+      corpus = search_corpus_new_for_group (doc->corpus->group);
+      g_clear_pointer (&doc->corpus, search_corpus_data_unref);
+      doc->corpus = g_steal_pointer (&corpus);
+
+      index_doc (self, doc);
+    }
+  g_hash_table_remove_all (self->dirty_docs);
+
+  self->model_generation++;
+}
+
+static void
+publish_snapshot (BzSearchEngine *self)
+{
+  SearchSnapshot *snapshot            = self->snapshot;
+  g_autoptr (SearchSnapshot) replaced = NULL;
+
+  if (snapshot != NULL &&
+      snapshot->generation == self->model_generation)
+    return;
+
+  replaced             = search_snapshot_data_new ();
+  replaced->generation = self->model_generation;
+  replaced->corpora    = g_ptr_array_new_full (self->docs->len, search_corpus_data_unref);
+  for (guint i = 0; i < self->docs->len; i++)
+    {
+      SearchDoc *doc = NULL;
+
+      doc = g_ptr_array_index (self->docs, i);
+      g_ptr_array_add (replaced->corpora, search_corpus_data_ref (doc->corpus));
+    }
+
+  /* Queries still running against the old snapshot keep their own
+     reference, so it is freed by whichever of them finishes last */
+  g_clear_pointer (&self->snapshot, search_snapshot_data_unref);
+  self->snapshot = g_steal_pointer (&replaced);
+}
+
+static SearchSnapshot *
+acquire_snapshot (BzSearchEngine *self)
+{
+  /* Normally already published by the reindex idle; a query issued
+     before that idle gets to run rebuilds it here instead */
+  publish_snapshot (self);
+  return search_snapshot_data_ref (self->snapshot);
+}
+
+static DexFuture *
+cache_store_then (DexFuture      *future,
+                  CacheStoreData *data)
+{
+  g_autoptr (BzSearchEngine) self = NULL;
+  BzFinishedSearchQuery *finished = NULL;
+  g_autoptr (CacheEntry) entry    = NULL;
+
+  finished = g_value_get_object (dex_future_get_value (future, NULL));
+
+  self = g_weak_ref_get (data->self);
+  if (self == NULL)
+    return dex_future_new_for_object (finished);
+
+  validate_cache (self);
+  if (data->model_generation != self->cache_model_generation ||
+      data->biases_generation != self->cache_biases_generation ||
+      g_hash_table_contains (self->cache, data->key))
+    return dex_future_new_for_object (finished);
+
+  entry           = cache_entry_data_new ();
+  entry->key      = g_strdup (data->key);
+  entry->finished = g_object_ref (finished);
+
+  g_queue_push_head (&self->cache_lru, entry);
+  entry->link = self->cache_lru.head;
+  g_hash_table_replace (self->cache, entry->key, cache_entry_data_ref (entry));
+
+  while (self->cache_lru.length > QUERY_CACHE_SIZE)
+    {
+      CacheEntry *evict = NULL;
+
+      evict = g_queue_pop_tail (&self->cache_lru);
+      g_hash_table_remove (self->cache, evict->key);
+    }
+
+  return dex_future_new_for_object (finished);
+}
+
+static void
+validate_cache (BzSearchEngine *self)
+{
+  /* Any change to the model or the biases may change any result */
+  if (self->cache_model_generation == self->model_generation &&
+      self->cache_biases_generation == self->biases_generation)
+    return;
+
+  clear_cache (self);
+  self->cache_model_generation  = self->model_generation;
+  self->cache_biases_generation = self->biases_generation;
+}
+
+static void
+clear_cache (BzSearchEngine *self)
+{
+  g_queue_clear (&self->cache_lru);
+  if (self->cache != NULL)
+    g_hash_table_remove_all (self->cache);
+}
+
+static void
+group_notify (SearchDoc    *doc,
+              GParamSpec   *pspec,
+              BzEntryGroup *group)
+{
+  BzSearchEngine *self = doc->engine;
+
+  if (self == NULL)
+    return;
+
+  if (g_strcmp0 (pspec->name, "id") != 0 &&
+      g_strcmp0 (pspec->name, "title") != 0 &&
+      g_strcmp0 (pspec->name, "developer") != 0 &&
+      g_strcmp0 (pspec->name, "description") != 0 &&
+      g_strcmp0 (pspec->name, "search-tokens") != 0 &&
+      /* Searchability is settled by the end of every add, which always
+         notifies this one */
+      g_strcmp0 (pspec->name, "installed-versions") != 0)
+    return;
+
+  /* A refresh will notify many times per group, so batch the work */
+  g_hash_table_add (self->dirty_docs, doc);
+  schedule_reindex (self);
+}
+
+static void
+schedule_reindex (BzSearchEngine *self)
+{
+  if (self->reindex_idle == 0)
+    self->reindex_idle = g_idle_add_full (
+        G_PRIORITY_LOW,
+        (GSourceFunc) reindex_idle_cb,
+        self, NULL);
+}
+
+static gboolean
+reindex_idle_cb (BzSearchEngine *self)
+{
+  self->reindex_idle = 0;
+  flush_dirty_docs (self);
+  publish_snapshot (self);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+clear_docs (BzSearchEngine *self)
+{
+  if (self->docs == NULL)
+    return;
+
+  for (guint i = 0; i < self->docs->len; i++)
+    detach_doc (self, g_ptr_array_index (self->docs, i));
+  g_ptr_array_set_size (self->docs, 0);
+}
+
+static GArray *
+lookup_candidates (BzSearchEngine     *self,
+                   const SearchCorpus *query,
+                   GPtrArray          *active_biases)
+{
+  g_autoptr (GArray) grams       = NULL;
+  g_autoptr (GPtrArray) postings = NULL;
+  g_autoptr (GArray) candidates  = NULL;
+
+  grams = g_array_new (FALSE, FALSE, sizeof (guint64));
+  append_corpus_grams (grams, query);
+  sort_and_dedup_guint64 (grams);
+
+  /* Query tokens shorter than a trigram can't be narrowed down */
+  if (grams->len == 0)
+    return NULL;
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  postings = g_ptr_array_new ();
+  for (guint i = 0; i < grams->len; i++)
+    {
+      GArray *posting = NULL;
+
+      posting = g_hash_table_lookup (self->index, &g_array_index (grams, guint64, i));
+      if (posting == NULL)
+        {
+          g_ptr_array_set_size (postings, 0);
+          break;
+        }
+      g_ptr_array_add (postings, posting);
+    }
+
+  if (postings->len > 0)
+    {
+      GArray *smallest = NULL;
+
+      /* Walk the rarest trigram and probe the others */
+      g_ptr_array_sort (postings, (GCompareFunc) cmp_postings_by_length);
+      smallest = g_ptr_array_index (postings, 0);
+
+      for (guint i = 0; i < smallest->len; i++)
+        {
+          guint      doc_id  = 0;
+          gboolean   matches = TRUE;
+          SearchDoc *doc     = NULL;
+
+          doc_id = g_array_index (smallest, guint, i);
+          for (guint j = 1; j < postings->len; j++)
+            {
+              if (!posting_find (g_ptr_array_index (postings, j), doc_id, NULL))
+                {
+                  matches = FALSE;
+                  break;
+                }
+            }
+          if (!matches)
+            continue;
+
+          doc = g_hash_table_lookup (self->doc_ids, GUINT_TO_POINTER (doc_id));
+          if (doc != NULL)
+            g_array_append_val (candidates, doc->position);
+        }
+    }
+
+  /* Boosts may lift groups which don't match the text at all */
+  for (guint i = 0; i < active_biases->len; i++)
+    {
+      BiasData      *bias = NULL;
+      GHashTableIter iter = { 0 };
+
+      bias = g_ptr_array_index (active_biases, i);
+      if (bias->boost == NULL)
+        continue;
+
+      g_hash_table_iter_init (&iter, bias->boost);
+      for (const char *appid = NULL;
+           g_hash_table_iter_next (&iter, (gpointer *) &appid, NULL);)
+        {
+          SearchDoc *doc = NULL;
+
+          doc = g_hash_table_lookup (self->appids, appid);
+          if (doc != NULL)
+            g_array_append_val (candidates, doc->position);
+        }
+    }
+
+  sort_and_dedup_guint (candidates);
+  return g_steal_pointer (&candidates);
+}
+
+static gboolean
+can_refine (BzSearchEngine *self,
+            RefineState    *last,
+            SearchCorpus   *query,
+            GPtrArray      *active_biases)
+{
+  SearchCorpus *last_query = last->query;
+
+  if (!g_atomic_int_get (&last->complete) ||
+      last->model_generation != self->model_generation ||
+      last->biases_generation != self->biases_generation)
+    return FALSE;
+
+  if (last->active_biases->len != active_biases->len)
+    return FALSE;
+  for (guint i = 0; i < active_biases->len; i++)
+    {
+      if (g_ptr_array_index (last->active_biases, i) !=
+          g_ptr_array_index (active_biases, i))
+        return FALSE;
+    }
+
+  /* Every previous token has to be contained by some new token */
+  if (last_query->n_tokens == 0)
+    return FALSE;
+  for (guint l = 0; l < last_query->n_tokens; l++)
+    {
+      gboolean contained = FALSE;
+
+      for (guint q = 0; q < query->n_tokens; q++)
+        {
+          if (find_substring (
+                  query->text + query->tok_offsets[q],
+                  query->tok_bytes[q],
+                  last_query->text + last_query->tok_offsets[l],
+                  last_query->tok_bytes[l]) != NULL)
+            {
+              contained = TRUE;
+              break;
+            }
+        }
+      if (!contained)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static GArray *
+intersect_positions (GArray *a,
+                     GArray *b)
+{
+  g_autoptr (GArray) out = NULL;
+  guint i                = 0;
+  guint j                = 0;
+
+  /* NULL stands for every position */
+  if (a == NULL)
+    {
+      out = g_array_sized_new (FALSE, FALSE, sizeof (guint), b->len);
+      g_array_append_vals (out, b->data, b->len);
+      return g_steal_pointer (&out);
+    }
+
+  out = g_array_new (FALSE, FALSE, sizeof (guint));
+  while (i < a->len && j < b->len)
+    {
+      guint va = g_array_index (a, guint, i);
+      guint vb = g_array_index (b, guint, j);
+
+      if (va < vb)
+        i++;
+      else if (vb < va)
+        j++;
+      else
+        {
+          g_array_append_val (out, va);
+          i++;
+          j++;
+        }
+    }
+
+  return g_steal_pointer (&out);
+}
+
+static void
+append_corpus_grams (GArray             *grams,
+                     const SearchCorpus *corpus)
+{
+  for (guint i = 0; i < corpus->n_fields; i++)
+    append_string_grams (grams, corpus->text + corpus->field_bytes[i]);
+}
+
+static void
+append_string_grams (GArray     *grams,
+                     const char *string)
+{
+  gunichar window[2] = { 0 };
+  guint    n_window  = 0;
+
+  /* Trigrams never span tokens, matching how `test_strings` tokenizes */
+  UTF8_FOREACH_FORWARD (ptr, string)
+  {
+    gunichar ch = 0;
+
+    if (utf8_char_class (ptr, &ch) == G_UNICODE_SPACE_SEPARATOR)
+      {
+        n_window = 0;
+        continue;
+      }
+    ch = g_unichar_tolower (ch);
+
+    if (n_window >= 2)
+      {
+        guint64 gram = 0;
+
+        gram = ((guint64) window[0] << 42) |
+               ((guint64) window[1] << 21) |
+               (guint64) ch;
+        g_array_append_val (grams, gram);
+      }
+
+    window[0] = window[1];
+    window[1] = ch;
+    n_window  = MIN (n_window + 1, 2);
+  }
+}
+
+static void
+sort_and_dedup_guint64 (GArray *array)
+{
+  guint n_unique = 1;
+
+  if (array->len < 2)
+    return;
+
+  g_array_sort (array, (GCompareFunc) cmp_guint64);
+  for (guint i = 1; i < array->len; i++)
+    {
+      if (g_array_index (array, guint64, i) != g_array_index (array, guint64, n_unique - 1))
+        g_array_index (array, guint64, n_unique++) = g_array_index (array, guint64, i);
+    }
+  g_array_set_size (array, n_unique);
+}
+
+static void
+sort_and_dedup_guint (GArray *array)
+{
+  guint n_unique = 1;
+
+  if (array->len < 2)
+    return;
+
+  g_array_sort (array, (GCompareFunc) cmp_guint);
+  for (guint i = 1; i < array->len; i++)
+    {
+      if (g_array_index (array, guint, i) != g_array_index (array, guint, n_unique - 1))
+        g_array_index (array, guint, n_unique++) = g_array_index (array, guint, i);
+    }
+  g_array_set_size (array, n_unique);
+}
+
+static gboolean
+posting_find (GArray *posting,
+              guint   doc_id,
+              guint  *idx_out)
+{
+  guint lo = 0;
+  guint hi = posting->len;
+
+  /* lower bound */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (posting, guint, mid) < doc_id)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (idx_out != NULL)
+    *idx_out = lo;
+  return lo < posting->len && g_array_index (posting, guint, lo) == doc_id;
+}
+
+static gint
+cmp_guint64 (const guint64 *a,
+             const guint64 *b)
+{
+  return (*a > *b) - (*a < *b);
+}
+
+static gint
+cmp_guint (const guint *a,
+           const guint *b)
+{
+  return (*a > *b) - (*a < *b);
+}
+
+static gint
+cmp_postings_by_length (GArray **a,
+                        GArray **b)
+{
+  return ((*a)->len > (*b)->len) - ((*a)->len < (*b)->len);
 }
 
 /* End of bz-search-engine.c */
@@ -45,10 +45,34 @@ void
 bz_search_engine_set_biases (BzSearchEngine *self,
                              GListModel     *biases);
 
+gboolean
+bz_search_engine_get_fuzzy (BzSearchEngine *self);
+
+void
+bz_search_engine_set_fuzzy (BzSearchEngine *self,
+                            gboolean        fuzzy);
+
+guint
+bz_search_engine_get_cache_hits (BzSearchEngine *self);
+
+guint
+bz_search_engine_get_cache_misses (BzSearchEngine *self);
+
 DexFuture *
 bz_search_engine_query (BzSearchEngine    *self,
                         const char *const *terms);
 
+DexFuture *
+bz_search_engine_refine_query (BzSearchEngine    *self,
+                               const char *const *terms,
+                               const char *const *previous_ids,
+                               guint              max_results);
+
+char *
+bz_search_engine_benchmark_kernels (BzSearchEngine    *self,
+                                    const char *const *queries,
+                                    guint              n_passes);
+
 G_END_DECLS
 
 /* End of bz-search-engine.h */
@@ -32,6 +32,7 @@
 #include "bz-search-filter-popover.h"
 #include "bz-search-page.h"
 #include "bz-search-pill-list.h"
+#include "bz-search-result-model.h"
 #include "bz-search-result.h"
 #include "bz-template-callbacks.h"
 #include "bz-util.h"
@@ -48,7 +49,7 @@ struct _BzSearchPage
 
   BzContentProvider *blocklists_provider;
   BzContentProvider *txt_blocklists_provider;
-  GListStore        *search_model;
+  GListModel        *search_model;
   GtkSelectionModel *selection_model;
   guint              search_update_timeout;
   DexFuture         *search_query;
@@ -109,6 +110,23 @@ search_query_then (DexFuture *future,
 static void
 update_filter (BzSearchPage *self);
 
+typedef struct
+{
+  BzCategoryFlags categories;
+  gboolean        only_verified;
+  gboolean        only_free;
+  gboolean        only_non_eol;
+  gboolean        only_mobile;
+} SearchFilter;
+
+static gboolean
+filter_hit (const BzSearchHit  *hit,
+            const SearchFilter *filter);
+
+static void
+set_search_model (BzSearchPage        *self,
+                  BzSearchResultModel *model);
+
 static void
 emit_idx (BzSearchPage *self,
           GListModel   *model,
@@ -449,14 +467,14 @@ bz_search_page_class_init (BzSearchPageClass *klass)
 static void
 bz_search_page_init (BzSearchPage *self)
 {
-  self->search_model = g_list_store_new (BZ_TYPE_SEARCH_RESULT);
+  self->search_model = G_LIST_MODEL (g_list_store_new (BZ_TYPE_SEARCH_RESULT));
 
   gtk_widget_init_template (GTK_WIDGET (self));
 
   /* TODO: move all this to blueprint */
 
   self->selection_model = GTK_SELECTION_MODEL (gtk_no_selection_new (NULL));
-  gtk_no_selection_set_model (GTK_NO_SELECTION (self->selection_model), G_LIST_MODEL (self->search_model));
+  gtk_no_selection_set_model (GTK_NO_SELECTION (self->selection_model), self->search_model);
   gtk_grid_view_set_model (self->grid_view, self->selection_model);
 
   g_signal_connect (self->search_bar, "changed", G_CALLBACK (search_changed), self);
@@ -709,66 +727,37 @@ static DexFuture *
 search_query_then (DexFuture *future,
                    GWeakRef  *wr)
 {
-  g_autoptr (BzSearchPage) self        = NULL;
-  g_autoptr (GPtrArray) filtered       = NULL;
-  BzFinishedSearchQuery *finished      = NULL;
-  GPtrArray             *results       = NULL;
-  guint                  old_length    = 0;
-  const char            *page_name     = NULL;
-  BzCategoryFlags        categories    = BZ_CATEGORY_FLAGS_NONE;
-  gboolean               only_verified = FALSE;
-  gboolean               only_free     = FALSE;
-  gboolean               only_non_eol  = FALSE;
-  gboolean               only_mobile   = FALSE;
+  g_autoptr (BzSearchPage) self            = NULL;
+  g_autoptr (BzSearchResultModel) filtered = NULL;
+  BzFinishedSearchQuery *finished          = NULL;
+  BzSearchResultModel   *results           = NULL;
+  SearchFilter           filter            = { 0 };
+  guint                  n_filtered        = 0;
+  const char            *page_name         = NULL;
 
   bz_weak_get_or_return_reject (self, wr);
 
-  finished      = g_value_get_object (dex_future_get_value (future, NULL));
-  results       = bz_finished_search_query_get_results (finished);
-  categories    = bz_search_filter_popover_get_selected_categories (self->filter_popover);
-  only_verified = bz_search_filter_popover_get_only_verified (self->filter_popover);
-  only_free     = bz_search_filter_popover_get_only_free (self->filter_popover);
-  only_non_eol  = bz_search_filter_popover_get_only_non_eol (self->filter_popover);
-  only_mobile   = bz_search_filter_popover_get_only_mobile (self->filter_popover);
-
-  filtered = g_ptr_array_new_with_free_func (g_object_unref);
-
-  for (guint i = 0; i < results->len; i++)
-    {
-      BzSearchResult *result = g_ptr_array_index (results, i);
-      BzEntryGroup   *group  = bz_search_result_get_group (result);
-
-      if (self->state != NULL)
-        /* This is for debug mode */
-        bz_search_result_set_state (result, self->state);
-
-      if (categories != BZ_CATEGORY_FLAGS_NONE &&
-          !(bz_entry_group_get_categories (group) & categories))
-        continue;
-
-      if (only_verified && !bz_entry_group_get_is_verified (group))
-        continue;
-
-      if (only_free && !bz_entry_group_get_is_floss (group))
-        continue;
-
-      if (only_non_eol && bz_entry_group_get_eol (group))
-        continue;
-
-      if (only_mobile && !bz_entry_group_get_is_mobile_friendly (group))
-        continue;
-
-      g_ptr_array_add (filtered, g_object_ref (result));
-    }
+  finished             = g_value_get_object (dex_future_get_value (future, NULL));
+  results              = bz_finished_search_query_get_results (finished);
+  filter.categories    = bz_search_filter_popover_get_selected_categories (self->filter_popover);
+  filter.only_verified = bz_search_filter_popover_get_only_verified (self->filter_popover);
+  filter.only_free     = bz_search_filter_popover_get_only_free (self->filter_popover);
+  filter.only_non_eol  = bz_search_filter_popover_get_only_non_eol (self->filter_popover);
+  filter.only_mobile   = bz_search_filter_popover_get_only_mobile (self->filter_popover);
+
+  /* Filter on the groups directly so that only results which actually get
+     displayed are ever turned into objects */
+  filtered = bz_search_result_model_filter (
+      results, (BzSearchHitFilterFunc) filter_hit, &filter);
+  if (self->state != NULL)
+    /* This is for debug mode */
+    bz_search_result_model_set_state (filtered, self->state);
 
-  old_length = g_list_model_get_n_items (G_LIST_MODEL (self->search_model));
-  g_list_store_splice (
-      self->search_model,
-      0, old_length,
-      (gpointer *) filtered->pdata, filtered->len);
+  n_filtered = g_list_model_get_n_items (G_LIST_MODEL (filtered));
+  set_search_model (self, filtered);
   gtk_widget_set_visible (GTK_WIDGET (self->search_busy), FALSE);
 
-  if (filtered->len > 0)
+  if (n_filtered > 0)
     {
       page_name = "results";
       gtk_widget_activate_action (GTK_WIDGET (self->grid_view), "list.scroll-to-item", "u", 0);
@@ -820,7 +809,7 @@ update_filter (BzSearchPage *self)
 
   if (search_text == NULL || *search_text == '\0')
     {
-      g_list_store_remove_all (self->search_model);
+      set_search_model (self, NULL);
       gtk_stack_set_visible_child_name (self->search_stack, "empty");
       return;
     }
@@ -841,7 +830,7 @@ update_filter (BzSearchPage *self)
 
   if (n_terms == 0)
     {
-      g_list_store_remove_all (self->search_model);
+      set_search_model (self, NULL);
       gtk_stack_set_visible_child_name (self->search_stack, "empty");
       return;
     }
@@ -864,6 +853,44 @@ update_filter (BzSearchPage *self)
   self->search_query = g_steal_pointer (&future);
 }
 
+static gboolean
+filter_hit (const BzSearchHit  *hit,
+            const SearchFilter *filter)
+{
+  BzEntryGroup *group = hit->group;
+
+  if (filter->categories != BZ_CATEGORY_FLAGS_NONE &&
+      !(bz_entry_group_get_categories (group) & filter->categories))
+    return FALSE;
+
+  if (filter->only_verified && !bz_entry_group_get_is_verified (group))
+    return FALSE;
+
+  if (filter->only_free && !bz_entry_group_get_is_floss (group))
+    return FALSE;
+
+  if (filter->only_non_eol && bz_entry_group_get_eol (group))
+    return FALSE;
+
+  if (filter->only_mobile && !bz_entry_group_get_is_mobile_friendly (group))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+set_search_model (BzSearchPage        *self,
+                  BzSearchResultModel *model)
+{
+  g_clear_object (&self->search_model);
+  if (model != NULL)
+    self->search_model = G_LIST_MODEL (g_object_ref (model));
+  else
+    self->search_model = G_LIST_MODEL (g_list_store_new (BZ_TYPE_SEARCH_RESULT));
+
+  gtk_no_selection_set_model (GTK_NO_SELECTION (self->selection_model), self->search_model);
+}
+
 static void
 emit_idx (BzSearchPage *self,
           GListModel   *model,
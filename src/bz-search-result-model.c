@@ -0,0 +1,237 @@
+/* bz-search-result-model.c
+ *
+ * Copyright 2026 agent
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "BAZAAR::SEARCH-RESULT-MODEL"
+
+#include "bz-search-result-model.h"
+#include "bz-search-result.h"
+
+/* An immutable, sorted list of search hits which only creates
+   BzSearchResult objects for the items that are actually looked at */
+struct _BzSearchResultModel
+{
+  GObject parent_instance;
+
+  GArray      *hits;
+  GPtrArray   *results;
+  BzStateInfo *state;
+};
+
+static void list_model_iface_init (GListModelInterface *iface);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (
+    BzSearchResultModel,
+    bz_search_result_model,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL, list_model_iface_init))
+
+static void
+clear_hit (BzSearchHit *hit);
+
+static void
+unref_result (gpointer result);
+
+static void
+bz_search_result_model_dispose (GObject *object)
+{
+  BzSearchResultModel *self = BZ_SEARCH_RESULT_MODEL (object);
+
+  g_clear_pointer (&self->hits, g_array_unref);
+  g_clear_pointer (&self->results, g_ptr_array_unref);
+  g_clear_object (&self->state);
+
+  G_OBJECT_CLASS (bz_search_result_model_parent_class)->dispose (object);
+}
+
+static void
+bz_search_result_model_class_init (BzSearchResultModelClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = bz_search_result_model_dispose;
+}
+
+static void
+bz_search_result_model_init (BzSearchResultModel *self)
+{
+  self->results = g_ptr_array_new_with_free_func (unref_result);
+}
+
+static GType
+list_model_get_item_type (GListModel *list)
+{
+  return BZ_TYPE_SEARCH_RESULT;
+}
+
+static guint
+list_model_get_n_items (GListModel *list)
+{
+  BzSearchResultModel *self = BZ_SEARCH_RESULT_MODEL (list);
+  return self->hits != NULL ? self->hits->len : 0;
+}
+
+static gpointer
+list_model_get_item (GListModel *list,
+                     guint       position)
+{
+  BzSearchResultModel *self   = BZ_SEARCH_RESULT_MODEL (list);
+  BzSearchHit         *hit    = NULL;
+  BzSearchResult      *result = NULL;
+
+  if (self->hits == NULL || position >= self->hits->len)
+    return NULL;
+
+  result = g_ptr_array_index (self->results, position);
+  if (result == NULL)
+    {
+      hit    = &g_array_index (self->hits, BzSearchHit, position);
+      result = bz_search_result_new ();
+      bz_search_result_set_group (result, hit->group);
+      bz_search_result_set_original_index (result, hit->original_index);
+      bz_search_result_set_score (result, hit->score);
+      if (self->state != NULL)
+        bz_search_result_set_state (result, self->state);
+
+      g_ptr_array_index (self->results, position) = result;
+    }
+
+  return g_object_ref (result);
+}
+
+static void
+list_model_iface_init (GListModelInterface *iface)
+{
+  iface->get_item_type = list_model_get_item_type;
+  iface->get_n_items   = list_model_get_n_items;
+  iface->get_item      = list_model_get_item;
+}
+
+GArray *
+bz_search_hit_array_new (guint reserved_size)
+{
+  GArray *hits = NULL;
+
+  hits = g_array_sized_new (FALSE, FALSE, sizeof (BzSearchHit), reserved_size);
+  g_array_set_clear_func (hits, (GDestroyNotify) clear_hit);
+
+  return hits;
+}
+
+BzSearchResultModel *
+bz_search_result_model_new (GArray *hits)
+{
+  BzSearchResultModel *self = NULL;
+
+  g_return_val_if_fail (hits != NULL, NULL);
+  g_return_val_if_fail (g_array_get_element_size (hits) == sizeof (BzSearchHit), NULL);
+
+  self       = g_object_new (BZ_TYPE_SEARCH_RESULT_MODEL, NULL);
+  self->hits = g_array_ref (hits);
+  g_ptr_array_set_size (self->results, hits->len);
+
+  return self;
+}
+
+const BzSearchHit *
+bz_search_result_model_get_hit (BzSearchResultModel *self,
+                                guint                position)
+{
+  g_return_val_if_fail (BZ_IS_SEARCH_RESULT_MODEL (self), NULL);
+  g_return_val_if_fail (self->hits != NULL && position < self->hits->len, NULL);
+
+  return &g_array_index (self->hits, BzSearchHit, position);
+}
+
+BzSearchResultModel *
+bz_search_result_model_filter (BzSearchResultModel  *self,
+                               BzSearchHitFilterFunc func,
+                               gpointer              user_data)
+{
+  g_autoptr (GArray) hits               = NULL;
+  g_autoptr (BzSearchResultModel) model = NULL;
+
+  g_return_val_if_fail (BZ_IS_SEARCH_RESULT_MODEL (self), NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  hits = bz_search_hit_array_new (self->hits != NULL ? self->hits->len : 0);
+  for (guint i = 0; self->hits != NULL && i < self->hits->len; i++)
+    {
+      BzSearchHit *hit  = NULL;
+      BzSearchHit  copy = { 0 };
+
+      hit = &g_array_index (self->hits, BzSearchHit, i);
+      if (!func (hit, user_data))
+        continue;
+
+      copy       = *hit;
+      copy.group = g_object_ref (hit->group);
+      g_array_append_val (hits, copy);
+    }
+
+  model = bz_search_result_model_new (hits);
+  if (self->state != NULL)
+    bz_search_result_model_set_state (model, self->state);
+
+  return g_steal_pointer (&model);
+}
+
+void
+bz_search_result_model_set_state (BzSearchResultModel *self,
+                                  BzStateInfo         *state)
+{
+  g_return_if_fail (BZ_IS_SEARCH_RESULT_MODEL (self));
+  g_return_if_fail (state == NULL || BZ_IS_STATE_INFO (state));
+
+  g_clear_object (&self->state);
+  if (state != NULL)
+    self->state = g_object_ref (state);
+
+  for (guint i = 0; i < self->results->len; i++)
+    {
+      BzSearchResult *result = NULL;
+
+      result = g_ptr_array_index (self->results, i);
+      if (result != NULL)
+        bz_search_result_set_state (result, state);
+    }
+}
+
+BzStateInfo *
+bz_search_result_model_get_state (BzSearchResultModel *self)
+{
+  g_return_val_if_fail (BZ_IS_SEARCH_RESULT_MODEL (self), NULL);
+  return self->state;
+}
+
+static void
+clear_hit (BzSearchHit *hit)
+{
+  g_clear_object (&hit->group);
+}
+
+static void
+unref_result (gpointer result)
+{
+  /* Most results are never materialized */
+  if (result != NULL)
+    g_object_unref (result);
+}
+
+/* End of bz-search-result-model.c */
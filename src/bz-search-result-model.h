@@ -0,0 +1,67 @@
+/* bz-search-result-model.h
+ *
+ * Copyright 2026 agent
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "bz-entry-group.h"
+#include "bz-state-info.h"
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  BzEntryGroup *group;
+  guint         original_index;
+  double        score;
+} BzSearchHit;
+
+typedef gboolean (*BzSearchHitFilterFunc) (const BzSearchHit *hit,
+                                           gpointer           user_data);
+
+GArray *
+bz_search_hit_array_new (guint reserved_size);
+
+#define BZ_TYPE_SEARCH_RESULT_MODEL (bz_search_result_model_get_type ())
+G_DECLARE_FINAL_TYPE (BzSearchResultModel, bz_search_result_model, BZ, SEARCH_RESULT_MODEL, GObject)
+
+BzSearchResultModel *
+bz_search_result_model_new (GArray *hits);
+
+const BzSearchHit *
+bz_search_result_model_get_hit (BzSearchResultModel *self,
+                                guint                position);
+
+BzSearchResultModel *
+bz_search_result_model_filter (BzSearchResultModel  *self,
+                               BzSearchHitFilterFunc func,
+                               gpointer              user_data);
+
+void
+bz_search_result_model_set_state (BzSearchResultModel *self,
+                                  BzStateInfo         *state);
+
+BzStateInfo *
+bz_search_result_model_get_state (BzSearchResultModel *self);
+
+G_END_DECLS
+
+/* End of bz-search-result-model.h */
@@ -18,10 +18,32 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <gio/gio.h>
+
 #include "bz-serializable.h"
 
 G_DEFINE_INTERFACE (BzSerializable, bz_serializable, G_TYPE_OBJECT)
 
+static const char *const packed_formats[] = {
+  [BZ_SERIALIZABLE_FIELD_BOOLEAN] = "b",
+  [BZ_SERIALIZABLE_FIELD_INT32]   = "i",
+  [BZ_SERIALIZABLE_FIELD_UINT32]  = "u",
+  [BZ_SERIALIZABLE_FIELD_UINT64]  = "t",
+  [BZ_SERIALIZABLE_FIELD_STRING]  = "ms",
+};
+
+/* What the same fields looked like as a{sv} values */
+static const char *const legacy_formats[] = {
+  [BZ_SERIALIZABLE_FIELD_BOOLEAN] = "b",
+  [BZ_SERIALIZABLE_FIELD_INT32]   = "i",
+  [BZ_SERIALIZABLE_FIELD_UINT32]  = "u",
+  [BZ_SERIALIZABLE_FIELD_UINT64]  = "t",
+  [BZ_SERIALIZABLE_FIELD_STRING]  = "s",
+};
+
+static const GVariantType *
+ensure_schema_type (BzSerializableSchema *schema);
+
 static void
 bz_serializable_real_serialize (BzSerializable  *self,
                                 GVariantBuilder *builder)
@@ -69,3 +91,142 @@ bz_serializable_deserialize (BzSerializable *self,
       import,
       error);
 }
+
+GVariant *
+bz_serializable_schema_pack (BzSerializableSchema *schema,
+                             gconstpointer         instance)
+{
+  g_autoptr (GVariantBuilder) builder = NULL;
+
+  g_return_val_if_fail (schema != NULL, NULL);
+  g_return_val_if_fail (instance != NULL, NULL);
+
+  builder = g_variant_builder_new (ensure_schema_type (schema));
+  g_variant_builder_add (builder, "u", schema->version);
+
+  for (guint i = 0; i < schema->n_fields; i++)
+    {
+      const BzSerializableField *field  = &schema->fields[i];
+      gconstpointer              member = (const guint8 *) instance + field->offset;
+
+      switch (field->kind)
+        {
+        case BZ_SERIALIZABLE_FIELD_BOOLEAN:
+          g_variant_builder_add (builder, "b", *(const gboolean *) member);
+          break;
+        case BZ_SERIALIZABLE_FIELD_INT32:
+          g_variant_builder_add (builder, "i", *(const gint32 *) member);
+          break;
+        case BZ_SERIALIZABLE_FIELD_UINT32:
+          g_variant_builder_add (builder, "u", *(const guint32 *) member);
+          break;
+        case BZ_SERIALIZABLE_FIELD_UINT64:
+          g_variant_builder_add (builder, "t", *(const guint64 *) member);
+          break;
+        case BZ_SERIALIZABLE_FIELD_STRING:
+          g_variant_builder_add (builder, "ms", *(const char *const *) member);
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+    }
+
+  return g_variant_builder_end (builder);
+}
+
+gboolean
+bz_serializable_schema_unpack (BzSerializableSchema *schema,
+                               gpointer              instance,
+                               GVariant             *packed,
+                               GError              **error)
+{
+  const GVariantType *type    = NULL;
+  guint32             version = 0;
+
+  g_return_val_if_fail (schema != NULL, FALSE);
+  g_return_val_if_fail (instance != NULL, FALSE);
+  g_return_val_if_fail (packed != NULL, FALSE);
+
+  type = ensure_schema_type (schema);
+  if (!g_variant_is_of_type (packed, type))
+    {
+      g_autofree char *expected = NULL;
+
+      expected = g_variant_type_dup_string (type);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Packed fields have type '%s', expected '%s'",
+                   g_variant_get_type_string (packed), expected);
+      return FALSE;
+    }
+
+  g_variant_get_child (packed, 0, "u", &version);
+  if (version != schema->version)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Packed fields are schema version %u, expected %u",
+                   version, schema->version);
+      return FALSE;
+    }
+
+  for (guint i = 0; i < schema->n_fields; i++)
+    {
+      const BzSerializableField *field  = &schema->fields[i];
+      gpointer                   member = (guint8 *) instance + field->offset;
+
+      if (field->kind == BZ_SERIALIZABLE_FIELD_STRING)
+        g_clear_pointer ((char **) member, g_free);
+      g_variant_get_child (packed, i + 1, packed_formats[field->kind], member);
+    }
+
+  return TRUE;
+}
+
+gboolean
+bz_serializable_schema_unpack_legacy (BzSerializableSchema *schema,
+                                      gpointer              instance,
+                                      const char           *key,
+                                      GVariant             *value)
+{
+  g_return_val_if_fail (schema != NULL, FALSE);
+  g_return_val_if_fail (instance != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  for (guint i = 0; i < schema->n_fields; i++)
+    {
+      const BzSerializableField *field  = &schema->fields[i];
+      gpointer                   member = (guint8 *) instance + field->offset;
+      const char                *format = legacy_formats[field->kind];
+
+      if (g_strcmp0 (field->key, key) != 0)
+        continue;
+
+      if (g_variant_is_of_type (value, G_VARIANT_TYPE (format)))
+        {
+          if (field->kind == BZ_SERIALIZABLE_FIELD_STRING)
+            g_clear_pointer ((char **) member, g_free);
+          g_variant_get (value, format, member);
+        }
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static const GVariantType *
+ensure_schema_type (BzSerializableSchema *schema)
+{
+  if (g_once_init_enter (&schema->type))
+    {
+      g_autoptr (GString) string = NULL;
+
+      string = g_string_new ("(u");
+      for (guint i = 0; i < schema->n_fields; i++)
+        g_string_append (string, packed_formats[schema->fields[i].kind]);
+      g_string_append_c (string, ')');
+
+      g_once_init_leave (&schema->type, g_variant_type_new (string->str));
+    }
+
+  return schema->type;
+}
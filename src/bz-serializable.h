@@ -48,4 +48,52 @@ bz_serializable_deserialize (BzSerializable *self,
                              GVariant       *import,
                              GError        **error);
 
+/* Plain fields can be described by a table and packed into a
+ * fixed-position tuple, so decoding needs no key lookups
+ */
+typedef enum
+{
+  BZ_SERIALIZABLE_FIELD_BOOLEAN,
+  BZ_SERIALIZABLE_FIELD_INT32,
+  BZ_SERIALIZABLE_FIELD_UINT32,
+  BZ_SERIALIZABLE_FIELD_UINT64,
+  BZ_SERIALIZABLE_FIELD_STRING,
+} BzSerializableFieldKind;
+
+typedef struct
+{
+  const char             *key;
+  BzSerializableFieldKind kind;
+  gsize                   offset;
+} BzSerializableField;
+
+#define BZ_SERIALIZABLE_FIELD(_key, _kind, _struct, _member) \
+  { (_key), BZ_SERIALIZABLE_FIELD_##_kind, G_STRUCT_OFFSET (_struct, _member) }
+
+typedef struct
+{
+  guint32                    version;
+  const BzSerializableField *fields;
+  guint                      n_fields;
+
+  /* Filled in on first use */
+  GVariantType *type;
+} BzSerializableSchema;
+
+GVariant *
+bz_serializable_schema_pack (BzSerializableSchema *schema,
+                             gconstpointer         instance);
+
+gboolean
+bz_serializable_schema_unpack (BzSerializableSchema *schema,
+                               gpointer              instance,
+                               GVariant             *packed,
+                               GError              **error);
+
+gboolean
+bz_serializable_schema_unpack_legacy (BzSerializableSchema *schema,
+                                      gpointer              instance,
+                                      const char           *key,
+                                      GVariant             *value);
+
 G_END_DECLS
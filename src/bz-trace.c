@@ -0,0 +1,204 @@
+/* bz-trace.c
+ *
+ * Copyright 2026 agent
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include "bz-trace.h"
+#include "bz-env.h"
+
+struct _BzTraceSpan
+{
+  const char *name;
+  guint       id;
+  guint       tid;
+  gint64      begin;
+  gint64      end;
+};
+
+static GMutex       trace_mutex;
+static GPrivate     trace_tid    = G_PRIVATE_INIT (NULL);
+static GArray      *trace_spans  = NULL;
+static GThreadPool *trace_writer = NULL;
+static guint        next_span_id = 0;
+static guint        next_tid     = 0;
+
+static void
+write_spans (GArray  *spans,
+             gpointer user_data);
+
+static guint
+get_tid (void)
+{
+  guint tid = 0;
+
+  /* Chrome traces only need a stable number per thread, and
+   * small ones keep the exported file readable
+   */
+  tid = GPOINTER_TO_UINT (g_private_get (&trace_tid));
+  if (tid == 0)
+    {
+      tid = g_atomic_int_add (&next_tid, 1) + 1;
+      g_private_set (&trace_tid, GUINT_TO_POINTER (tid));
+    }
+
+  return tid;
+}
+
+BzTraceSpan *
+bz_trace_span_begin (const char *name)
+{
+  BzTraceSpan *span = NULL;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  if (bz_get_trace_file () == NULL)
+    return NULL;
+
+  span        = g_new0 (BzTraceSpan, 1);
+  span->name  = name;
+  span->id    = g_atomic_int_add (&next_span_id, 1) + 1;
+  span->tid   = get_tid ();
+  span->begin = g_get_monotonic_time ();
+
+  return span;
+}
+
+void
+bz_trace_span_end (BzTraceSpan *span)
+{
+  if (span == NULL)
+    return;
+
+  span->end = g_get_monotonic_time ();
+
+  g_mutex_lock (&trace_mutex);
+  if (trace_spans == NULL)
+    trace_spans = g_array_new (FALSE, FALSE, sizeof (BzTraceSpan));
+  g_array_append_val (trace_spans, *span);
+  g_mutex_unlock (&trace_mutex);
+
+  g_free (span);
+}
+
+/* Hands the spans ended since the last flush to a single
+ * writer thread, which appends them to the trace file in
+ * order, so memory stays bounded and nothing is formatted
+ * or written on the caller's thread
+ */
+void
+bz_trace_flush (void)
+{
+  g_autoptr (GArray) spans = NULL;
+
+  if (bz_get_trace_file () == NULL)
+    return;
+
+  g_mutex_lock (&trace_mutex);
+  spans = g_steal_pointer (&trace_spans);
+  if (spans != NULL && trace_writer == NULL)
+    trace_writer = g_thread_pool_new (
+        (GFunc) write_spans, NULL,
+        1, FALSE, NULL);
+  if (spans != NULL)
+    g_thread_pool_push (trace_writer, g_steal_pointer (&spans), NULL);
+  g_mutex_unlock (&trace_mutex);
+}
+
+void
+bz_trace_finish (void)
+{
+  GThreadPool *writer = NULL;
+
+  bz_trace_flush ();
+
+  g_mutex_lock (&trace_mutex);
+  writer = g_steal_pointer (&trace_writer);
+  g_mutex_unlock (&trace_mutex);
+
+  /* Waits for every queued batch to be written */
+  if (writer != NULL)
+    g_thread_pool_free (writer, FALSE, TRUE);
+}
+
+static void
+write_spans (GArray  *spans,
+             gpointer user_data)
+{
+  static gboolean started    = FALSE;
+  g_autoptr (GArray) owned   = spans;
+  g_autoptr (GString) events = NULL;
+  const char *path           = NULL;
+  int         pid            = 0;
+  int         fd             = -1;
+
+  path   = bz_get_trace_file ();
+  pid    = (int) getpid ();
+  events = g_string_new (NULL);
+
+  /* This is the Chrome JSON array format, which may be left
+   * unterminated so that every flush can simply append.
+   * Fibers interleave on the same thread, so spans are
+   * written as async begin/end pairs which may overlap.
+   */
+  if (!started)
+    g_string_append (events, "[\n");
+  for (guint i = 0; i < spans->len; i++)
+    {
+      BzTraceSpan *span = NULL;
+
+      span = &g_array_index (spans, BzTraceSpan, i);
+      g_string_append_printf (
+          events,
+          "{\"name\":\"%s\",\"cat\":\"bazaar\",\"ph\":\"b\","
+          "\"id\":%u,\"pid\":%d,\"tid\":%u,\"ts\":%" G_GINT64_FORMAT "},\n"
+          "{\"name\":\"%s\",\"cat\":\"bazaar\",\"ph\":\"e\","
+          "\"id\":%u,\"pid\":%d,\"tid\":%u,\"ts\":%" G_GINT64_FORMAT "},\n",
+          span->name, span->id, pid, span->tid, span->begin,
+          span->name, span->id, pid, span->tid, span->end);
+    }
+
+  /* Only this thread ever writes, so `started` needs no lock */
+  fd = g_open (path, O_WRONLY | O_CREAT | O_CLOEXEC | (started ? O_APPEND : O_TRUNC), 0644);
+  if (fd < 0)
+    {
+      g_warning ("Failed to open trace file %s: %s", path, g_strerror (errno));
+      return;
+    }
+  started = TRUE;
+
+  for (gsize written = 0; written < events->len;)
+    {
+      gssize n = 0;
+
+      n = write (fd, events->str + written, events->len - written);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        {
+          g_warning ("Failed to write trace to %s: %s", path, g_strerror (errno));
+          break;
+        }
+      written += n;
+    }
+  close (fd);
+}
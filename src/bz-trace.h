@@ -0,0 +1,45 @@
+/* bz-trace.h
+ *
+ * Copyright 2026 agent
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _BzTraceSpan BzTraceSpan;
+
+/* Returns NULL when tracing is disabled; name must be static */
+BzTraceSpan *
+bz_trace_span_begin (const char *name);
+
+void
+bz_trace_span_end (BzTraceSpan *span);
+
+void
+bz_trace_flush (void);
+
+/* Like bz_trace_flush, but waits until everything is written */
+void
+bz_trace_finish (void);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BzTraceSpan, bz_trace_span_end);
+
+G_END_DECLS
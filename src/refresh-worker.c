@@ -20,11 +20,15 @@
 
 #define G_LOG_DOMAIN "BAZAAR::REFRESH-WORKER"
 
+#include <string.h>
+
 #include "bz-backend-notification.h"
 #include "bz-backend.h"
 #include "bz-entry-cache-manager.h"
 #include "bz-env.h"
 #include "bz-flatpak-instance.h"
+#include "bz-refresh-delta.h"
+#include "bz-serializable.h"
 #include "bz-util.h"
 
 BZ_DEFINE_DATA (
@@ -33,14 +37,36 @@ BZ_DEFINE_DATA (
     {
       GMainLoop  *loop;
       GIOChannel *stdout_channel;
+      gboolean    emit_deltas;
       int         rv;
     },
     BZ_RELEASE_DATA (loop, g_main_loop_unref);
     BZ_RELEASE_DATA (stdout_channel, g_io_channel_unref));
 
+BZ_DEFINE_DATA (
+    write_back,
+    WriteBack,
+    {
+      MainData          *main;
+      BzEntry           *entry;
+      BzRefreshDeltaKind kind;
+    },
+    BZ_RELEASE_DATA (main, main_data_unref);
+    BZ_RELEASE_DATA (entry, g_object_unref));
+
 static DexFuture *
 run (MainData *data);
 
+static DexFuture *
+write_back_finally (DexFuture     *future,
+                    WriteBackData *data);
+
+static void
+emit_delta (MainData          *data,
+            BzRefreshDeltaKind kind,
+            const char        *checksum,
+            BzEntry           *entry);
+
 int
 main (int   argc,
       char *argv[])
@@ -64,6 +90,12 @@ main (int   argc,
   data->stdout_channel = g_io_channel_ref (stdout_channel);
   data->rv             = EXIT_SUCCESS;
 
+  for (int i = 1; i < argc; i++)
+    {
+      if (g_strcmp0 (argv[i], BZ_REFRESH_DELTA_ARG) == 0)
+        data->emit_deltas = TRUE;
+    }
+
   future = dex_scheduler_spawn (
       dex_scheduler_get_default (),
       bz_get_dex_stack_size (),
@@ -82,29 +114,52 @@ run (MainData *data)
   g_autoptr (BzEntryCacheManager) cache = NULL;
   g_autoptr (BzFlatpakInstance) flatpak = NULL;
   g_autoptr (DexChannel) channel        = NULL;
+  g_autoptr (DexFuture) remotes_future  = NULL;
+  gboolean partial                      = FALSE;
   g_autoptr (GHashTable) installed_set  = NULL;
   g_autoptr (DexFuture) all_notifs      = NULL;
   guint n_notifs                        = 0;
   g_autoptr (GPtrArray) write_backs     = NULL;
+  g_autoptr (GHashTable) live_set       = NULL;
+  g_autoptr (GHashTable) prior_set      = NULL;
+  gboolean cached                       = TRUE;
 
   cache = bz_entry_cache_manager_new ();
 
+  /* What was cached before this refresh is the baseline the
+   * deltas are relative to, and tells the backend which
+   * unchanged remotes it may skip
+   */
+  prior_set = dex_await_boxed (
+      bz_entry_cache_manager_enumerate_disk (cache),
+      &local_error);
+  if (prior_set == NULL)
+    {
+      g_warning ("Unable to enumerate the entry cache, every remote will be "
+                 "enumerated and every entry reported as added: %s",
+                 local_error->message);
+      g_clear_error (&local_error);
+    }
+
   flatpak = dex_await_object (
       bz_flatpak_instance_new (),
       &local_error);
   if (flatpak == NULL)
     goto err;
+  bz_flatpak_instance_set_cached_entries (flatpak, prior_set);
 
   channel = bz_backend_create_notification_channel (BZ_BACKEND (flatpak));
   if (channel == NULL)
     goto err;
 
-  result = dex_await (
-      bz_backend_retrieve_remote_entries (
-          BZ_BACKEND (flatpak), NULL),
-      &local_error);
+  remotes_future = bz_backend_retrieve_remote_entries (BZ_BACKEND (flatpak), NULL);
+  result         = dex_await (dex_ref (remotes_future), &local_error);
   if (!result)
     goto err;
+  /* Remotes that failed resolve with an error string
+   * instead, and their entries never arrive
+   */
+  partial = G_VALUE_HOLDS_STRING (dex_future_get_value (remotes_future, NULL));
 
   installed_set = dex_await_boxed (
       bz_backend_retrieve_install_ids (
@@ -117,6 +172,7 @@ run (MainData *data)
   n_notifs   = dex_future_set_get_size (DEX_FUTURE_SET (all_notifs));
 
   write_backs = g_ptr_array_new_with_free_func (dex_unref);
+  live_set    = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   for (guint i = 0; i < n_notifs; i++)
     {
       DexFuture *future                       = NULL;
@@ -133,25 +189,117 @@ run (MainData *data)
       kind = bz_backend_notification_get_kind (notif);
       if (kind == BZ_BACKEND_NOTIFICATION_KIND_REPLACE_ENTRY)
         {
-          BzEntry    *entry     = NULL;
-          const char *unique_id = NULL;
+          BzEntry    *entry      = NULL;
+          const char *unique_id  = NULL;
+          const char *checksum   = NULL;
+          DexFuture  *write_back = NULL;
 
           entry     = bz_backend_notification_get_entry (notif);
           unique_id = bz_entry_get_unique_id (entry);
+          checksum  = bz_entry_get_unique_id_checksum (entry);
           bz_entry_set_installed (entry, g_hash_table_contains (installed_set, unique_id));
 
-          g_ptr_array_add (
-              write_backs,
-              bz_entry_cache_manager_add (cache, entry));
+          write_back = bz_entry_cache_manager_add (cache, entry);
+          if (data->emit_deltas && checksum != NULL)
+            {
+              g_autoptr (WriteBackData) write_back_data = NULL;
+
+              /* Report the entry the moment its write
+               * settles instead of after all of them
+               */
+              write_back_data        = write_back_data_new ();
+              write_back_data->main  = main_data_ref (data);
+              write_back_data->entry = g_object_ref (entry);
+              write_back_data->kind  = prior_set != NULL && g_hash_table_contains (prior_set, checksum)
+                                           ? BZ_REFRESH_DELTA_KIND_CHANGED
+                                           : BZ_REFRESH_DELTA_KIND_ADDED;
+
+              write_back = dex_future_finally (
+                  write_back,
+                  (DexFutureCallback) write_back_finally,
+                  write_back_data_ref (write_back_data),
+                  write_back_data_unref);
+            }
+          g_ptr_array_add (write_backs, write_back);
+          if (checksum != NULL)
+            g_hash_table_add (live_set, g_strdup (checksum));
+        }
+      else if (kind == BZ_BACKEND_NOTIFICATION_KIND_RETAIN_ENTRIES)
+        {
+          GHashTable    *checksums = NULL;
+          GHashTableIter iter      = { 0 };
+
+          /* Still cached from an earlier refresh */
+          checksums = bz_backend_notification_get_checksums (notif);
+          g_hash_table_iter_init (&iter, checksums);
+          for (;;)
+            {
+              const char *checksum = NULL;
+
+              if (!g_hash_table_iter_next (&iter, (gpointer *) &checksum, NULL))
+                break;
+              g_hash_table_add (live_set, g_strdup (checksum));
+            }
         }
+      else if (kind == BZ_BACKEND_NOTIFICATION_KIND_ERROR)
+        partial = TRUE;
     }
   if (write_backs->len > 0)
-    dex_await (
+    cached = dex_await (
         dex_future_allv (
             (DexFuture *const *) write_backs->pdata,
             write_backs->len),
         NULL);
 
+  /* Only now may those remotes be skipped next time */
+  if (cached)
+    {
+      result = bz_flatpak_instance_commit_remote_fingerprints (flatpak, &local_error);
+      if (!result)
+        {
+          g_warning ("Failed to record remote fingerprints: %s", local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+
+  /* Removals can only be known once everything arrived */
+  if (data->emit_deltas && !partial && prior_set != NULL)
+    {
+      GHashTableIter iter = { 0 };
+
+      g_hash_table_iter_init (&iter, prior_set);
+      for (;;)
+        {
+          const char *checksum = NULL;
+
+          if (!g_hash_table_iter_next (&iter, (gpointer *) &checksum, NULL))
+            break;
+          if (!g_hash_table_contains (live_set, checksum))
+            emit_delta (data, BZ_REFRESH_DELTA_KIND_REMOVED, checksum, NULL);
+        }
+    }
+
+  /* Every entry that still exists was just sent to us, so
+   * anything else in the cache belongs to an entry that
+   * left its remote or a remote that was removed. Don't
+   * trust an incomplete picture though.
+   */
+  if (!partial && g_hash_table_size (live_set) > 0)
+    {
+      result = dex_await (
+          bz_entry_cache_manager_collect_garbage (
+              cache, live_set,
+              bz_get_entry_cache_max_size ()),
+          &local_error);
+      if (!result)
+        {
+          g_warning ("Failed to collect entry cache garbage: %s", local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+  else
+    g_debug ("Skipping entry cache garbage collection after an incomplete refresh");
+
   data->rv = EXIT_SUCCESS;
   g_main_loop_quit (data->loop);
   return dex_future_new_true ();
@@ -163,3 +311,70 @@ err:
   g_main_loop_quit (data->loop);
   return dex_future_new_false ();
 }
+
+static DexFuture *
+write_back_finally (DexFuture     *future,
+                    WriteBackData *data)
+{
+  const GValue *value = NULL;
+
+  /* Resolves to FALSE when the record was already cached
+   * as is. A failed write is reported anyway since the
+   * payload travels with the delta.
+   */
+  value = dex_future_get_value (future, NULL);
+  if (value == NULL || g_value_get_boolean (value))
+    emit_delta (
+        data->main, data->kind,
+        bz_entry_get_unique_id_checksum (data->entry),
+        data->entry);
+
+  /* Keep the outcome for whoever waits on all writes */
+  return dex_ref (future);
+}
+
+static void
+emit_delta (MainData          *data,
+            BzRefreshDeltaKind kind,
+            const char        *checksum,
+            BzEntry           *entry)
+{
+  g_autoptr (GError) local_error = NULL;
+  g_autoptr (GBytes) bytes       = NULL;
+  BzRefreshDeltaFrame frame      = { 0 };
+  g_autoptr (GByteArray) output  = NULL;
+  GIOStatus status               = G_IO_STATUS_NORMAL;
+
+  if (entry != NULL)
+    {
+      g_autoptr (GVariantBuilder) builder = NULL;
+      g_autoptr (GVariant) variant        = NULL;
+
+      builder = g_variant_builder_new (G_VARIANT_TYPE_VARDICT);
+      bz_serializable_serialize (BZ_SERIALIZABLE (entry), builder);
+      variant = g_variant_builder_end (builder);
+      bytes   = g_variant_get_data_as_bytes (variant);
+    }
+  else
+    bytes = g_bytes_new (NULL, 0);
+
+  frame.kind            = kind;
+  frame.checksum_length = strlen (checksum);
+  frame.digest          = bz_entry_cache_manager_digest (bytes);
+  frame.length          = g_bytes_get_size (bytes);
+
+  /* Write each frame in one go */
+  output = g_byte_array_sized_new (sizeof (frame) + frame.checksum_length + frame.length);
+  g_byte_array_append (output, (const guint8 *) &frame, sizeof (frame));
+  g_byte_array_append (output, (const guint8 *) checksum, frame.checksum_length);
+  g_byte_array_append (output, g_bytes_get_data (bytes, NULL), frame.length);
+
+  status = g_io_channel_write_chars (
+      data->stdout_channel,
+      (const char *) output->data, output->len,
+      NULL, &local_error);
+  if (status != G_IO_STATUS_NORMAL)
+    g_warning ("Failed to emit refresh delta for %s: %s",
+               checksum,
+               local_error != NULL ? local_error->message : "unknown error");
+}